@@ -0,0 +1,488 @@
+#include "ft_ping.h"
+
+/* Largest buffer checked or timed (the largest ICMP payload over IPv4) */
+#define BENCH_MAX_SIZE 65515
+
+/* Random buffers checked against the reference at each size */
+#define BENCH_RANDOM_ROUNDS 2000
+
+/* Minimum time spent timing one case */
+#define BENCH_MIN_NS (NSEC_PER_SEC / 5)
+
+/* Round-trip times fed to the statistics (power of two) */
+#define BENCH_RTT_SAMPLES 4096
+
+/* State shared by the timed operations */
+typedef struct s_bench {
+    t_checksum_impl impl;           /* Checksum implementation being timed */
+    t_packet_template tpl;          /* Echo request template */
+    t_send_batch send_batch;        /* Send batch filled from the template */
+    t_ping_stats stats;             /* Statistics fed with RTT samples */
+    double rtts[BENCH_RTT_SAMPLES]; /* Round-trip times in milliseconds */
+    uint8_t *buffer;                /* Scratch buffer (BENCH_MAX_SIZE + 64 bytes) */
+    uint8_t **replies;              /* Echo replies with their IP header */
+    t_target_table index;           /* Reply index over the benchmark targets */
+    t_sockaddr *addrs;              /* Addresses of the indexed targets */
+    int size;                       /* Packet size */
+    int batch;                      /* Packets handled per operation */
+    long round;                     /* Operations run so far */
+} t_bench;
+
+/**
+ * Read the monotonic clock
+ *
+ * @return Nanoseconds since an arbitrary point
+ */
+static int64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * Fill a buffer with pseudo-random bytes
+ *
+ * @param buffer Buffer to fill
+ * @param size Number of bytes
+ */
+static void fill_random(uint8_t *buffer, int size)
+{
+    for (int i = 0; i < size; i++) {
+        buffer[i] = rand() & 0xFF;
+    }
+}
+
+/**
+ * Check one implementation against the scalar reference
+ * Every length and alignment up to 256 bytes is checked exhaustively on
+ * random data and on all-ones data (the worst case for carries), then
+ * random lengths up to BENCH_MAX_SIZE.
+ *
+ * @param impl Implementation to check
+ * @param buffer Scratch buffer of BENCH_MAX_SIZE + 64 bytes
+ * @return 0 if every result matched, -1 otherwise
+ */
+static int verify_checksum(t_checksum_impl *impl, uint8_t *buffer)
+{
+    uint16_t expected, got;
+    int size, offset;
+
+    for (int pattern = 0; pattern < 2; pattern++) {
+        if (pattern == 0) {
+            fill_random(buffer, BENCH_MAX_SIZE + 64);
+        } else {
+            memset(buffer, 0xFF, BENCH_MAX_SIZE + 64);
+        }
+        for (size = 0; size <= 256; size++) {
+            for (offset = 0; offset < 64; offset++) {
+                expected = checksum_scalar(buffer + offset, size);
+                got = impl->fn(buffer + offset, size);
+                if (got != expected) {
+                    fprintf(stderr, "checksum %s: size %d offset %d: got %04x, expected %04x\n",
+                            impl->name, size, offset, got, expected);
+                    return -1;
+                }
+            }
+        }
+        expected = checksum_scalar(buffer, BENCH_MAX_SIZE);
+        if (impl->fn(buffer, BENCH_MAX_SIZE) != expected) {
+            fprintf(stderr, "checksum %s: size %d mismatch\n", impl->name, BENCH_MAX_SIZE);
+            return -1;
+        }
+    }
+
+    for (int round = 0; round < BENCH_RANDOM_ROUNDS; round++) {
+        size = rand() % (BENCH_MAX_SIZE + 1);
+        offset = rand() % 64;
+        fill_random(buffer + offset, size);
+        expected = checksum_scalar(buffer + offset, size);
+        got = impl->fn(buffer + offset, size);
+        if (got != expected) {
+            fprintf(stderr, "checksum %s: size %d offset %d: got %04x, expected %04x\n",
+                    impl->name, size, offset, got, expected);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Check that the adaptive pacer ramps up over clean windows, backs off
+ * once on the first window past a threshold, then holds that rate
+ * whatever later windows show
+ *
+ * @return 0 if every window ended on the expected interval, -1 otherwise
+ */
+static int verify_pacer(void)
+{
+    static const struct {
+        int lost;                   /* Expiries besides ADAPT_MIN_SAMPLES replies */
+        double rtt;                 /* RTT of every reply, in milliseconds */
+        int64_t interval_ns;        /* Interval expected once the window ends */
+    } windows[] = {
+        {0, 1.0, ADAPT_START_INTERVAL_NS / 2},
+        {0, 1.0, ADAPT_START_INTERVAL_NS / 4},
+        {0, 1.0, ADAPT_START_INTERVAL_NS / 8},
+        {ADAPT_MIN_SAMPLES, 1.0, ADAPT_START_INTERVAL_NS / 4},
+        {0, 1.0, ADAPT_START_INTERVAL_NS / 4},
+        {0, 1.0, ADAPT_START_INTERVAL_NS / 4},
+        {0, 5.0, ADAPT_START_INTERVAL_NS / 4},
+        {ADAPT_MIN_SAMPLES, 1.0, ADAPT_START_INTERVAL_NS / 4},
+        {0, 1.0, ADAPT_START_INTERVAL_NS / 4},
+    };
+    t_options opts;
+    t_pacer pacer;
+    int64_t now_ns;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.adaptive = true;
+    now_ns = 0;
+    pacer_init(&pacer, &opts, now_ns);
+    for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+        for (int j = 0; j < ADAPT_MIN_SAMPLES; j++) {
+            pacer_reply(&pacer, windows[i].rtt);
+        }
+        for (int j = 0; j < windows[i].lost; j++) {
+            pacer_expire(&pacer);
+        }
+        now_ns += ADAPT_WINDOW_NS;
+        pacer_adapt(&pacer, now_ns);
+        if (pacer.interval_ns != windows[i].interval_ns) {
+            fprintf(stderr, "pacer: window %zu: interval %lld ns, expected %lld ns\n",
+                    i, (long long)pacer.interval_ns, (long long)windows[i].interval_ns);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Checksum one buffer with the implementation under test
+ *
+ * @param b Benchmark state
+ */
+static void op_checksum(t_bench *b)
+{
+    volatile uint16_t sink;
+
+    sink = b->impl.fn(b->buffer, b->size);
+    (void)sink;
+}
+
+/**
+ * Build an echo request from scratch, as every send did before templates
+ *
+ * @param b Benchmark state
+ */
+static void op_init_packet(t_bench *b)
+{
+    init_packet(b->buffer, b->size, (int)b->round, 0x4242);
+}
+
+/**
+ * Queue a batch of probes the way the ping loop does
+ *
+ * @param b Benchmark state
+ */
+static void op_send_batch(t_bench *b)
+{
+    static t_sockaddr addr = {.v4 = {.sin_family = AF_INET}};
+    void *packet;
+
+    for (int i = 0; i < b->batch; i++) {
+        packet = send_batch_add(&b->send_batch, &addr, b->tpl.size, 0, (int)b->round + i, 0);
+        stamp_packet(&b->tpl, packet, b->tpl.size, (int)b->round + i, (int64_t)b->round);
+    }
+    b->send_batch.count = 0;
+}
+
+/**
+ * Validate a batch of echo replies
+ *
+ * @param b Benchmark state
+ */
+static void op_parse_reply(t_bench *b)
+{
+    t_reply reply;
+
+    for (int i = 0; i < b->batch; i++) {
+        if (parse_reply(b->replies[i], b->size + sizeof(struct ip), AF_INET, SOCKET_RAW, 0x4242, &reply) < 0) {
+            fprintf(stderr, "parse_reply rejected a valid reply\n");
+            exit(1);
+        }
+    }
+}
+
+/**
+ * Match a batch of replies to their targets, in no particular order
+ *
+ * @param b Benchmark state
+ */
+static void op_find_target(t_bench *b)
+{
+    int target;
+
+    for (int i = 0; i < b->batch; i++) {
+        target = (int)(((b->round * b->batch + i) * 40503L) % b->size);
+        if (find_target(&b->index, &b->addrs[target]) != target) {
+            fprintf(stderr, "find_target missed target %d\n", target);
+            exit(1);
+        }
+    }
+}
+
+/**
+ * Account for a batch of round-trip times
+ *
+ * @param b Benchmark state
+ */
+static void op_update_stats(t_bench *b)
+{
+    for (int i = 0; i < b->batch; i++) {
+        update_stats(&b->stats, b->rtts[(b->round + i) & (BENCH_RTT_SAMPLES - 1)]);
+    }
+}
+
+/**
+ * Time an operation and print one JSON line with the result
+ * Rates are per packet, so batch sizes can be compared directly.
+ *
+ * @param name Name of the operation
+ * @param variant Implementation or variant of the operation
+ * @param op Operation to time
+ * @param b Benchmark state (size and batch set by the caller)
+ */
+static void bench_run(const char *name, const char *variant, void (*op)(t_bench *), t_bench *b)
+{
+    int64_t start, elapsed;
+    long iterations;
+    double ns;
+
+    b->round = 0;
+    iterations = 256;
+    start = bench_now();
+    do {
+        for (long i = 0; i < iterations; i++) {
+            op(b);
+            b->round++;
+        }
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    ns = (double)elapsed / (b->round * b->batch);
+    printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"size\":%d,\"batch\":%d,"
+           "\"ops\":%ld,\"ns_per_op\":%.2f,\"pps\":%.0f}\n",
+           name, variant, b->size, b->batch, b->round * b->batch, ns, NSEC_PER_SEC / ns);
+}
+
+/**
+ * Build valid echo replies, IP header included, for parse_reply
+ *
+ * @param b Benchmark state
+ * @param size Size of the ICMP part
+ * @param count Number of replies
+ * @return 0 on success, -1 on error
+ */
+static int build_replies(t_bench *b, int size, int count)
+{
+    struct ip *ip;
+    struct icmphdr *icmp;
+
+    for (int i = 0; i < count; i++) {
+        b->replies[i] = calloc(1, sizeof(struct ip) + size);
+        if (!b->replies[i]) {
+            return -1;
+        }
+        ip = (struct ip *)b->replies[i];
+        ip->ip_hl = sizeof(struct ip) >> 2;
+        ip->ip_v = 4;
+
+        icmp = (struct icmphdr *)(b->replies[i] + sizeof(struct ip));
+        init_packet(icmp, size, i, 0x4242);
+        icmp->type = ICMP_ECHO_REPLY;
+        icmp->un.echo.id = htons(0x4242);
+        icmp->checksum = 0;
+        icmp->checksum = compute_checksum(icmp, size);
+    }
+
+    return 0;
+}
+
+/**
+ * Release the replies built by build_replies
+ *
+ * @param b Benchmark state
+ * @param count Number of replies
+ */
+static void free_replies(t_bench *b, int count)
+{
+    for (int i = 0; i < count; i++) {
+        free(b->replies[i]);
+        b->replies[i] = NULL;
+    }
+}
+
+/**
+ * Index a number of IPv4 targets, 10.0.0.0 onwards
+ *
+ * @param b Benchmark state
+ * @param count Number of targets
+ * @return 0 on success, -1 on error
+ */
+static int build_index(t_bench *b, int count)
+{
+    t_target_index *slots;
+
+    b->addrs = calloc(count, sizeof(t_sockaddr));
+    slots = malloc(index_slots(count) * sizeof(t_target_index));
+    if (!b->addrs || !slots) {
+        free(slots);
+        return -1;
+    }
+    index_init(&b->index, slots, index_slots(count));
+    for (int i = 0; i < count; i++) {
+        b->addrs[i].v4.sin_family = AF_INET;
+        b->addrs[i].v4.sin_addr.s_addr = htonl(0x0A000000 + i);
+        index_insert(&b->index, &b->addrs[i], i);
+    }
+
+    return 0;
+}
+
+/**
+ * Release the index built by build_index
+ *
+ * @param b Benchmark state
+ */
+static void free_index(t_bench *b)
+{
+    free(b->index.slots);
+    free(b->addrs);
+    b->addrs = NULL;
+}
+
+/**
+ * Check whether an operation was selected on the command line
+ *
+ * @param name Name of the operation
+ * @param filter Substring given on the command line, or NULL for all
+ * @return true if the operation should run
+ */
+static bool selected(const char *name, const char *filter)
+{
+    return !filter || strstr(name, filter) != NULL;
+}
+
+int main(int argc, char **argv)
+{
+    static const int sizes[] = {64, 512, 1472, 9000, BENCH_MAX_SIZE};
+    static const int batches[] = {1, 8, 32, BATCH_SIZE};
+    static const int targets[] = {16, 1000, 100000};
+    t_checksum_impl impls[CHECKSUM_IMPL_MAX];
+    const char *filter;
+    t_bench *b;
+    int count, status;
+
+    filter = argc > 1 ? argv[1] : NULL;
+    b = calloc(1, sizeof(t_bench));
+    if (b) {
+        b->buffer = malloc(BENCH_MAX_SIZE + 64);
+        b->replies = calloc(BATCH_SIZE, sizeof(uint8_t *));
+        b->stats.histogram = calloc(HIST_BUCKETS, sizeof(uint32_t));
+    }
+    if (!b || !b->buffer || !b->replies || !b->stats.histogram) {
+        perror("malloc");
+        return 1;
+    }
+
+    /* Refuse to time checksums that do not match the reference */
+    srand(42);
+    status = 0;
+    count = checksum_impls(impls);
+    for (int i = 0; i < count; i++) {
+        if (verify_checksum(&impls[i], b->buffer) < 0) {
+            status = 1;
+        }
+    }
+    if (status) {
+        return status;
+    }
+
+    /* Rate control decides what an adaptive run measures: check it too */
+    if (verify_pacer() < 0) {
+        return 1;
+    }
+
+    b->batch = 1;
+    fill_random(b->buffer, BENCH_MAX_SIZE);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        b->size = sizes[s];
+        for (int i = 0; i < count && selected("checksum", filter); i++) {
+            b->impl = impls[i];
+            bench_run("checksum", impls[i].name, op_checksum, b);
+        }
+        if (selected("init_packet", filter)) {
+            bench_run("init_packet", "full", op_init_packet, b);
+        }
+    }
+
+    /* The send batch holds PACKET_SIZE packets, so only the batch varies */
+    if (init_template(&b->tpl, AF_INET, PACKET_SIZE, 0x4242, 0x4242) < 0 ||
+        send_batch_init(&b->send_batch, &b->tpl) < 0) {
+        perror("malloc");
+        return 1;
+    }
+    b->size = PACKET_SIZE;
+    for (size_t n = 0; n < sizeof(batches) / sizeof(*batches) && selected("send_batch", filter); n++) {
+        b->batch = batches[n];
+        bench_run("send_batch", "template", op_send_batch, b);
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes) && selected("parse_reply", filter); s++) {
+        if (build_replies(b, sizes[s], BATCH_SIZE) < 0) {
+            perror("malloc");
+            return 1;
+        }
+        b->size = sizes[s];
+        for (size_t n = 0; n < sizeof(batches) / sizeof(*batches); n++) {
+            b->batch = batches[n];
+            bench_run("parse_reply", "echo", op_parse_reply, b);
+        }
+        free_replies(b, BATCH_SIZE);
+    }
+
+    /* Sizes are target counts: how lookups scale with the index */
+    b->batch = BATCH_SIZE;
+    for (size_t t = 0; t < sizeof(targets) / sizeof(*targets) && selected("find_target", filter); t++) {
+        if (build_index(b, targets[t]) < 0) {
+            perror("malloc");
+            return 1;
+        }
+        b->size = targets[t];
+        bench_run("find_target", "hash", op_find_target, b);
+        free_index(b);
+    }
+
+    /* Spread samples over the histogram like real RTTs (0.01 to 100 ms) */
+    for (int i = 0; i < BENCH_RTT_SAMPLES; i++) {
+        b->rtts[i] = 0.01 * pow(10000.0, (double)rand() / RAND_MAX);
+    }
+    b->stats.min_time = -1;
+    b->size = 0;
+    for (size_t n = 0; n < sizeof(batches) / sizeof(*batches) && selected("update_stats", filter); n++) {
+        b->batch = batches[n];
+        bench_run("update_stats", "welford+histogram", op_update_stats, b);
+    }
+
+    send_batch_free(&b->send_batch);
+    free_template(&b->tpl);
+    free(b->stats.histogram);
+    free(b->replies);
+    free(b->buffer);
+    free(b);
+    return 0;
+}
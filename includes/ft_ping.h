@@ -1,6 +1,11 @@
 #ifndef FT_PING_H
 # define FT_PING_H
 
+/* Linux extensions (sendmmsg, recvmmsg) */
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+
 /* Standard includes */
 # include <stdio.h>
 # include <stdlib.h>
@@ -14,21 +19,207 @@
 # include <netdb.h>
 # include <netinet/ip.h>
 # include <netinet/ip_icmp.h>
+# include <netinet/icmp6.h>
+# include <netinet/ip6.h>
 # include <netinet/in.h>
 # include <errno.h>
 # include <stdbool.h>
+# include <sys/epoll.h>
+# include <sys/timerfd.h>
+# include <time.h>
+# include <linux/errqueue.h>
+# include <linux/net_tstamp.h>
+# include <math.h>
+# include <pthread.h>
+# include <sys/eventfd.h>
+# include <sys/signalfd.h>
+# include <poll.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/un.h>
+# include <sys/random.h>
 
 /* Default values */
 # define PACKET_SIZE 64              /* Default packet size */
+# define PACKET_MAX 65515            /* Largest ICMP message an IPv4 datagram holds */
+# define IP_HEADER_MAX 60            /* Largest IPv4 header, in front of raw socket replies */
+# define ICMP_HEADER_SIZE 8          /* Echo header, before the payload */
+# define PAYLOAD_MIN 16              /* Smallest payload: a t_payload */
 # define DEFAULT_TTL 64              /* Default Time-To-Live */
 # define DEFAULT_TIMEOUT 1           /* Default timeout in seconds */
 # define DEFAULT_INTERVAL 1          /* Default interval between pings in seconds */
 # define DEFAULT_PING_COUNT 0        /* Default ping count (0 = unlimited) */
+# define INFLIGHT_WINDOW 1024        /* Max outstanding probes per target (power of two) */
+# define BATCH_SIZE 64               /* Max datagrams per sendmmsg/recvmmsg call */
+# define SEND_BATCH_WINDOW_US 1000   /* Probes due this soon are sent in the same batch */
+# define SEND_BURST_MAX 256          /* Max probes sent per timer tick, unless one round is larger */
+# define RECV_BUFFER_SIZE 576        /* Smallest reply buffer, room for an ICMP error quoting a request (RFC 1812) */
+# define CONTROL_SIZE 256            /* Ancillary data buffer per received message */
+# define TX_KEY_RING 4096            /* Sent datagrams awaiting a transmit timestamp (power of two) */
+# define TTL_CONTROL_SIZE CMSG_SPACE(sizeof(int)) /* Ancillary data carrying a per-packet TTL */
+
+/* Per-target state */
+# define ARENA_ALIGN 64              /* Cache line: every array of an arena starts on one */
+# define ARENA_BLOCK 65536           /* Smallest block added once the first one is full */
+# define INDEX_EMPTY -1              /* Target of an unused slot of the reply index */
+
+/* Path trace (-t) */
+# define TRACE_HOPS_MAX 255          /* Largest TTL there is */
+# define HOP_PENDING 0               /* No answer yet */
+# define HOP_ROUTER 1                /* A router said the TTL ran out there */
+# define HOP_REACHED 2               /* The target answered the echo */
+# define HOP_ERROR 3                 /* Another ICMP error ended the path there */
+# define HOP_TIMEOUT 4               /* Nothing came back in time */
+
+/* Path MTU search (-P) and discovery (-m) */
+# define PMTU_DEFAULT -1             /* Leave IP_MTU_DISCOVER at the system default */
+# define PMTU_MAX 9000               /* Largest MTU searched unless -s asks for more (jumbo frames) */
+# define PMTU_PROBES 4               /* Sizes probed in parallel per round */
+# define PMTU_ROUNDS_MAX 16          /* Rounds before a search is reported unfinished */
+# define DISCARD_PORT 9              /* Port a route MTU lookup connects to; nothing is sent */
+# define PMTU_FITS 0                 /* The probe came back: the path carries its size */
+# define PMTU_TOO_BIG 1              /* Refused for its size, locally or by a router */
+# define PMTU_LOST 2                 /* Nothing or another error came back: a black hole looks like this */
+# define PMTU_FOUND 0                /* The largest size that fits is known */
+# define PMTU_PARTIAL 1              /* Search cut short: the path carries at least the MTU */
+# define PMTU_NONE 2                 /* No size came back at all */
+
+/* Flood and adaptive rate */
+# define FLOOD_WINDOW 64            /* Outstanding probes per target in flood mode */
+# define ADAPT_START_INTERVAL_NS 10000000LL /* Adaptive mode starts at 100 probes/s */
+# define ADAPT_MIN_INTERVAL_NS 10000LL      /* Adaptive mode never exceeds 100k probes/s */
+# define ADAPT_WINDOW_NS 200000000LL        /* Rate is re-evaluated every 200 ms */
+# define ADAPT_MIN_SAMPLES 8         /* Replies or losses needed to judge a window */
+# define ADAPT_MAX_LOSS 0.01         /* Back off above 1% loss */
+# define ADAPT_MAX_RTT_INFLATION 2.0 /* Back off when average RTT doubles over the baseline */
+
+/* RTT histogram: log-linear buckets over nanoseconds */
+# define HIST_SUB_BITS 5             /* 16 buckets per power of two (about 3% error) */
+# define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+# define HIST_MAX_BITS 40            /* Largest value recorded: 2^40 ns (about 18 minutes) */
+# define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 3) * (HIST_SUB_BUCKETS / 2))
+
+/* Sharded mode (-T) */
+# define SHARD_MAX 64                /* Most probing threads */
+
+/* Output thread */
+# define OUTPUT_RING_SIZE 4096       /* Records queued per shard (power of two) */
+# define CACHE_LINE 64               /* Keeps producer and consumer indexes apart */
+# define RECORD_HEADER 0             /* PING line of a target */
+# define RECORD_REPLY 1              /* One reply line */
+# define RECORD_MARK 2               /* Flood mode progress character */
+# define RECORD_TIMEOUT 3            /* A probe expired (machine formats) */
+# define RECORD_ERROR 4              /* An ICMP error retired a probe */
+# define RECORD_TRACE 5              /* Path trace header of a target */
+# define RECORD_HOP 6                /* One hop of a traced path */
+# define RECORD_PMTU 7               /* Outcome of a path MTU search */
+# define OUTPUT_BUFFER_SIZE (1 << 16) /* Stdio block for machine formats */
+# define OUTPUT_FLUSH_MS 1000        /* Idle time before a partial block is written */
+
+/* Output formats (-o) */
+# define FORMAT_TEXT 0               /* inetutils-like lines */
+# define FORMAT_JSON 1               /* One JSON object per line */
+# define FORMAT_BINARY 2             /* t_wire_header then t_wire_record entries */
+
+/* Binary format */
+# define WIRE_MAGIC "FTPING"         /* First bytes of the header */
+# define WIRE_VERSION 2
+# define WIRE_BYTE_ORDER 0x0102      /* Written in host order */
+# define WIRE_NAME_MAX 104           /* Host name bytes in a target record */
+# define WIRE_NO_TARGET 0xFFFFFFFF   /* Target of the summary record */
+# define WIRE_TARGET 1               /* A target was resolved */
+# define WIRE_REPLY 2                /* One reply */
+# define WIRE_TIMEOUT 3              /* One expired probe */
+# define WIRE_STATS 4                /* Final statistics of a target */
+# define WIRE_SUMMARY 5              /* Final statistics over every target */
+# define WIRE_ERROR 6                /* One ICMP error about a probe */
+# define WIRE_HOP 7                  /* One hop of a traced path */
+# define WIRE_PMTU 8                 /* Outcome of a path MTU search */
+
+/* Sample capture file (-w) */
+# define CAPTURE_MAGIC "FTPCAP"      /* First bytes of the file */
+# define CAPTURE_VERSION 1
+# define CAPTURE_SAMPLES (1 << 20)   /* Default samples kept per shard (power of two) */
+# define CAPTURE_SAMPLES_MAX (1 << 26) /* Most samples kept per shard */
+# define CAPTURE_PAGE 4096           /* Alignment of the file sections */
+# define CAPTURE_NAME_MAX 96         /* Host name bytes in the target table */
+# define SAMPLE_REPLY 1              /* The probe was answered */
+# define SAMPLE_TIMEOUT 2            /* The probe expired */
+# define SAMPLE_ERROR 3              /* An ICMP error came back instead of a reply */
+
+/* Live metrics endpoint (-M) */
+# define METRICS_PUBLISH_MS 500      /* How often shards refresh their snapshot */
+# define METRICS_BUCKETS 16          /* RTT histogram bounds exposed, +Inf aside */
+# define METRICS_BACKLOG 16          /* Scrapes waiting to be accepted */
+# define METRICS_TIMEOUT_MS 1000     /* Longest wait on a scraping client */
+# define METRICS_REQUEST_MAX 4096    /* Bytes of a request read before answering */
+
+/* Name resolution */
+# define DNS_THREADS 16              /* Lookups run in parallel, for every shard at once */
+# define DNS_CACHE_MIN 64            /* Initial cache slots (power of two) */
+# define DNS_FORWARD 0               /* Name to address */
+# define DNS_REVERSE 1               /* Address to name */
+
+/* Target resolution state */
+# define TARGET_PENDING 0            /* Name is still being resolved */
+# define TARGET_ACTIVE 1             /* Resolved and being probed */
+# define TARGET_FAILED 2             /* Unknown host or duplicate address */
+
+/* Checksum implementations (scalar, generic, sse2, avx2) */
+# define CHECKSUM_IMPL_MAX 4
+
+/* Time units */
+# define NSEC_PER_SEC 1000000000LL
+# define NSEC_PER_MSEC 1000000LL
+# define NSEC_PER_USEC 1000LL
+
+/* Kernel timestamping support */
+# define TIMESTAMP_TX 1              /* Sent packets are timestamped */
+# define TIMESTAMP_RX 2              /* Received packets are timestamped */
+
+/* Clock an RTT was measured with */
+# define RTT_HARDWARE 0              /* NIC hardware timestamps */
+# define RTT_SOFTWARE 1              /* Kernel software timestamps */
+# define RTT_MONOTONIC 2             /* Userspace CLOCK_MONOTONIC */
+
+/* ICMP socket kinds */
+# define SOCKET_RAW 0
+# define SOCKET_DGRAM 1
+
+/* One ICMP socket per address family */
+# define ENDPOINT_V4 0               /* ICMP over IPv4 */
+# define ENDPOINT_V6 1               /* ICMPv6 */
+# define ENDPOINT_COUNT 2
+
+/* Event loop sources */
+# define EVENT_TIMER 1               /* The send timer ticked */
+# define EVENT_SOCKET(e) (2 << (2 * (e)))    /* Replies are waiting on endpoint e */
+# define EVENT_ERRQUEUE(e) (4 << (2 * (e)))  /* The error queue of endpoint e has entries */
+# define EVENT_DNS (2 << (2 * ENDPOINT_COUNT)) /* The resolver has answers */
+# define EVENT_STOP (4 << (2 * ENDPOINT_COUNT)) /* Another thread ended the run */
+# define EVENT_SOURCES (ENDPOINT_COUNT + 3)   /* Timer, sockets, resolver and stop */
+
+/* How a reply relates to its probe, judged by the payload and the inflight table */
+# define REPLY_OK 0                  /* First answer to an outstanding probe */
+# define REPLY_LATE 1                /* First answer, after the probe expired */
+# define REPLY_DUPLICATE 2           /* Another answer to an answered probe */
+# define REPLY_CORRUPTED 3           /* Payload truncated or damaged */
+# define REPLY_MISMATCHED 4          /* Payload of another run (nonce differs) */
+# define REPLY_KINDS 5
 
 /* ICMP definitions */
 # define ICMP_ECHO_REQUEST 8         /* ICMP echo request */
 # define ICMP_ECHO_REPLY 0           /* ICMP echo reply */
 
+/* Kinds of ICMP errors quoting one of our probes */
+# define ICMP_ERR_NONE -1            /* An echo reply, not an error */
+# define ICMP_ERR_UNREACH 0          /* Destination unreachable */
+# define ICMP_ERR_TOO_BIG 1          /* Fragmentation needed / packet too big */
+# define ICMP_ERR_TIME_EXCEEDED 2    /* TTL or hop limit ran out on the way */
+# define ICMP_ERR_REDIRECT 3         /* A router pointed at a better gateway (IPv4) */
+# define ICMP_ERR_PARAMPROB 4        /* A header field was rejected */
+# define ICMP_ERR_KINDS 5
+
 /* Error codes */
 # define ERR_SOCKET 1
 # define ERR_SETOPT 2
@@ -37,29 +228,508 @@
 # define ERR_SENDTO 5
 
 /* Global variables */
-extern volatile int g_ping_count;    /* Number of pings sent */
-extern volatile int g_ping_received; /* Number of pings received */
-extern volatile bool g_running;      /* Program running flag */
+extern volatile bool g_running;      /* Cleared by the single-shard signal handler */
 
 /* Type definitions */
 typedef struct s_ping_stats {
     double min_time;                /* Minimum round-trip time */
     double max_time;                /* Maximum round-trip time */
     double total_time;              /* Total round-trip time */
-    int packets_sent;               /* Number of packets sent */
-    int packets_received;           /* Number of packets received */
+    long packets_sent;              /* Number of packets sent */
+    long packets_received;          /* Number of packets received */
+    int errors[ICMP_ERR_KINDS];     /* ICMP errors about our probes, by ICMP_ERR_* */
+    int replies[REPLY_KINDS];       /* Replies read, by REPLY_* */
+    double mean;                    /* Running mean round-trip time (Welford) */
+    double m2;                      /* Sum of squared deviations from the mean (Welford) */
+    uint32_t *histogram;            /* RTT histogram for quantiles (HIST_BUCKETS entries) */
     char *hostname;                 /* Target hostname (for display) */
+    struct s_target *target;        /* Target the statistics belong to */
 } t_ping_stats;
 
+typedef union u_sockaddr {
+    struct sockaddr sa;             /* Generic view, for the socket calls */
+    struct sockaddr_in v4;          /* IPv4 address */
+    struct sockaddr_in6 v6;         /* IPv6 address */
+} t_sockaddr;
+
+typedef struct s_target {
+    t_sockaddr addr;                /* Target address */
+    char *hostname;                 /* Hostname (for display) */
+    char *ipstr;                    /* IP string (for display), NULL until resolved */
+    char *rdns;                     /* Name found by reverse lookup (-H), or NULL */
+    int state;                      /* TARGET_PENDING, TARGET_ACTIVE or TARGET_FAILED */
+} t_target;
+
+typedef struct s_target_index {
+    struct in6_addr addr;           /* Target address, IPv4 mapped into IPv6 */
+    int target;                     /* Position in the target array, INDEX_EMPTY if unused */
+} t_target_index;
+
+typedef struct s_target_table {
+    t_target_index *slots;          /* Open addressing with linear probing, at most half full */
+    uint32_t mask;                  /* Number of slots minus one (power of two) */
+} t_target_table;
+
+typedef struct s_arena_block {
+    struct s_arena_block *next;     /* Block filled before this one */
+    size_t size;                    /* Bytes of data */
+    size_t used;                    /* Bytes of data handed out */
+    _Alignas(ARENA_ALIGN) char data[]; /* Memory handed out, from the start */
+} t_arena_block;
+
+typedef struct s_arena {
+    t_arena_block *head;            /* Block being filled, NULL until the first allocation */
+} t_arena;
+
 typedef struct s_options {
     bool verbose;                   /* Verbose output flag */
     bool help;                      /* Show help flag */
-    char *target;                   /* Target host (IP or hostname) */
-    struct sockaddr_in addr;        /* Target address */
-    char *hostname;                 /* Hostname (for display) */
-    char *ipstr;                    /* IP string (for display) */
+    bool kernel_timestamps;         /* Measure RTT with kernel timestamps */
+    bool flood;                     /* Send as fast as outstanding probes allow */
+    bool adaptive;                  /* Ramp the rate up until loss or RTT inflation */
+    bool interval_set;              /* Interval given on the command line */
+    bool reverse_dns;               /* Look up names of numeric targets */
+    int trace_hops;                 /* Trace the path with TTLs 1 to this, 0 to ping */
+    int packet_size;                /* ICMP bytes of a probe, header included (-s); largest searched (-P) */
+    bool size_set;                  /* Size given on the command line */
+    bool pmtu_search;               /* Search the path MTU of every target */
+    int pmtu_discover;              /* IP_PMTUDISC_* for the sockets, or PMTU_DEFAULT */
+    uint32_t nonce;                 /* Drawn once per run, carried by every probe */
+    int family;                     /* AF_INET, AF_INET6 or AF_UNSPEC for either */
+    int shards;                     /* Probing threads, each with its own sockets */
+    int format;                     /* FORMAT_TEXT, FORMAT_JSON or FORMAT_BINARY */
+    char *capture_file;             /* File every probe is recorded to, or NULL */
+    long capture_samples;           /* Samples kept per shard in the capture file */
+    char *metrics_endpoint;         /* Port on localhost or Unix socket path, or NULL */
+    int64_t interval_ns;            /* Time between two probes to the same target */
+    char **names;                   /* Target hosts from the command line */
+    int name_count;                 /* Number of command line targets */
+    char *target_file;              /* File listing one target per line */
+    t_target *targets;              /* Resolved targets */
+    int target_count;               /* Number of resolved targets */
+    int target_capacity;            /* Allocated size of the target array */
+    t_arena hostnames;              /* Hostnames of every target */
 } t_options;
 
+typedef struct s_probe {
+    int64_t send_ns;                /* When the echo request was sent (monotonic) */
+    int64_t tx_sw_ns;               /* Kernel software transmit timestamp (wall clock), 0 until read */
+    int64_t tx_hw_ns;               /* Hardware transmit timestamp */
+    int seq;                        /* Full sequence number */
+    bool outstanding;               /* Still waiting for a reply */
+    bool answered;                  /* Retired by a reply; later copies are duplicates */
+    int size;                       /* ICMP bytes sent */
+    uint8_t ttl;                    /* TTL the probe was sent with, 0 for the socket's */
+} t_probe;
+
+typedef struct s_inflight {
+    t_probe *slots;                 /* Ring of probes indexed by sequence */
+    int size;                       /* Number of slots (power of two) */
+    int next;                       /* Next sequence number to send */
+    int count;                      /* Number of outstanding probes */
+} t_inflight;
+
+typedef struct s_expiry {
+    int64_t send_ns;                /* When the probe was sent (monotonic) */
+    int target;                     /* Position of the probed target */
+    int seq;                        /* Full sequence number of the probe */
+} t_expiry;
+
+typedef struct s_expiry_queue {
+    t_expiry *entries;              /* Ring of probes in send order */
+    int size;                       /* Number of entries */
+    int head;                       /* Oldest entry */
+    int count;                      /* Number of queued entries */
+} t_expiry_queue;
+
+typedef struct s_reply {
+    t_sockaddr from;                /* Source address of the reply (the router, for errors) */
+    t_sockaddr target;              /* Destination of the quoted request (errors) */
+    uint16_t seq;                   /* Echo sequence number */
+    int bytes;                      /* ICMP bytes received */
+    void *payload;                  /* Echo data, in the receive buffer (reply) */
+    int64_t send_ns;                /* Send time carried by the payload (monotonic) */
+    int error;                      /* ICMP_ERR_* kind, ICMP_ERR_NONE for an echo reply */
+    uint8_t icmp_type;              /* ICMP type and code of an error */
+    uint8_t icmp_code;
+    uint32_t mtu;                   /* Next-hop MTU of a too big error, 0 if not given */
+    int ttl;                        /* TTL (hop limit) the reply arrived with, 0 if unknown */
+    int64_t rx_ns;                  /* When the reply was read (monotonic) */
+    int64_t rx_sw_ns;               /* Software receive timestamp (wall clock) */
+    int64_t rx_hw_ns;               /* Hardware receive timestamp */
+} t_reply;
+
+typedef struct s_tx_stamp {
+    uint32_t key;                   /* Datagram counter assigned by the kernel */
+    int64_t sw_ns;                  /* Software transmit timestamp */
+    int64_t hw_ns;                  /* Hardware transmit timestamp */
+} t_tx_stamp;
+
+typedef struct s_errqueue {
+    struct mmsghdr msgs[BATCH_SIZE];          /* Messages for recvmmsg */
+    struct iovec iov[BATCH_SIZE];             /* One buffer per message */
+    char payloads[BATCH_SIZE][RECV_BUFFER_SIZE]; /* Quoted requests (ICMP errors) */
+    _Alignas(struct cmsghdr) char control[BATCH_SIZE][CONTROL_SIZE]; /* Extended errors and timestamps */
+    t_sockaddr addrs[BATCH_SIZE];             /* Destinations of the quoted requests */
+    t_tx_stamp stamps[BATCH_SIZE];            /* Transmit timestamps read */
+    int stamp_count;                          /* Number of stamps */
+    t_reply errors[BATCH_SIZE];               /* ICMP errors quoting one of our requests */
+    int error_count;                          /* Number of errors */
+} t_errqueue;
+
+typedef struct s_tx_key {
+    uint32_t key;                   /* Datagram counter of a sent probe */
+    int target;                     /* Position of the probed target */
+    int seq;                        /* Sequence number of the probe */
+} t_tx_key;
+
+typedef struct s_checksum_impl {
+    const char *name;               /* Name reported by the benchmark */
+    uint16_t (*fn)(void *addr, int count);
+} t_checksum_impl;
+
+typedef struct s_payload {
+    int64_t send_ns;                /* When the probe was queued (monotonic) */
+    uint32_t nonce;                 /* Nonce of the run */
+    uint32_t check;                 /* Mix of the send time, nonce and sequence number */
+} t_payload;
+
+typedef struct s_packet_template {
+    char *packet;                   /* Echo request with sequence number 0 */
+    int size;                       /* Size of the packet, the largest a probe may be */
+    uint32_t nonce;                 /* Nonce of the run, also the pattern seed */
+    uint16_t checksum;              /* Checksum of the packet as stored */
+    bool kernel_checksum;           /* The kernel fills in the checksum (ICMPv6) */
+} t_packet_template;
+
+typedef struct s_send_batch {
+    struct mmsghdr msgs[BATCH_SIZE];          /* Messages for sendmmsg */
+    struct iovec iov[BATCH_SIZE];             /* One buffer per message */
+    char *packets;                            /* BATCH_SIZE buffers of stride bytes */
+    _Alignas(struct cmsghdr) char control[BATCH_SIZE][TTL_CONTROL_SIZE]; /* Per-packet TTL, when one is set */
+    t_sockaddr addrs[BATCH_SIZE];             /* Destinations */
+    int stride;                               /* Size of one packet buffer */
+    int errors[BATCH_SIZE];                   /* errno of each packet not sent, 0 once sent */
+    int targets[BATCH_SIZE];                  /* Position of each probed target */
+    int seqs[BATCH_SIZE];                     /* Sequence number of each probe */
+    int count;                                /* Number of queued packets */
+} t_send_batch;
+
+typedef struct s_recv_batch {
+    struct mmsghdr msgs[BATCH_SIZE];          /* Messages for recvmmsg */
+    struct iovec iov[BATCH_SIZE];             /* One buffer per message */
+    char *buffers;                            /* BATCH_SIZE buffers of buffer_size bytes */
+    _Alignas(struct cmsghdr) char control[BATCH_SIZE][CONTROL_SIZE]; /* Ancillary data (timestamps, TTL) */
+    t_sockaddr addrs[BATCH_SIZE];             /* Source addresses */
+    int buffer_size;                          /* Size of one datagram buffer */
+} t_recv_batch;
+
+typedef struct s_batch_stats {
+    long send_calls;                /* Number of sendmmsg calls */
+    long packets_sent;              /* Packets sent by those calls */
+    long recv_calls;                /* Number of recvmmsg calls */
+    long packets_received;          /* Datagrams received by those calls */
+    long packets_accepted;          /* Datagrams that were replies to our probes */
+} t_batch_stats;
+
+typedef struct s_pacer {
+    int64_t interval_ns;            /* Current time between two probes to a target */
+    bool adaptive;                  /* Rate follows loss and RTT */
+    bool settled;                   /* A threshold was crossed; rate is held */
+    int64_t window_start;           /* Start of the adaptation window */
+    long window_received;           /* Replies in the adaptation window */
+    long window_lost;               /* Expiries in the adaptation window */
+    double window_rtt_total;        /* Sum of RTTs in the adaptation window */
+    double baseline_rtt;            /* Lowest window average RTT seen */
+} t_pacer;
+
+typedef struct s_event_loop {
+    int epfd;                       /* epoll instance */
+    int timerfd;                    /* Periodic timer driving the send cadence */
+} t_event_loop;
+
+typedef struct s_dns_job {
+    int kind;                       /* DNS_FORWARD or DNS_REVERSE */
+    int target;                     /* Position of the target the answer is for */
+    int family;                     /* Address family asked for (forward) */
+    char *key;                      /* Cache key of the lookup */
+    char *name;                     /* Name to resolve (forward) */
+    t_sockaddr addr;                /* Answer (forward) or address to look up (reverse) */
+    char *result;                   /* Address string (forward) or host name (reverse) */
+    int status;                     /* 0 on success, -1 if the lookup failed */
+    int inbox;                      /* Shard the answer goes back to */
+    struct s_dns_job *next;         /* Next job in the same list */
+} t_dns_job;
+
+typedef struct s_dns_entry {
+    char *key;                      /* Cache key, NULL if the slot is free */
+    bool pending;                   /* A worker is resolving it */
+    int status;                     /* 0 on success, -1 if the lookup failed */
+    t_sockaddr addr;                /* Answer (forward) */
+    char *result;                   /* Address string (forward) or host name (reverse) */
+    t_dns_job *waiters;             /* Jobs waiting for the pending lookup */
+} t_dns_entry;
+
+typedef struct s_dns_inbox {
+    t_dns_job *done;                /* Answered jobs not yet collected, newest first */
+    int eventfd;                    /* Readable when answers are waiting */
+} t_dns_inbox;
+
+typedef struct s_resolver {
+    pthread_mutex_t lock;           /* Guards everything below */
+    pthread_cond_t wake;            /* Signalled when a job is queued or on shutdown */
+    t_dns_job *queue_head;          /* Lookups waiting for a worker, oldest first */
+    t_dns_job *queue_tail;          /* Newest queued lookup */
+    t_dns_inbox *inboxes;           /* Answers waiting for each shard */
+    int inbox_count;                /* Number of inboxes, one per shard */
+    t_dns_entry *cache;             /* Open addressing table of answers */
+    int cache_size;                 /* Number of slots (power of two) */
+    int cache_used;                 /* Occupied slots */
+    int threads;                    /* Workers still running */
+    bool stopping;                  /* Workers should exit; the last one frees */
+    long lookups;                   /* Lookups handed to a worker */
+    long hits;                      /* Lookups answered or joined from the cache */
+} t_resolver;
+
+typedef struct s_record {
+    int type;                       /* RECORD_* */
+    t_target *target;               /* Target the record is about (lives until the run ends) */
+    const char *name;               /* Target as displayed when the record was made */
+    int seq;                        /* Sequence number (reply, timeout); rounds (pmtu) */
+    int bytes;                      /* Reply size (reply); largest probe answered (pmtu) */
+    int ttl;                        /* Reply TTL, 0 if unknown (reply); hop (hop); hops probed (trace) */
+    int status;                     /* REPLY_OK, REPLY_LATE or REPLY_DUPLICATE (reply); HOP_* (hop); PMTU_FOUND.. (pmtu) */
+    double rtt;                     /* Round-trip time in milliseconds (reply) */
+    int64_t time_ns;                /* When the reply came or the probe expired (monotonic) */
+    char mark;                      /* Character to write (flood mark) */
+    int error;                      /* ICMP_ERR_* kind (error) */
+    uint8_t icmp_type;              /* ICMP type and code (error) */
+    uint8_t icmp_code;
+    uint32_t mtu;                   /* Next-hop MTU, 0 if not given (error); path MTU (pmtu) */
+    t_sockaddr from;                /* Router that sent the error (error, hop) */
+} t_record;
+
+typedef struct s_ring {
+    uint32_t head __attribute__((aligned(CACHE_LINE))); /* Next slot written (producer) */
+    uint32_t tail_cache;            /* Last tail the producer saw */
+    long dropped;                   /* Records lost to a full ring (producer) */
+    uint32_t tail __attribute__((aligned(CACHE_LINE))); /* Next slot read (consumer) */
+    uint32_t head_cache;            /* Last head the consumer saw */
+    t_record slots[OUTPUT_RING_SIZE] __attribute__((aligned(CACHE_LINE)));
+} t_ring;
+
+typedef struct s_output {
+    t_options *opts;                /* Command line options */
+    int64_t wall_offset_ns;         /* Wall clock minus monotonic clock at start */
+    t_ring *rings;                  /* One single-producer ring per shard */
+    int count;                      /* Number of rings */
+    pthread_t thread;               /* Thread formatting and writing records */
+    int wakefd;                     /* Eventfd the output thread sleeps on */
+    bool sleeping;                  /* The output thread is (about to be) asleep */
+    bool stopping;                  /* Producers are done; drain and exit */
+} t_output;
+
+typedef struct s_wire_header {
+    char magic[8];                  /* WIRE_MAGIC, NUL padded */
+    uint16_t byte_order;            /* WIRE_BYTE_ORDER in the writer's byte order */
+    uint16_t version;               /* WIRE_VERSION */
+    uint32_t record_size;           /* sizeof(t_wire_record) */
+    int64_t start_ns;               /* Start of the run (wall clock) */
+    uint8_t reserved[120];          /* Pads the header to one record */
+} t_wire_header;
+
+typedef struct s_wire_record {
+    uint8_t type;                   /* WIRE_* */
+    uint8_t family;                 /* 4 or 6, 0 for the summary */
+    uint16_t reserved;
+    uint32_t target;                /* Position of the target, or WIRE_NO_TARGET */
+    uint8_t addr[16];               /* Target address (IPv4 in the first 4 bytes) */
+    union {
+        struct {
+            uint32_t seq;           /* Sequence number; rounds (pmtu) */
+            uint32_t bytes;         /* Reply size, 0 for a timeout; largest probe answered (pmtu) */
+            int64_t time_ns;        /* When the reply came or the probe expired (wall clock) */
+            int64_t rtt_ns;         /* Round-trip time, 0 for a timeout */
+            uint8_t error;          /* ICMP_ERR_* kind (error) */
+            uint8_t icmp_type;      /* ICMP type and code (error) */
+            uint8_t icmp_code;
+            uint8_t from_family;    /* 4 or 6 (error) */
+            uint32_t mtu;           /* Next-hop MTU, 0 if not given (error); path MTU (pmtu) */
+            uint8_t from[16];       /* Router that sent the error (error, hop) */
+            uint8_t ttl;            /* Reply TTL (reply) or hop number (hop) */
+            uint8_t status;         /* REPLY_* (reply), HOP_* (hop) or PMTU_FOUND.. (pmtu) */
+        } probe;
+        struct {
+            int64_t transmitted;    /* Probes sent */
+            int64_t received;       /* Replies received */
+            int64_t min_ns;         /* Round-trip times, 0 without replies */
+            int64_t avg_ns;
+            int64_t max_ns;
+            int64_t mdev_ns;
+            int64_t quantile_ns[4]; /* p50, p90, p99 and p99.9 */
+            uint32_t errors[ICMP_ERR_KINDS]; /* ICMP errors by ICMP_ERR_* */
+            uint32_t replies[REPLY_KINDS];   /* Replies by REPLY_* */
+        } stats;
+        char name[WIRE_NAME_MAX];   /* Host name, truncated, NUL padded (target) */
+    } u;
+} t_wire_record;
+
+typedef struct s_capture_header {
+    char magic[8];                  /* CAPTURE_MAGIC, NUL padded */
+    uint16_t byte_order;            /* WIRE_BYTE_ORDER in the writer's byte order */
+    uint16_t version;               /* CAPTURE_VERSION */
+    uint32_t sample_size;           /* sizeof(t_sample) */
+    uint32_t target_size;           /* sizeof(t_capture_target) */
+    uint32_t capacity;              /* Samples per shard ring (power of two) */
+    uint32_t shards;                /* Number of rings */
+    uint32_t targets;               /* Entries of the target table */
+    int64_t start_ns;               /* When the capture was created (wall clock) */
+    int64_t end_ns;                 /* When the prober closed it, 0 while running */
+    uint64_t heads_offset;          /* File offset of the ring heads */
+    uint64_t targets_offset;        /* File offset of the target table */
+    uint64_t rings_offset;          /* File offset of the first ring */
+} t_capture_header;
+
+typedef struct s_capture_head {
+    uint64_t head;                  /* Samples ever written to the ring */
+    uint8_t pad[CACHE_LINE - sizeof(uint64_t)]; /* One cache line per shard */
+} t_capture_head;
+
+typedef struct s_capture_target {
+    char name[CAPTURE_NAME_MAX];    /* Host name, truncated, NUL padded */
+    uint8_t family;                 /* 4 or 6 once resolved, 0 before */
+    uint8_t reserved[15];
+    uint8_t addr[16];               /* Address (IPv4 in the first 4 bytes) */
+} t_capture_target;
+
+typedef struct s_sample {
+    uint64_t sequence;              /* Position in the ring + 1, 0 while being written */
+    uint32_t target;                /* Position of the target */
+    uint32_t seq;                   /* Sequence number of the probe */
+    uint8_t status;                 /* SAMPLE_REPLY, SAMPLE_TIMEOUT or SAMPLE_ERROR */
+    uint8_t ttl;                    /* TTL of the reply, 0 if unknown */
+    uint16_t bytes;                 /* Reply size */
+    uint8_t icmp_type;              /* ICMP type and code (error) */
+    uint8_t icmp_code;
+    uint16_t reserved;
+    int64_t send_ns;                /* When the probe left (wall clock) */
+    int64_t recv_ns;                /* When the reply came or the probe expired (wall clock) */
+    int64_t rtt_ns;                 /* Round-trip time, 0 for a timeout */
+    uint8_t pad[16];                /* Keeps samples on cache line boundaries */
+} t_sample;
+
+typedef struct s_capture {
+    int fd;                         /* Capture file */
+    uint8_t *map;                   /* Whole file, shared mapping */
+    size_t size;                    /* Size of the file */
+    t_capture_header *header;       /* Start of the file */
+    t_capture_head *heads;          /* Ring heads, one per shard */
+    t_capture_target *targets;      /* Target table */
+    t_sample *rings;                /* Rings, one after the other */
+    int64_t wall_offset_ns;         /* Wall clock minus monotonic clock at start */
+} t_capture;
+
+typedef struct s_hop {
+    t_sockaddr from;                /* Router or target that answered, unset if none did */
+    double rtt;                     /* Round-trip time in milliseconds */
+    int status;                     /* HOP_* */
+    uint8_t icmp_type;              /* ICMP type and code (error) */
+    uint8_t icmp_code;
+} t_hop;
+
+typedef struct s_pmtu {
+    int lo;                         /* Largest probe answered (ICMP bytes), below every probe if none */
+    int hi;                         /* Smallest probe known not to fit */
+    int header;                     /* IP header in front of a probe, to tell MTUs from sizes */
+    int outstanding;                /* Probes of the current round not resolved yet */
+    int rounds;                     /* Rounds sent */
+} t_pmtu;
+
+typedef struct s_metrics_target {
+    bool active;                    /* Being probed: address known, not a duplicate */
+    long sent;                      /* Probes sent */
+    long received;                  /* Replies received */
+    double rtt_sum;                 /* Sum of RTTs in milliseconds */
+    uint64_t buckets[METRICS_BUCKETS + 1]; /* Replies per RTT bucket, the last above every bound */
+    long errors[ICMP_ERR_KINDS];    /* ICMP errors by ICMP_ERR_* */
+    long replies[REPLY_KINDS];      /* Replies by REPLY_* */
+} t_metrics_target;
+
+typedef struct s_metrics_shard {
+    uint32_t sequence __attribute__((aligned(CACHE_LINE))); /* Odd while the shard rewrites the snapshot */
+    int count;                      /* Targets of the shard */
+    t_target *targets;              /* The shard's slice of the target list */
+    t_metrics_target *snapshot;     /* Last published state, one entry per target */
+} t_metrics_shard;
+
+typedef struct s_metrics {
+    const char *endpoint;           /* Port on localhost or Unix socket path */
+    bool unix_socket;               /* The endpoint is a Unix socket, removed on exit */
+    int listenfd;                   /* Listening socket */
+    int stopfd;                     /* Eventfd telling the thread to exit */
+    pthread_t thread;               /* Thread serving scrapes */
+    t_metrics_shard *shards;        /* Snapshots, one per shard */
+    int count;                      /* Number of shards */
+    t_metrics_target *scratch;      /* Consistent copy of every snapshot, for the thread */
+} t_metrics;
+
+typedef struct s_endpoint {
+    int family;                     /* AF_INET or AF_INET6 */
+    int sockfd;                     /* ICMP socket shared by the family's targets, -1 if unused */
+    int kind;                       /* SOCKET_DGRAM or SOCKET_RAW */
+    const char *filter;             /* How unrelated ICMP is kept away from us */
+    uint16_t ident;                 /* Echo identifier of our requests */
+    int timestamps;                 /* Kernel timestamping support (TIMESTAMP_*) */
+    t_packet_template tpl;          /* Echo request every probe is stamped from */
+    t_tx_key tx_keys[TX_KEY_RING];  /* Sent probes by kernel datagram counter */
+    uint32_t tx_key_next;           /* Counter the kernel assigns to the next datagram */
+    t_send_batch send_batch;        /* Probes leaving with the next sendmmsg */
+    t_recv_batch recv_batch;        /* Replies arriving with one recvmmsg */
+    t_errqueue errqueue;            /* Timestamps and ICMP errors from the error queue */
+} t_endpoint;
+
+typedef struct s_pinger {
+    t_options *opts;                /* Command line options */
+    int shard;                      /* Position of the shard */
+    pthread_t thread;               /* Thread running the shard */
+    int status;                     /* Exit code of the shard */
+    int stopfd;                     /* Readable once the run must end (sharded), or -1 */
+    int donefd;                     /* Counts shards that returned (sharded), or -1 */
+    t_endpoint endpoints[ENDPOINT_COUNT]; /* ICMP sockets, indexed by ENDPOINT_* */
+    t_target *targets;              /* The shard's slice of the target list */
+    int count;                      /* Number of targets, resolved or not */
+    int kept;                       /* Targets probed, once the run is over */
+    int *active;                    /* Positions of the targets being probed */
+    int active_count;               /* Number of targets being probed */
+    int pending;                    /* Targets still being resolved */
+    t_resolver *resolver;           /* Background name resolution shared by every shard */
+    t_output *output;               /* Output thread shared by every shard */
+    t_ring *ring;                   /* The shard's ring to the output thread */
+    t_capture *capture;             /* Sample capture file shared by every shard, or NULL */
+    t_metrics_shard *metrics;       /* Snapshot served by the metrics endpoint, or NULL */
+    int64_t metrics_next_ns;        /* When the snapshot is next published (monotonic) */
+    t_arena arena;                  /* Every per-target array of the shard, and resolved names */
+    t_ping_stats *stats;            /* Run statistics, one per target */
+    uint32_t *histograms;           /* Backing storage for every RTT histogram */
+    t_inflight *inflight;           /* Probes waiting for a reply, one table per target */
+    t_probe *slots;                 /* Backing storage for every inflight table */
+    t_expiry_queue expiry;          /* Outstanding probes of all targets in send order */
+    t_target_table index;           /* Active targets by address, for reply lookup */
+    int next_target;                /* Next entry of the active list to probe */
+    int64_t next_send;              /* When the next probe is due (monotonic) */
+    int64_t send_gap;               /* Time between two consecutive sends */
+    t_pacer pacer;                  /* Send rate, fixed or adaptive */
+    int64_t start_ns;               /* When the first probe was sent */
+    long rtt_sources[3];            /* RTTs measured with each clock (RTT_*) */
+    t_event_loop events;            /* Socket and send timer readiness */
+    t_batch_stats batch_stats;      /* Achieved batch sizes */
+    t_hop *hops;                    /* Path of every target, trace_hops entries each (-t) */
+    t_pmtu *pmtu;                   /* Path MTU search of every target (-P) */
+    int pmtu_ready;                 /* Searches whose round is over, due for the next one (-P) */
+    bool *reported;                 /* The path or path MTU of a target was reported (-t, -P) */
+    int reported_count;             /* Targets whose path or path MTU was reported (-t, -P) */
+} t_pinger;
+
 /* Function prototypes */
 
 /* main.c */
@@ -72,23 +742,159 @@ int start_ping(t_options *opts);
 void finish_ping(t_ping_stats *stats);
 
 /* socket.c */
-int create_socket(void);
-int setup_socket(int sockfd);
+int create_socket(int family, int *kind);
+int socket_ident(int sockfd, int family, int kind, int shard, uint16_t *ident);
+int setup_socket(int sockfd, int family);
+int enable_icmp_errors(int sockfd, int family);
+int set_mtu_discovery(int sockfd, int family, int mode);
+int route_mtu(t_sockaddr *addr);
+int read_reply_ttl(struct msghdr *msg);
 
 /* packet.c */
-void init_packet(void *packet, int size, int seq);
+void init_packet(void *packet, int size, int seq, uint32_t nonce);
+void fill_pattern(void *buffer, size_t size, uint64_t seed);
+int init_template(t_packet_template *tpl, int family, int size, uint16_t ident, uint32_t nonce);
+void free_template(t_packet_template *tpl);
+void stamp_packet(t_packet_template *tpl, void *packet, int size, int seq, int64_t send_ns);
+int check_payload(t_packet_template *tpl, t_reply *reply);
+const char *reply_kind_name(int kind);
+uint16_t checksum_update(uint16_t check, uint16_t old_word, uint16_t new_word);
+int parse_reply(void *buffer, int len, int family, int kind, uint16_t ident, t_reply *reply);
+int parse_queued_error(struct sock_extended_err *err, void *payload, int len, uint16_t ident, t_reply *reply);
+int icmp_error_kind(int family, int type, int code);
+const char *icmp_error_name(int kind);
+
+/* checksum.c */
 uint16_t compute_checksum(void *addr, int count);
-int send_packet(int sockfd, struct sockaddr_in *addr, void *packet, int size);
-int receive_packet(int sockfd, struct sockaddr_in *addr, void *buffer, int size, struct timeval *tv);
+uint16_t checksum_scalar(void *addr, int count);
+int checksum_impls(t_checksum_impl *impls);
+
+/* batch.c */
+int send_batch_init(t_send_batch *batch, t_packet_template *tpl);
+void send_batch_free(t_send_batch *batch);
+void *send_batch_add(t_send_batch *batch, t_sockaddr *addr, int size, int target, int seq, int ttl);
+int send_batch_flush(int sockfd, t_send_batch *batch, t_batch_stats *stats);
+int recv_batch_init(t_recv_batch *batch, int buffer_size);
+void recv_batch_free(t_recv_batch *batch);
+int receive_batch(int sockfd, t_recv_batch *batch, t_batch_stats *stats);
+
+/* event.c */
+int event_init(t_event_loop *loop);
+int event_add_socket(t_event_loop *loop, int sockfd, int endpoint);
+int event_add_fd(t_event_loop *loop, int fd, int source);
+void event_free(t_event_loop *loop);
+int event_start_timer(t_event_loop *loop, int64_t start_ns, int64_t period_ns);
+int event_wait(t_event_loop *loop, int timeout_ms);
+
+/* inflight.c */
+void inflight_init(t_inflight *table, t_probe *slots, int size);
+int inflight_window(int64_t interval_ns, int64_t timeout_ns);
+t_probe *inflight_add(t_inflight *table, int64_t now_ns, t_probe *evicted);
+int inflight_match(t_inflight *table, uint16_t seq, t_probe *out);
+int inflight_reply(t_inflight *table, uint16_t seq, t_probe *out);
+bool inflight_pending(t_inflight *table, int seq);
+int expiry_init(t_expiry_queue *queue, int size);
+void expiry_free(t_expiry_queue *queue);
+void expiry_push(t_expiry_queue *queue, int target, t_probe *probe);
+t_expiry *expiry_peek(t_expiry_queue *queue);
+void expiry_pop(t_expiry_queue *queue);
 
 /* dns.c */
-int resolve_hostname(const char *hostname, struct sockaddr_in *addr, char **ipstr);
-char *get_hostname_from_ip(struct sockaddr_in *addr);
+int resolve_hostname(const char *hostname, int family, t_sockaddr *addr, char **ipstr);
+int resolve_numeric(const char *hostname, int family, t_sockaddr *addr, char **ipstr);
+char *get_hostname_from_ip(t_sockaddr *addr);
+socklen_t sockaddr_len(t_sockaddr *addr);
+const char *sockaddr_str(t_sockaddr *addr, char *buffer, size_t size);
+
+/* resolver.c */
+t_resolver *resolver_create(int threads, int inboxes);
+void resolver_destroy(t_resolver *r);
+int resolver_forward(t_resolver *r, int inbox, const char *name, int family, int target);
+int resolver_reverse(t_resolver *r, int inbox, t_sockaddr *addr, int target);
+t_dns_job *resolver_collect(t_resolver *r, int inbox);
+void dns_job_free(t_dns_job *job);
+
+/* output.c */
+int output_start(t_output *out, t_options *opts, int count);
+long output_stop(t_output *out);
+void output_push(t_output *out, t_ring *ring, const t_record *rec);
+
+/* capture.c */
+int capture_open(t_capture *c, t_options *opts, int shards);
+void capture_close(t_capture *c);
+void capture_target(t_capture *c, int index, t_sockaddr *addr);
+void capture_sample(t_capture *c, int shard, t_sample *sample);
+
+/* metrics.c */
+int metrics_start(t_metrics *m, t_options *opts, t_pinger *shards, int count);
+void metrics_stop(t_metrics *m);
+void metrics_publish(t_metrics_shard *m, t_ping_stats *stats);
+
+/* format.c */
+void format_begin(t_options *opts);
+void format_record(t_output *out, t_record *rec);
+void format_stats(t_options *opts, t_ping_stats *stats);
+void format_summary(t_options *opts, t_ping_stats *stats, int count, int64_t elapsed_ns);
+
+/* pacing.c */
+void pacer_init(t_pacer *pacer, t_options *opts, int64_t now_ns);
+void pacer_reply(t_pacer *pacer, double rtt);
+void pacer_expire(t_pacer *pacer);
+bool pacer_adapt(t_pacer *pacer, int64_t now_ns);
+
+/* stats.c */
+int histogram_index(uint64_t value);
+uint64_t histogram_value(int index);
+double histogram_quantile(uint32_t *histogram, long total, double quantile, double min, double max);
+void update_stats(t_ping_stats *stats, double rtt);
+double stats_mdev(t_ping_stats *stats);
+int merge_stats(t_ping_stats *merged, uint32_t *histogram, t_ping_stats *stats, int count);
+
+/* filter.c */
+int attach_reply_filter(int sockfd, int family, uint16_t ident);
+
+/* timestamp.c */
+int64_t monotonic_ns(void);
+int64_t realtime_ns(void);
+int enable_timestamps(int sockfd);
+void read_rx_timestamp(struct msghdr *msg, int64_t *sw, int64_t *hw);
+int read_error_queue(int sockfd, uint16_t ident, t_errqueue *q);
+
+/* target.c */
+int add_target(t_options *opts, const char *name);
+int read_target_file(t_options *opts, const char *path);
+void free_targets(t_options *opts);
+uint32_t index_slots(int count);
+void index_init(t_target_table *table, t_target_index *slots, uint32_t size);
+int index_insert(t_target_table *table, t_sockaddr *addr, int target);
+int find_target(t_target_table *table, t_sockaddr *addr);
+
+/* arena.c */
+size_t arena_span(size_t size);
+int arena_init(t_arena *arena, size_t size);
+void *arena_alloc(t_arena *arena, size_t size);
+char *arena_strdup(t_arena *arena, const char *str);
+void arena_free(t_arena *arena);
 
 /* display.c */
-void print_ping_header(t_options *opts);
-void print_ping_result(t_options *opts, int seq, int bytes, float rtt);
-void print_ping_stats(t_ping_stats *stats);
+void print_ping_header(const char *hostname, const char *ipstr, int size);
+void print_ping_result(const char *name, const char *ipstr, int seq, int bytes, int ttl, float rtt, int status);
+void print_trace_header(const char *hostname, const char *ipstr, int hops, int size);
+void print_hop(t_record *rec);
+const char *hop_status_name(int status);
+void print_pmtu(t_record *rec);
+const char *pmtu_status_name(int status);
+void print_record(t_record *rec);
+const char *icmp_error_text(int family, int type, int code);
+void print_error_counts(int *errors);
+void print_ping_summary(t_ping_stats *stats, int count);
+void print_rtt_quantiles(uint32_t *histogram, long total, double min, double max);
+void print_batch_stats(t_batch_stats *stats);
+void print_timestamp_stats(long *rtt_sources);
+void print_filter_stats(t_batch_stats *stats, const char *filter);
+void print_dns_stats(long lookups, long hits);
+void print_output_stats(long dropped);
+void print_rate_stats(t_options *opts, double requested, bool settled, long sent, int64_t elapsed_ns);
 void print_verbose(const char *format, ...);
 
 #endif /* FT_PING_H */
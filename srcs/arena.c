@@ -0,0 +1,130 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Round a size up to a whole number of arena alignment units
+ *
+ * @param size Size in bytes
+ * @return Rounded size
+ */
+size_t arena_span(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/**
+ * Prepare an arena whose first block holds at least a given size
+ * Sizing the first block for everything known up front keeps the arrays
+ * carved from it in one allocation, next to each other.
+ *
+ * @param arena Arena to initialize
+ * @param size Size of the first block, 0 to allocate it on first use
+ * @return 0 on success, -1 on error
+ */
+int arena_init(t_arena *arena, size_t size)
+{
+    memset(arena, 0, sizeof(t_arena));
+    if (size == 0) {
+        return 0;
+    }
+    size = arena_span(size);
+    arena->head = aligned_alloc(ARENA_ALIGN, sizeof(t_arena_block) + size);
+    if (!arena->head) {
+        return -1;
+    }
+    arena->head->next = NULL;
+    arena->head->size = size;
+    arena->head->used = 0;
+
+    return 0;
+}
+
+/**
+ * Take memory from the current block of an arena, opening a new one if
+ * it is too full
+ * A request the current block cannot hold opens a block of at least
+ * ARENA_BLOCK bytes; nothing is released before the whole arena is.
+ *
+ * @param arena Arena
+ * @param size Size in bytes
+ * @param align Alignment, a power of two no larger than ARENA_ALIGN
+ * @return Memory, or NULL if memory runs out
+ */
+static void *arena_take(t_arena *arena, size_t size, size_t align)
+{
+    t_arena_block *block;
+    size_t offset, capacity;
+
+    block = arena->head;
+    offset = block ? (block->used + align - 1) & ~(align - 1) : 0;
+    if (!block || offset + size > block->size) {
+        capacity = arena_span(size > ARENA_BLOCK ? size : ARENA_BLOCK);
+        block = aligned_alloc(ARENA_ALIGN, sizeof(t_arena_block) + capacity);
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena->head;
+        block->size = capacity;
+        arena->head = block;
+        offset = 0;
+    }
+    block->used = offset + size;
+
+    return block->data + offset;
+}
+
+/**
+ * Carve zeroed memory out of an arena
+ * Every array starts on a cache line, so arrays of different kinds never
+ * share one.
+ *
+ * @param arena Arena
+ * @param size Size in bytes
+ * @return Zeroed memory, or NULL if memory runs out
+ */
+void *arena_alloc(t_arena *arena, size_t size)
+{
+    void *ptr;
+
+    ptr = arena_take(arena, size, ARENA_ALIGN);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/**
+ * Copy a string into an arena
+ * Strings are packed end to end, with no alignment.
+ *
+ * @param arena Arena
+ * @param str String to copy
+ * @return Copy, or NULL if memory runs out
+ */
+char *arena_strdup(t_arena *arena, const char *str)
+{
+    size_t len;
+    char *copy;
+
+    len = strlen(str) + 1;
+    copy = arena_take(arena, len, 1);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+/**
+ * Release every block of an arena at once
+ *
+ * @param arena Arena
+ */
+void arena_free(t_arena *arena)
+{
+    t_arena_block *block, *next;
+
+    for (block = arena->head; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    arena->head = NULL;
+}
@@ -0,0 +1,244 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Prepare a send batch, wiring each message to its buffer and address
+ * Every buffer starts as a copy of the template, so queuing a probe only
+ * has to stamp its sequence number. Buffers are sized for the template,
+ * the largest probe the batch will carry.
+ *
+ * @param batch Send batch to initialize
+ * @param tpl Echo request template
+ * @return 0 on success, -1 on error
+ */
+int send_batch_init(t_send_batch *batch, t_packet_template *tpl)
+{
+    memset(batch, 0, sizeof(t_send_batch));
+    batch->stride = tpl->size;
+    batch->packets = malloc((size_t)BATCH_SIZE * batch->stride);
+    if (!batch->packets) {
+        return -1;
+    }
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        memcpy(batch->packets + (size_t)i * batch->stride, tpl->packet, tpl->size);
+        batch->iov[i].iov_base = batch->packets + (size_t)i * batch->stride;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+    }
+
+    return 0;
+}
+
+/**
+ * Release the buffers of a send batch
+ *
+ * @param batch Send batch
+ */
+void send_batch_free(t_send_batch *batch)
+{
+    free(batch->packets);
+    batch->packets = NULL;
+}
+
+/**
+ * Reserve the next packet of a send batch
+ *
+ * @param batch Send batch
+ * @param addr Destination of the packet
+ * @param size Size of the packet, at most the template's
+ * @param target Position of the probed target
+ * @param seq Sequence number of the probe
+ * @param ttl TTL (hop limit) of this packet alone, 0 for the socket's
+ * @return Packet buffer to fill, or NULL if the batch is full
+ */
+void *send_batch_add(t_send_batch *batch, t_sockaddr *addr, int size, int target, int seq, int ttl)
+{
+    struct msghdr *hdr;
+    struct cmsghdr *cmsg;
+    int i;
+
+    if (batch->count == BATCH_SIZE) {
+        return NULL;
+    }
+
+    i = batch->count++;
+    hdr = &batch->msgs[i].msg_hdr;
+    batch->addrs[i] = *addr;
+    hdr->msg_namelen = sockaddr_len(addr);
+    batch->iov[i].iov_len = size;
+    batch->targets[i] = target;
+    batch->seqs[i] = seq;
+
+    /* A TTL given as ancillary data overrides the socket's for one packet */
+    hdr->msg_control = NULL;
+    hdr->msg_controllen = 0;
+    if (ttl > 0) {
+        hdr->msg_control = batch->control[i];
+        hdr->msg_controllen = TTL_CONTROL_SIZE;
+        cmsg = CMSG_FIRSTHDR(hdr);
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        if (addr->sa.sa_family == AF_INET6) {
+            cmsg->cmsg_level = IPPROTO_IPV6;
+            cmsg->cmsg_type = IPV6_HOPLIMIT;
+        } else {
+            cmsg->cmsg_level = IPPROTO_IP;
+            cmsg->cmsg_type = IP_TTL;
+        }
+        memcpy(CMSG_DATA(cmsg), &ttl, sizeof(int));
+    }
+
+    return batch->packets + (size_t)i * batch->stride;
+}
+
+/**
+ * Check whether a socket error is an ICMP error reported late
+ * A ping socket with IP_RECVERR also records an ICMP error as a pending
+ * socket error, returned once by whatever call comes next. The error
+ * itself is read from the error queue, so the call can just be retried.
+ *
+ * @param err errno of the failed call
+ * @return true if err is what an ICMP error turns into
+ */
+static bool deferred_icmp_error(int err)
+{
+    return err == ECONNREFUSED || err == EHOSTUNREACH || err == ENETUNREACH ||
+           err == EHOSTDOWN || err == ENONET || err == EPROTO || err == EMSGSIZE ||
+           err == EACCES || err == ENOPROTOOPT || err == EOPNOTSUPP;
+}
+
+/**
+ * Check whether a send error is about the socket rather than one message
+ * Such an error would fail every message left, so the batch stops there.
+ *
+ * @param err errno of the failed call
+ * @return true if no message of the batch can be sent
+ */
+static bool socket_send_error(int err)
+{
+    return err == EBADF || err == ENOTSOCK || err == EFAULT || err == EAGAIN ||
+           err == ENOBUFS || err == ENOMEM;
+}
+
+/**
+ * Send every packet of a batch with as few sendmmsg calls as possible
+ * The batch is emptied; errors[] tells which entries were not sent.
+ * A message failing on a pending ICMP error is tried once more, since the
+ * failure cleared the error and said nothing about that message. Any other
+ * error fails that message alone (one too large for the path, a broadcast
+ * destination refused with EACCES) and the rest still go; only an error
+ * about the socket itself fails everything left.
+ *
+ * @param sockfd Socket file descriptor
+ * @param batch Send batch
+ * @param stats Batching counters to update
+ * @return Number of packets sent
+ */
+int send_batch_flush(int sockfd, t_send_batch *batch, t_batch_stats *stats)
+{
+    int next, sent, ret, retried;
+
+    next = 0;
+    sent = 0;
+    retried = -1;
+    while (next < batch->count) {
+        ret = sendmmsg(sockfd, &batch->msgs[next], batch->count - next, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (deferred_icmp_error(errno) && retried != next) {
+                retried = next;
+                continue;
+            }
+            if (socket_send_error(errno)) {
+                break;
+            }
+            batch->errors[next++] = errno;
+            continue;
+        }
+        memset(&batch->errors[next], 0, ret * sizeof(int));
+        stats->send_calls++;
+        stats->packets_sent += ret;
+        next += ret;
+        sent += ret;
+    }
+    for (int i = next; i < batch->count; i++) {
+        batch->errors[i] = errno;
+    }
+
+    batch->count = 0;
+    return sent;
+}
+
+/**
+ * Prepare a receive batch, wiring each message to its buffer and address
+ *
+ * @param batch Receive batch to initialize
+ * @param buffer_size Size of one datagram buffer: the largest reply expected
+ * @return 0 on success, -1 on error
+ */
+int recv_batch_init(t_recv_batch *batch, int buffer_size)
+{
+    memset(batch, 0, sizeof(t_recv_batch));
+    batch->buffer_size = buffer_size;
+    batch->buffers = malloc((size_t)BATCH_SIZE * buffer_size);
+    if (!batch->buffers) {
+        return -1;
+    }
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        batch->iov[i].iov_base = batch->buffers + (size_t)i * buffer_size;
+        batch->iov[i].iov_len = buffer_size;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+        batch->msgs[i].msg_hdr.msg_control = batch->control[i];
+    }
+
+    return 0;
+}
+
+/**
+ * Release the buffers of a receive batch
+ *
+ * @param batch Receive batch
+ */
+void recv_batch_free(t_recv_batch *batch)
+{
+    free(batch->buffers);
+    batch->buffers = NULL;
+}
+
+/**
+ * Receive every queued datagram with one recvmmsg call
+ * Called once the event loop reports the socket readable; never blocks.
+ *
+ * @param sockfd Socket file descriptor
+ * @param batch Receive batch
+ * @param stats Batching counters to update
+ * @return Number of datagrams received, or -1 if none was queued or on error
+ */
+int receive_batch(int sockfd, t_recv_batch *batch, t_batch_stats *stats)
+{
+    int ret;
+
+    /* The kernel rewrites the name and control lengths on every call */
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(t_sockaddr);
+        batch->msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+    }
+
+    /* Drain whatever is queued without blocking again */
+    ret = recvmmsg(sockfd, batch->msgs, BATCH_SIZE, MSG_DONTWAIT, NULL);
+    if (ret < 0) {
+        if (errno != EAGAIN && errno != EINTR && !deferred_icmp_error(errno)) {
+            perror("recvmmsg");
+        }
+        return -1;
+    }
+
+    stats->recv_calls++;
+    stats->packets_received += ret;
+    return ret;
+}
@@ -0,0 +1,163 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Round a size up to a whole number of capture pages
+ *
+ * @param size Size in bytes
+ * @return Rounded size
+ */
+static size_t page_align(size_t size)
+{
+    return (size + CAPTURE_PAGE - 1) & ~(size_t)(CAPTURE_PAGE - 1);
+}
+
+/**
+ * Create the capture file and map it
+ * The file is sized and allocated up front, so recording a sample is a
+ * handful of stores into the mapping: no syscall, and no SIGBUS later
+ * because the disk filled up. The mapping is shared, so whatever was
+ * written is in the page cache and survives a crash of the prober.
+ *
+ * @param c Capture state (output)
+ * @param opts Options structure (targets are already collected)
+ * @param shards Number of rings, one per shard
+ * @return 0 on success, -1 on error
+ */
+int capture_open(t_capture *c, t_options *opts, int shards)
+{
+    t_capture_header *h;
+    size_t heads, targets, rings;
+    uint32_t capacity;
+    int ret;
+
+    memset(c, 0, sizeof(t_capture));
+    capacity = 1;
+    while (capacity < opts->capture_samples) {
+        capacity <<= 1;
+    }
+
+    heads = page_align(CAPTURE_PAGE);
+    targets = page_align(heads + SHARD_MAX * sizeof(t_capture_head));
+    rings = page_align(targets + opts->target_count * sizeof(t_capture_target));
+    c->size = rings + (size_t)shards * capacity * sizeof(t_sample);
+
+    c->fd = open(opts->capture_file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (c->fd < 0) {
+        perror(opts->capture_file);
+        return -1;
+    }
+    ret = posix_fallocate(c->fd, 0, c->size);
+    if (ret != 0) {
+        fprintf(stderr, "ft_ping: %s: %s\n", opts->capture_file, strerror(ret));
+        close(c->fd);
+        return -1;
+    }
+    c->map = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if (c->map == MAP_FAILED) {
+        perror("mmap");
+        close(c->fd);
+        return -1;
+    }
+
+    c->header = (t_capture_header *)c->map;
+    c->heads = (t_capture_head *)(c->map + heads);
+    c->targets = (t_capture_target *)(c->map + targets);
+    c->rings = (t_sample *)(c->map + rings);
+    c->wall_offset_ns = realtime_ns() - monotonic_ns();
+
+    /* Targets are listed by name now; addresses are filled in as they resolve */
+    for (int i = 0; i < opts->target_count; i++) {
+        strncpy(c->targets[i].name, opts->targets[i].hostname, CAPTURE_NAME_MAX - 1);
+    }
+
+    h = c->header;
+    h->byte_order = WIRE_BYTE_ORDER;
+    h->version = CAPTURE_VERSION;
+    h->sample_size = sizeof(t_sample);
+    h->target_size = sizeof(t_capture_target);
+    h->capacity = capacity;
+    h->shards = shards;
+    h->targets = opts->target_count;
+    h->start_ns = realtime_ns();
+    h->heads_offset = heads;
+    h->targets_offset = targets;
+    h->rings_offset = rings;
+
+    /* The magic goes last: a reader never sees a half-written header */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(h->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+
+    return 0;
+}
+
+/**
+ * Mark the capture as complete and unmap it
+ *
+ * @param c Capture state
+ */
+void capture_close(t_capture *c)
+{
+    __atomic_store_n(&c->header->end_ns, realtime_ns(), __ATOMIC_RELEASE);
+    if (msync(c->map, c->size, MS_ASYNC) < 0) {
+        perror("msync");
+    }
+    munmap(c->map, c->size);
+    close(c->fd);
+}
+
+/**
+ * Record the address of a target once it is known
+ *
+ * @param c Capture state
+ * @param index Position of the target
+ * @param addr Resolved address
+ */
+void capture_target(t_capture *c, int index, t_sockaddr *addr)
+{
+    t_capture_target *t;
+
+    t = &c->targets[index];
+    if (addr->sa.sa_family == AF_INET6) {
+        memcpy(t->addr, &addr->v6.sin6_addr, 16);
+        __atomic_store_n(&t->family, 6, __ATOMIC_RELEASE);
+    } else {
+        memcpy(t->addr, &addr->v4.sin_addr, 4);
+        __atomic_store_n(&t->family, 4, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Append one sample to the ring of a shard, overwriting the oldest
+ * The shard is the only writer of its ring. Each slot carries its own
+ * sequence, cleared while the slot is rewritten, so a reader running
+ * concurrently can tell a complete sample from one being overwritten.
+ *
+ * @param c Capture state
+ * @param shard Ring to write
+ * @param sample Sample to copy, with monotonic times
+ */
+void capture_sample(t_capture *c, int shard, t_sample *sample)
+{
+    t_sample *slot;
+    uint64_t pos;
+    uint32_t mask;
+
+    mask = c->header->capacity - 1;
+    pos = c->heads[shard].head;
+    slot = &c->rings[(size_t)shard * c->header->capacity + (pos & mask)];
+
+    __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->target = sample->target;
+    slot->seq = sample->seq;
+    slot->status = sample->status;
+    slot->ttl = sample->ttl;
+    slot->bytes = sample->bytes;
+    slot->icmp_type = sample->icmp_type;
+    slot->icmp_code = sample->icmp_code;
+    slot->send_ns = sample->send_ns + c->wall_offset_ns;
+    slot->recv_ns = sample->recv_ns + c->wall_offset_ns;
+    slot->rtt_ns = sample->rtt_ns;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&c->heads[shard].head, pos + 1, __ATOMIC_RELEASE);
+}
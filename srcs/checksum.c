@@ -0,0 +1,273 @@
+#include "../includes/ft_ping.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define CHECKSUM_X86
+#endif
+
+/* Vectors summed into 32-bit lanes before they are widened; each lane
+ * gains at most 2 * 0xFFFF per vector, so none can overflow */
+#define CHECKSUM_BLOCK 4096
+
+/**
+ * Fold a 64-bit one's complement sum and finish the checksum
+ *
+ * @param sum Sum of the data, with end-around carries
+ * @return Checksum value
+ */
+static uint16_t checksum_fold(uint64_t sum)
+{
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return ~sum;
+}
+
+/**
+ * Add the bytes left over by a wide loop to a one's complement sum
+ *
+ * @param sum Running sum
+ * @param data Remaining bytes
+ * @param count Number of remaining bytes
+ * @return Updated sum, with end-around carries
+ */
+static uint64_t checksum_tail(uint64_t sum, const uint8_t *data, int count)
+{
+    uint16_t word;
+
+    while (count > 1) {
+        memcpy(&word, data, sizeof(word));
+        sum += word;
+        data += 2;
+        count -= 2;
+    }
+
+    /* Add left-over byte, if any */
+    if (count > 0) {
+        sum += *data;
+    }
+
+    return sum;
+}
+
+/**
+ * Reference checksum, one 16-bit word at a time
+ *
+ * @param addr Buffer to compute checksum for
+ * @param count Number of bytes
+ * @return Checksum value
+ */
+uint16_t checksum_scalar(void *addr, int count)
+{
+    uint32_t sum = 0;
+    uint16_t *ptr = addr;
+
+    /* Sum up 16-bit words */
+    while (count > 1) {
+        sum += *ptr++;
+        count -= 2;
+    }
+
+    /* Add left-over byte, if any */
+    if (count > 0) {
+        sum += *(uint8_t *)ptr;
+    }
+
+    /* Fold 32-bit sum to 16 bits */
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return ~sum;
+}
+
+/**
+ * Portable checksum adding 32 bits at a time into a 64-bit accumulator
+ * The accumulator cannot overflow for any buffer an int can describe, so
+ * carries are only folded once at the end.
+ *
+ * @param addr Buffer to compute checksum for
+ * @param count Number of bytes
+ * @return Checksum value
+ */
+static uint16_t checksum_generic(void *addr, int count)
+{
+    const uint8_t *data = addr;
+    uint64_t sum0 = 0, sum1 = 0;
+    uint32_t a, b;
+
+    /* Two independent accumulators keep both adders busy */
+    while (count >= 8) {
+        memcpy(&a, data, sizeof(a));
+        memcpy(&b, data + 4, sizeof(b));
+        sum0 += a;
+        sum1 += b;
+        data += 8;
+        count -= 8;
+    }
+
+    return checksum_fold(checksum_tail(sum0 + sum1, data, count));
+}
+
+#ifdef CHECKSUM_X86
+
+/**
+ * SSE2 checksum, 16 bytes per iteration
+ * Words are zero-extended into 32-bit lanes and widened into the 64-bit
+ * sum every CHECKSUM_BLOCK vectors.
+ *
+ * @param addr Buffer to compute checksum for
+ * @param count Number of bytes
+ * @return Checksum value
+ */
+__attribute__((target("sse2")))
+static uint16_t checksum_sse2(void *addr, int count)
+{
+    const uint8_t *data = addr;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc, v;
+    uint32_t lanes[4];
+    uint64_t sum = 0;
+    int block;
+
+    while (count >= 16) {
+        acc = zero;
+        for (block = 0; block < CHECKSUM_BLOCK && count >= 16; block++) {
+            v = _mm_loadu_si128((const __m128i *)data);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            data += 16;
+            count -= 16;
+        }
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    return checksum_fold(checksum_tail(sum, data, count));
+}
+
+/**
+ * AVX2 checksum, 32 bytes per iteration
+ *
+ * @param addr Buffer to compute checksum for
+ * @param count Number of bytes
+ * @return Checksum value
+ */
+__attribute__((target("avx2")))
+static uint16_t checksum_avx2(void *addr, int count)
+{
+    const uint8_t *data = addr;
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc, v;
+    uint32_t lanes[8];
+    uint64_t sum = 0;
+    int block;
+
+    while (count >= 32) {
+        acc = zero;
+        for (block = 0; block < CHECKSUM_BLOCK && count >= 32; block++) {
+            v = _mm256_loadu_si256((const __m256i *)data);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            data += 32;
+            count -= 32;
+        }
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (int i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
+    }
+
+    return checksum_fold(checksum_tail(sum, data, count));
+}
+
+#endif
+
+/* Implementations, fastest first */
+static const t_checksum_impl g_checksum_impls[] = {
+#ifdef CHECKSUM_X86
+    {"avx2", checksum_avx2},
+    {"sse2", checksum_sse2},
+#endif
+    {"generic", checksum_generic},
+    {"scalar", checksum_scalar},
+};
+
+/**
+ * Check whether the CPU can run an implementation
+ *
+ * @param impl Checksum implementation
+ * @return true if it can be used
+ */
+static bool checksum_supported(const t_checksum_impl *impl)
+{
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (impl->fn == checksum_avx2) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (impl->fn == checksum_sse2) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    (void)impl;
+    return true;
+}
+
+/**
+ * List the implementations this CPU can run, fastest first
+ *
+ * @param impls Implementations (output, at least CHECKSUM_IMPL_MAX entries)
+ * @return Number of implementations
+ */
+int checksum_impls(t_checksum_impl *impls)
+{
+    int count = 0;
+
+    for (size_t i = 0; i < sizeof(g_checksum_impls) / sizeof(*g_checksum_impls); i++) {
+        if (checksum_supported(&g_checksum_impls[i])) {
+            impls[count++] = g_checksum_impls[i];
+        }
+    }
+
+    return count;
+}
+
+static uint16_t checksum_resolve(void *addr, int count);
+
+/* Implementation used by compute_checksum, picked on the first call */
+static uint16_t (*g_checksum)(void *, int) = checksum_resolve;
+
+/**
+ * Pick the fastest implementation the CPU supports, then run it
+ * Every caller resolves to the same function, so concurrent first calls
+ * are harmless.
+ *
+ * @param addr Buffer to compute checksum for
+ * @param count Number of bytes
+ * @return Checksum value
+ */
+static uint16_t checksum_resolve(void *addr, int count)
+{
+    t_checksum_impl impls[CHECKSUM_IMPL_MAX];
+
+    checksum_impls(impls);
+    __atomic_store_n(&g_checksum, impls[0].fn, __ATOMIC_RELAXED);
+
+    return impls[0].fn(addr, count);
+}
+
+/**
+ * Compute the checksum of an ICMP packet
+ *
+ * @param addr Buffer to compute checksum for
+ * @param count Number of bytes
+ * @return Checksum value
+ */
+uint16_t compute_checksum(void *addr, int count)
+{
+    return __atomic_load_n(&g_checksum, __ATOMIC_RELAXED)(addr, count);
+}
@@ -3,76 +3,413 @@
 
 /**
  * Print ping header information
+ * The output thread flushes stdout once it has drained its rings.
  *
- * @param opts Options structure
+ * @param hostname Target as given on the command line
+ * @param ipstr Target address string
+ * @param size Size of a probe, ICMP header included
  */
-void print_ping_header(t_options *opts)
+void print_ping_header(const char *hostname, const char *ipstr, int size)
 {
     printf("PING %s (%s) %zu(%d) bytes of data.\n",
-           opts->hostname,
-           opts->ipstr,
-           PACKET_SIZE - sizeof(struct icmphdr),
-           PACKET_SIZE);
-
-    /* Flush stdout to ensure the header is displayed immediately */
-    fflush(stdout);
+           hostname,
+           ipstr,
+           size - sizeof(struct icmphdr),
+           size);
 }
 
 /**
  * Print ping result for a single packet
  *
- * @param opts Options structure
+ * @param name Target as displayed (reverse name or host name)
+ * @param ipstr Target address string
  * @param seq Sequence number
  * @param bytes Bytes received
+ * @param ttl TTL the reply arrived with, 0 if unknown (then not shown)
  * @param rtt Round-trip time in milliseconds
+ * @param status REPLY_OK, or REPLY_LATE or REPLY_DUPLICATE (then flagged)
  */
-void print_ping_result(t_options *opts, int seq, int bytes, float rtt)
+void print_ping_result(const char *name, const char *ipstr, int seq, int bytes, int ttl, float rtt, int status)
 {
     /* Display the basic ping result format - formatted exactly like inetutils-2.0 */
-    printf("%d bytes from %s (%s): icmp_seq=%d ttl=%d time=%.3f ms\n",
-           bytes,
-           opts->hostname,
-           opts->ipstr,
-           seq,
-           DEFAULT_TTL,
-           rtt);
-
-    /* Flush stdout to ensure each result is displayed immediately */
-    fflush(stdout);
+    printf("%d bytes from %s (%s): icmp_seq=%d", bytes, name, ipstr, seq);
+    if (ttl > 0) {
+        printf(" ttl=%d", ttl);
+    }
+    printf(" time=%.3f ms", rtt);
+    if (status == REPLY_DUPLICATE) {
+        printf(" (DUP!)");
+    } else if (status == REPLY_LATE) {
+        printf(" (late)");
+    }
+    putchar('\n');
 }
 
 /**
- * Print ping statistics
+ * Print the header of a path trace, the way traceroute does
  *
- * @param stats Ping statistics structure
+ * @param hostname Target as given on the command line
+ * @param ipstr Target address string
+ * @param hops Largest TTL probed
+ * @param size Size of a probe, ICMP header included
  */
-void print_ping_stats(t_ping_stats *stats)
+void print_trace_header(const char *hostname, const char *ipstr, int hops, int size)
 {
-    double packet_loss;
+    printf("traceroute to %s (%s), %d hops max, %d byte packets\n",
+           hostname, ipstr, hops, size);
+}
+
+/**
+ * Get the name of a hop status, as used in machine formats
+ *
+ * @param status HOP_*
+ * @return Name
+ */
+const char *hop_status_name(int status)
+{
+    static const char *names[] = {"pending", "router", "reached", "error", "timeout"};
+
+    return status >= HOP_PENDING && status <= HOP_TIMEOUT ? names[status] : "unknown";
+}
+
+/**
+ * Print one hop of a traced path
+ * A hop that ended the path with an ICMP error other than time exceeded
+ * says why, where traceroute would print !H or !X.
+ *
+ * @param rec Hop record
+ */
+void print_hop(t_record *rec)
+{
+    char from[INET6_ADDRSTRLEN];
 
-    /* Calculate packet loss percentage */
-    if (stats->packets_sent > 0) {
-        packet_loss = 100.0 * (stats->packets_sent - stats->packets_received) / stats->packets_sent;
+    if (rec->status == HOP_TIMEOUT || rec->status == HOP_PENDING) {
+        printf("%2d  *\n", rec->ttl);
+        return;
+    }
+    printf("%2d  %s  %.3f ms", rec->ttl, sockaddr_str(&rec->from, from, sizeof(from)), rec->rtt);
+    if (rec->status == HOP_ERROR) {
+        printf("  (%s)", icmp_error_text(rec->target->addr.sa.sa_family, rec->icmp_type, rec->icmp_code));
+    }
+    putchar('\n');
+}
+
+/**
+ * Get the name of the outcome of a path MTU search, as used in machine formats
+ *
+ * @param status PMTU_FOUND, PMTU_PARTIAL or PMTU_NONE
+ * @return Name
+ */
+const char *pmtu_status_name(int status)
+{
+    static const char *names[] = {"found", "partial", "none"};
+
+    return status >= PMTU_FOUND && status <= PMTU_NONE ? names[status] : "unknown";
+}
+
+/**
+ * Print the outcome of a path MTU search, the way tracepath sums it up
+ *
+ * @param rec Path MTU record
+ */
+void print_pmtu(t_record *rec)
+{
+    printf("%s (%s): ", rec->name, rec->target->ipstr);
+    if (rec->status == PMTU_NONE) {
+        printf("no probe came back");
     } else {
-        packet_loss = 0.0;
+        printf("pmtu %s%u (%d bytes of data)", rec->status == PMTU_PARTIAL ? ">= " : "",
+               rec->mtu, rec->bytes - (int)sizeof(struct icmphdr));
+    }
+    printf(", %d round%s\n", rec->seq, rec->seq == 1 ? "" : "s");
+}
+
+/**
+ * Describe an ICMP error the way iputils ping does
+ *
+ * @param family AF_INET or AF_INET6
+ * @param type ICMP or ICMPv6 type
+ * @param code ICMP or ICMPv6 code
+ * @return Description
+ */
+const char *icmp_error_text(int family, int type, int code)
+{
+    static const char *unreach[] = {
+        "Destination Net Unreachable", "Destination Host Unreachable",
+        "Destination Protocol Unreachable", "Destination Port Unreachable",
+        "Frag needed and DF set", "Source Route Failed",
+        "Destination Net Unknown", "Destination Host Unknown",
+        "Source Host Isolated", "Destination Net Prohibited",
+        "Destination Host Prohibited", "Destination Net Unreachable for Type of Service",
+        "Destination Host Unreachable for Type of Service", "Packet filtered",
+        "Precedence Violation", "Precedence Cutoff",
+    };
+    static const char *redirect[] = {
+        "Redirect Network", "Redirect Host",
+        "Redirect Type of Service and Network", "Redirect Type of Service and Host",
+    };
+    static const char *unreach6[] = {
+        "No route", "Administratively prohibited", "Beyond scope of source address",
+        "Address unreachable", "Port unreachable",
+        "Source address failed ingress/egress policy", "Reject route to destination",
+    };
+    static const char *param6[] = {
+        "Erroneous header field", "Unrecognized next header", "Unrecognized IPv6 option",
+    };
+
+    if (family == AF_INET6) {
+        switch (type) {
+            case ICMP6_DST_UNREACH:
+                return code < 7 ? unreach6[code] : "Destination unreachable";
+            case ICMP6_PACKET_TOO_BIG:
+                return "Packet too big";
+            case ICMP6_TIME_EXCEEDED:
+                return code == 0 ? "Hop limit exceeded" : "Fragment reassembly time exceeded";
+            case ICMP6_PARAM_PROB:
+                return code < 3 ? param6[code] : "Parameter problem";
+            default:
+                return "Unknown ICMPv6 error";
+        }
+    }
+
+    switch (type) {
+        case ICMP_DEST_UNREACH:
+            return code < 16 ? unreach[code] : "Dest Unreachable, Bad Code";
+        case ICMP_TIME_EXCEEDED:
+            return code == 0 ? "Time to live exceeded" : "Frag reassembly time exceeded";
+        case ICMP_REDIRECT:
+            return code < 4 ? redirect[code] : "Redirect, Bad Code";
+        case ICMP_PARAMETERPROB:
+            return "Parameter problem";
+        default:
+            return "Unknown ICMP error";
+    }
+}
+
+/**
+ * Print one record taken from an output ring
+ * Flood mode marks are '.' per probe sent, a backspace per reply and
+ * "\bE" per error.
+ *
+ * @param rec Record to print
+ */
+void print_record(t_record *rec)
+{
+    char from[INET6_ADDRSTRLEN];
+
+    if (rec->type == RECORD_HEADER) {
+        print_ping_header(rec->name, rec->target->ipstr, rec->bytes);
+    } else if (rec->type == RECORD_REPLY) {
+        print_ping_result(rec->name, rec->target->ipstr, rec->seq, rec->bytes, rec->ttl, rec->rtt, rec->status);
+    } else if (rec->type == RECORD_ERROR) {
+        printf("%d bytes from %s: icmp_seq=%d %s", rec->bytes,
+               sockaddr_str(&rec->from, from, sizeof(from)), rec->seq,
+               icmp_error_text(rec->target->addr.sa.sa_family, rec->icmp_type, rec->icmp_code));
+        if (rec->mtu) {
+            printf(" (mtu = %u)", rec->mtu);
+        }
+        putchar('\n');
+    } else if (rec->type == RECORD_TRACE) {
+        print_trace_header(rec->name, rec->target->ipstr, rec->ttl, rec->bytes);
+    } else if (rec->type == RECORD_HOP) {
+        print_hop(rec);
+    } else if (rec->type == RECORD_PMTU) {
+        print_pmtu(rec);
+    } else if (rec->type == RECORD_MARK) {
+        putchar(rec->mark);
     }
+}
 
-    /* Print statistics in a format matching inetutils-2.0 */
-    printf("\n--- %s ping statistics ---\n", stats->hostname);
-    printf("%d packets transmitted, %d received, %.1f%% packet loss, time %dms\n",
-           stats->packets_sent,
-           stats->packets_received,
-           packet_loss,
-           (int)stats->total_time);
+/**
+ * Print how many ICMP errors of each kind came back, if any did
+ *
+ * @param errors Counts indexed by ICMP_ERR_*
+ */
+void print_error_counts(int *errors)
+{
+    bool any = false;
 
-    if (stats->packets_received > 0) {
-        printf("rtt min/avg/max/mdev = %.3f/%.3f/%.3f/0.000 ms\n",
-               stats->min_time,
-               stats->total_time / stats->packets_received,
-               stats->max_time);
+    for (int i = 0; i < ICMP_ERR_KINDS; i++) {
+        if (errors[i] == 0) {
+            continue;
+        }
+        printf("%s%s=%d", any ? " " : "icmp errors: ", icmp_error_name(i), errors[i]);
+        any = true;
+    }
+    if (any) {
+        putchar('\n');
+    }
+}
+
+/**
+ * Print tail latency quantiles from an RTT histogram
+ *
+ * @param histogram Bucket counts (HIST_BUCKETS entries), may be NULL
+ * @param total Number of samples recorded
+ * @param min Smallest sample recorded, in milliseconds
+ * @param max Largest sample recorded, in milliseconds
+ */
+void print_rtt_quantiles(uint32_t *histogram, long total, double min, double max)
+{
+    if (!histogram || total == 0) {
+        return;
+    }
+
+    printf("rtt p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+           histogram_quantile(histogram, total, 0.50, min, max),
+           histogram_quantile(histogram, total, 0.90, min, max),
+           histogram_quantile(histogram, total, 0.99, min, max),
+           histogram_quantile(histogram, total, 0.999, min, max));
+}
+
+/**
+ * Print totals across every target of a multi-target run
+ *
+ * @param stats Per-target statistics
+ * @param count Number of targets
+ */
+void print_ping_summary(t_ping_stats *stats, int count)
+{
+    uint32_t histogram[HIST_BUCKETS];
+    t_ping_stats total;
+    long sent, received, errors;
+    int alive;
+    double packet_loss;
+
+    alive = merge_stats(&total, histogram, stats, count);
+    sent = total.packets_sent;
+    received = total.packets_received;
+    errors = 0;
+    for (int j = 0; j < ICMP_ERR_KINDS; j++) {
+        errors += total.errors[j];
+    }
+
+    packet_loss = sent > 0 ? 100.0 * (sent - received) / sent : 0.0;
+
+    printf("\n--- %d targets, %d alive, %d unreachable ---\n",
+           count, alive, count - alive);
+    printf("%ld packets transmitted, %ld received, ", sent, received);
+    if (total.replies[REPLY_DUPLICATE] > 0) {
+        printf("+%d duplicates, ", total.replies[REPLY_DUPLICATE]);
+    }
+    if (total.replies[REPLY_CORRUPTED] > 0) {
+        printf("+%d corrupted, ", total.replies[REPLY_CORRUPTED]);
+    }
+    if (total.replies[REPLY_MISMATCHED] > 0) {
+        printf("+%d mismatched, ", total.replies[REPLY_MISMATCHED]);
+    }
+    if (errors > 0) {
+        printf("+%ld errors, ", errors);
+    }
+    printf("%.1f%% packet loss\n", packet_loss);
+    print_rtt_quantiles(histogram, received, total.min_time, total.max_time);
+
+    fflush(stdout);
+}
+
+/**
+ * Print the average number of packets moved per batched syscall
+ *
+ * @param stats Batching counters
+ */
+void print_batch_stats(t_batch_stats *stats)
+{
+    /* Keep these lines after the statistics already written to stdout */
+    fflush(stdout);
+
+    print_verbose("sendmmsg: %ld calls, %ld packets, %.2f packets/call",
+                  stats->send_calls, stats->packets_sent,
+                  stats->send_calls ? (double)stats->packets_sent / stats->send_calls : 0.0);
+    print_verbose("recvmmsg: %ld calls, %ld packets, %.2f packets/call",
+                  stats->recv_calls, stats->packets_received,
+                  stats->recv_calls ? (double)stats->packets_received / stats->recv_calls : 0.0);
+}
+
+/**
+ * Print how many datagrams reached us and how many were ours
+ * Without a kernel filter a raw socket also receives every other ICMP
+ * packet on the host, which shows up as a gap between the two counts.
+ *
+ * @param stats Batching counters
+ * @param filter How unrelated packets are filtered
+ */
+void print_filter_stats(t_batch_stats *stats, const char *filter)
+{
+    /* Keep these lines after the statistics already written to stdout */
+    fflush(stdout);
+
+    print_verbose("filter: %s, %ld delivered, %ld accepted (%.1f%%)",
+                  filter, stats->packets_received, stats->packets_accepted,
+                  stats->packets_received ? 100.0 * stats->packets_accepted / stats->packets_received : 100.0);
+}
+
+/**
+ * Print how many lookups reached a name server and how many the cache saved
+ *
+ * @param lookups Lookups handed to the resolver threads
+ * @param hits Lookups answered from the cache
+ */
+void print_dns_stats(long lookups, long hits)
+{
+    /* Keep these lines after the statistics already written to stdout */
+    fflush(stdout);
+
+    print_verbose("dns: %ld lookups, %ld answered from cache", lookups, hits);
+}
+
+/**
+ * Print which clocks the round-trip times were measured with
+ *
+ * @param rtt_sources Number of RTTs per clock, indexed by RTT_*
+ */
+void print_timestamp_stats(long *rtt_sources)
+{
+    /* Keep these lines after the statistics already written to stdout */
+    fflush(stdout);
+
+    print_verbose("rtt clocks: %ld hardware, %ld kernel software, %ld monotonic",
+                  rtt_sources[RTT_HARDWARE],
+                  rtt_sources[RTT_SOFTWARE],
+                  rtt_sources[RTT_MONOTONIC]);
+}
+
+/**
+ * Report output lines lost because the output thread fell behind
+ *
+ * @param dropped Records dropped from full rings
+ */
+void print_output_stats(long dropped)
+{
+    if (dropped > 0) {
+        fprintf(stderr, "ft_ping: output too slow, %ld lines dropped\n", dropped);
+    }
+}
+
+/**
+ * Print the send rate that was asked for next to the one achieved
+ *
+ * @param opts Options structure
+ * @param requested Probes per second asked for (final rate for adaptive mode)
+ * @param settled The adaptive rate stopped ramping
+ * @param sent Probes sent to all targets
+ * @param elapsed_ns Duration of the run
+ */
+void print_rate_stats(t_options *opts, double requested, bool settled, long sent, int64_t elapsed_ns)
+{
+    double achieved;
+
+    achieved = elapsed_ns > 0 ? sent * (double)NSEC_PER_SEC / elapsed_ns : 0.0;
+
+    if (opts->flood) {
+        printf("rate: flood, achieved %.1f probes/s\n", achieved);
+    } else if (opts->adaptive) {
+        printf("rate: adaptive, %s at %.1f probes/s, achieved %.1f probes/s\n",
+               settled ? "settled" : "still ramping", requested, achieved);
+    } else {
+        printf("rate: requested %.1f probes/s, achieved %.1f probes/s\n",
+               requested, achieved);
     }
 
-    /* Flush stdout to ensure statistics are displayed immediately */
     fflush(stdout);
 }
 
@@ -1,38 +1,41 @@
 #include "../includes/ft_ping.h"
 
 /**
- * Resolve hostname to IP address
+ * Resolve a name with getaddrinfo and keep the first usable address
  *
  * @param hostname Hostname or IP address string
+ * @param family AF_INET, AF_INET6, or AF_UNSPEC for the preferred of both
+ * @param flags getaddrinfo flags (AI_NUMERICHOST to never query DNS)
  * @param addr Address structure to fill (output)
  * @param ipstr IP address string (output, must be freed by caller)
  * @return 0 on success, -1 on error
  */
-int resolve_hostname(const char *hostname, struct sockaddr_in *addr, char **ipstr)
+static int resolve(const char *hostname, int family, int flags, t_sockaddr *addr, char **ipstr)
 {
     struct addrinfo hints, *res, *p;
     int status;
-    char ip[INET_ADDRSTRLEN];
+    char ip[INET6_ADDRSTRLEN];
 
     /* Set up hints for getaddrinfo */
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;     /* IPv4 only */
+    hints.ai_family = family;      /* Either family unless -4 or -6 was given */
     hints.ai_socktype = SOCK_RAW;  /* Raw socket */
+    hints.ai_flags = flags;
 
     /* Get address info */
     if ((status = getaddrinfo(hostname, NULL, &hints, &res)) != 0) {
         return -1;
     }
 
-    /* Get the first IPv4 address */
+    /* Get the first address, in the order getaddrinfo prefers (RFC 6724) */
     for (p = res; p != NULL; p = p->ai_next) {
-        if (p->ai_family == AF_INET) {
+        if (p->ai_family == AF_INET || p->ai_family == AF_INET6) {
             /* Copy address */
-            memcpy(addr, p->ai_addr, sizeof(struct sockaddr_in));
+            memset(addr, 0, sizeof(t_sockaddr));
+            memcpy(addr, p->ai_addr, p->ai_addrlen);
 
             /* Convert IP to string */
-            inet_ntop(AF_INET, &(addr->sin_addr), ip, INET_ADDRSTRLEN);
-            *ipstr = strdup(ip);
+            *ipstr = strdup(sockaddr_str(addr, ip, sizeof(ip)));
 
             freeaddrinfo(res);
             return 0;
@@ -44,21 +47,49 @@ int resolve_hostname(const char *hostname, struct sockaddr_in *addr, char **ipst
     return -1;
 }
 
+/**
+ * Resolve hostname to IP address
+ * This may block for as long as the name servers take to answer.
+ *
+ * @param hostname Hostname or IP address string
+ * @param family AF_INET, AF_INET6, or AF_UNSPEC for the preferred of both
+ * @param addr Address structure to fill (output)
+ * @param ipstr IP address string (output, must be freed by caller)
+ * @return 0 on success, -1 on error
+ */
+int resolve_hostname(const char *hostname, int family, t_sockaddr *addr, char **ipstr)
+{
+    return resolve(hostname, family, 0, addr, ipstr);
+}
+
+/**
+ * Parse a numeric IP address, without any lookup
+ *
+ * @param hostname IP address string
+ * @param family AF_INET, AF_INET6, or AF_UNSPEC for either
+ * @param addr Address structure to fill (output)
+ * @param ipstr IP address string (output, must be freed by caller)
+ * @return 0 on success, -1 if hostname is not an address of that family
+ */
+int resolve_numeric(const char *hostname, int family, t_sockaddr *addr, char **ipstr)
+{
+    return resolve(hostname, family, AI_NUMERICHOST, addr, ipstr);
+}
+
 /**
  * Get hostname from IP address (reverse DNS lookup)
- * Note: This function is not used in the packet return as per project requirements,
- *       but can be used for display purposes.
+ * This may block; the ping loop goes through the resolver instead.
  *
  * @param addr Address structure
  * @return Hostname or NULL on error (must be freed by caller)
  */
-char *get_hostname_from_ip(struct sockaddr_in *addr)
+char *get_hostname_from_ip(t_sockaddr *addr)
 {
     char host[NI_MAXHOST];
     int ret;
 
     /* Perform reverse DNS lookup */
-    ret = getnameinfo((struct sockaddr *)addr, sizeof(struct sockaddr_in),
+    ret = getnameinfo(&addr->sa, sockaddr_len(addr),
                       host, NI_MAXHOST, NULL, 0, NI_NAMEREQD);
 
     if (ret != 0) {
@@ -67,3 +98,33 @@ char *get_hostname_from_ip(struct sockaddr_in *addr)
 
     return strdup(host);
 }
+
+/**
+ * Get the length of an address for the socket calls
+ *
+ * @param addr Address structure
+ * @return Size of the family's sockaddr
+ */
+socklen_t sockaddr_len(t_sockaddr *addr)
+{
+    return addr->sa.sa_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                                          : sizeof(struct sockaddr_in);
+}
+
+/**
+ * Format an address for display
+ *
+ * @param addr Address structure
+ * @param buffer Output buffer (INET6_ADDRSTRLEN bytes is enough)
+ * @param size Size of the buffer
+ * @return The buffer
+ */
+const char *sockaddr_str(t_sockaddr *addr, char *buffer, size_t size)
+{
+    if (addr->sa.sa_family == AF_INET6) {
+        inet_ntop(AF_INET6, &addr->v6.sin6_addr, buffer, size);
+    } else {
+        inet_ntop(AF_INET, &addr->v4.sin_addr, buffer, size);
+    }
+    return buffer;
+}
@@ -0,0 +1,150 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Create the epoll instance and the send timer
+ *
+ * @param loop Event loop to initialize
+ * @return 0 on success, -1 on error
+ */
+int event_init(t_event_loop *loop)
+{
+    struct epoll_event ev;
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->timerfd < 0) {
+        perror("timerfd_create");
+        close(loop->epfd);
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = EVENT_TIMER;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timerfd, &ev) < 0) {
+        perror("epoll_ctl");
+        event_free(loop);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Watch the socket of an endpoint for replies
+ * Its error queue is reported through EPOLLERR, which needs no request.
+ *
+ * @param loop Event loop
+ * @param sockfd Socket to watch
+ * @param endpoint Endpoint of the socket (ENDPOINT_*)
+ * @return 0 on success, -1 on error
+ */
+int event_add_socket(t_event_loop *loop, int sockfd, int endpoint)
+{
+    return event_add_fd(loop, sockfd, EVENT_SOCKET(endpoint));
+}
+
+/**
+ * Watch a descriptor for readability
+ *
+ * @param loop Event loop
+ * @param fd Descriptor to watch
+ * @param source Bit reported by event_wait when it is readable (EVENT_*)
+ * @return 0 on success, -1 on error
+ */
+int event_add_fd(t_event_loop *loop, int fd, int source)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = source;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Release the epoll instance and the send timer
+ *
+ * @param loop Event loop
+ */
+void event_free(t_event_loop *loop)
+{
+    close(loop->timerfd);
+    close(loop->epfd);
+}
+
+/**
+ * Arm the send timer to tick periodically from an absolute start time
+ * The kernel keeps the cadence, so ticks do not drift with processing time.
+ *
+ * @param loop Event loop
+ * @param start_ns Time of the first tick (monotonic)
+ * @param period_ns Time between two ticks
+ * @return 0 on success, -1 on error
+ */
+int event_start_timer(t_event_loop *loop, int64_t start_ns, int64_t period_ns)
+{
+    struct itimerspec spec;
+
+    spec.it_value.tv_sec = start_ns / NSEC_PER_SEC;
+    spec.it_value.tv_nsec = start_ns % NSEC_PER_SEC;
+    spec.it_interval.tv_sec = period_ns / NSEC_PER_SEC;
+    spec.it_interval.tv_nsec = period_ns % NSEC_PER_SEC;
+
+    if (timerfd_settime(loop->timerfd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        perror("timerfd_settime");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Sleep until a reply arrives, the send timer ticks, a name resolves or
+ * the timeout elapses
+ *
+ * @param loop Event loop
+ * @param timeout_ms Maximum time to sleep (-1 to wait for an event)
+ * @return Mask of EVENT_* sources, 0 on timeout or interruption
+ */
+int event_wait(t_event_loop *loop, int timeout_ms)
+{
+    struct epoll_event events[EVENT_SOURCES];
+    uint64_t ticks;
+    int ready, mask;
+
+    ready = epoll_wait(loop->epfd, events, EVENT_SOURCES, timeout_ms);
+    if (ready < 0) {
+        if (errno != EINTR) {
+            perror("epoll_wait");
+        }
+        return 0;
+    }
+
+    mask = 0;
+    for (int i = 0; i < ready; i++) {
+        mask |= events[i].data.u32;
+        /* Transmit timestamps and, on ping sockets, ICMP errors are
+         * queued on the error queue; its bit follows the socket's own */
+        if ((events[i].events & EPOLLERR) && events[i].data.u32 != EVENT_TIMER) {
+            mask |= events[i].data.u32 << 1;
+        }
+    }
+
+    /* Acknowledge the ticks so the timer stops being readable */
+    if ((mask & EVENT_TIMER) && read(loop->timerfd, &ticks, sizeof(ticks)) < 0) {
+        mask &= ~EVENT_TIMER;
+    }
+
+    return mask;
+}
@@ -0,0 +1,94 @@
+#include "../includes/ft_ping.h"
+#include <linux/filter.h>
+
+/**
+ * Attach a classic BPF filter letting through only ICMP meant for us
+ * A raw socket otherwise gets a copy of every ICMP packet the host
+ * receives. The filter accepts echo replies carrying our identifier and
+ * the errors we decode (destination unreachable, time exceeded, redirect,
+ * parameter problem; packet too big for ICMPv6) when the request they
+ * quote carries our identifier. Everything
+ * else is dropped in the kernel, before any wakeup or copy.
+ * Raw ICMPv6 sockets are filtered after the IPv6 header was stripped, so
+ * their offsets start at the ICMPv6 header; the request quoted by an error
+ * is assumed to have no extension headers, since we never add any.
+ *
+ * @param sockfd Raw ICMP or ICMPv6 socket
+ * @param family AF_INET or AF_INET6
+ * @param ident Echo identifier of our requests (host byte order)
+ * @return 0 on success, -1 on error
+ */
+int attach_reply_filter(int sockfd, int family, uint16_t ident)
+{
+    struct sock_filter code[] = {
+        /* X = outer IP header length, A = ICMP type */
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 2),
+
+        /* Echo reply: accept if the identifier is ours */
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ident, 13, 14),
+
+        /* Errors we decode */
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_DEST_UNREACH, 3, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_TIME_EXCEEDED, 2, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_REDIRECT, 1, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_PARAMETERPROB, 0, 10),
+
+        /* X = outer header length + quoted IP header length */
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+
+        /* Quoted packet: accept if it is one of our echo requests */
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO, 0, 3),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 12),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ident, 0, 1),
+
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_filter code6[] = {
+        /* A = ICMPv6 type */
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 0, 2),
+
+        /* Echo reply: accept if the identifier is ours */
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ident, 8, 9),
+
+        /* Errors we decode */
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_DST_UNREACH, 3, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_PACKET_TOO_BIG, 2, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_TIME_EXCEEDED, 1, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_PARAM_PROB, 0, 5),
+
+        /* Quoted packet, after 8 bytes of error and 40 of IPv6 header */
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 48),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REQUEST, 0, 3),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 52),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ident, 0, 1),
+
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog;
+
+    if (family == AF_INET6) {
+        prog.len = sizeof(code6) / sizeof(*code6);
+        prog.filter = code6;
+    } else {
+        prog.len = sizeof(code) / sizeof(*code);
+        prog.filter = code;
+    }
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        perror("setsockopt SO_ATTACH_FILTER");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,393 @@
+#include "../includes/ft_ping.h"
+
+/* Stdio block used for machine formats, so lines leave in large writes */
+static char g_output_buffer[OUTPUT_BUFFER_SIZE];
+
+/* Quantiles reported for every set of statistics */
+static const double g_quantiles[4] = {0.50, 0.90, 0.99, 0.999};
+
+/**
+ * Write a string as a JSON string literal
+ *
+ * @param s String to write
+ */
+static void json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            printf("\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            printf("\\u%04x", (unsigned char)*s);
+        } else {
+            putchar(*s);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * Write the members naming a target: position, host name and address
+ *
+ * @param opts Options structure
+ * @param t Target
+ * @param name Host name to show
+ */
+static void json_target(t_options *opts, t_target *t, const char *name)
+{
+    printf("\"target\":%d,\"host\":", (int)(t - opts->targets));
+    json_string(name);
+    printf(",\"addr\":");
+    json_string(t->ipstr);
+}
+
+/**
+ * Write the round-trip members of a set of statistics
+ *
+ * @param sent Probes sent
+ * @param received Replies received
+ * @param histogram RTT histogram, may be NULL
+ * @param min Smallest round-trip time, in milliseconds
+ * @param max Largest round-trip time, in milliseconds
+ */
+static void json_counts(long sent, long received, uint32_t *histogram, double min, double max)
+{
+    static const char *names[4] = {"p50", "p90", "p99", "p999"};
+
+    printf(",\"transmitted\":%ld,\"received\":%ld,\"loss\":%.1f",
+           sent, received, sent > 0 ? 100.0 * (sent - received) / sent : 0.0);
+    if (histogram && received > 0) {
+        for (int i = 0; i < 4; i++) {
+            printf(",\"%s_ms\":%.3f", names[i], histogram_quantile(histogram, received, g_quantiles[i], min, max));
+        }
+    }
+}
+
+/**
+ * Write the ICMP error counts of a set of statistics
+ *
+ * @param errors Counts indexed by ICMP_ERR_*
+ */
+static void json_errors(int *errors)
+{
+    int total = 0;
+
+    for (int i = 0; i < ICMP_ERR_KINDS; i++) {
+        total += errors[i];
+    }
+    printf(",\"errors\":%d", total);
+    if (total == 0) {
+        return;
+    }
+    printf(",\"icmp_errors\":{");
+    for (int i = 0, first = 1; i < ICMP_ERR_KINDS; i++) {
+        if (errors[i] > 0) {
+            printf("%s\"%s\":%d", first ? "" : ",", icmp_error_name(i), errors[i]);
+            first = 0;
+        }
+    }
+    putchar('}');
+}
+
+/**
+ * Write the counts of replies other than first, intact answers
+ *
+ * @param replies Counts indexed by REPLY_*
+ */
+static void json_replies(int *replies)
+{
+    printf(",\"late\":%d,\"duplicates\":%d,\"corrupted\":%d,\"mismatched\":%d",
+           replies[REPLY_LATE], replies[REPLY_DUPLICATE],
+           replies[REPLY_CORRUPTED], replies[REPLY_MISMATCHED]);
+}
+
+/**
+ * Fill the target part of a binary record
+ *
+ * @param opts Options structure
+ * @param wire Record to fill (zeroed by the caller)
+ * @param type WIRE_* type
+ * @param t Target
+ */
+static void wire_target(t_options *opts, t_wire_record *wire, int type, t_target *t)
+{
+    wire->type = type;
+    wire->target = (uint32_t)(t - opts->targets);
+    if (t->addr.sa.sa_family == AF_INET6) {
+        wire->family = 6;
+        memcpy(wire->addr, &t->addr.v6.sin6_addr, 16);
+    } else {
+        wire->family = 4;
+        memcpy(wire->addr, &t->addr.v4.sin_addr, 4);
+    }
+}
+
+/**
+ * Fill the address of the host that answered a probe
+ *
+ * @param wire Record to fill
+ * @param from Router or target, unset (family 0) if none answered
+ */
+static void wire_from(t_wire_record *wire, t_sockaddr *from)
+{
+    if (from->sa.sa_family == AF_INET6) {
+        wire->u.probe.from_family = 6;
+        memcpy(wire->u.probe.from, &from->v6.sin6_addr, 16);
+    } else if (from->sa.sa_family == AF_INET) {
+        wire->u.probe.from_family = 4;
+        memcpy(wire->u.probe.from, &from->v4.sin_addr, 4);
+    }
+}
+
+/**
+ * Fill the statistics part of a binary record
+ *
+ * @param wire Record to fill
+ * @param sent Probes sent
+ * @param received Replies received
+ * @param histogram RTT histogram, may be NULL
+ * @param min Smallest round-trip time, in milliseconds
+ * @param max Largest round-trip time, in milliseconds
+ */
+static void wire_counts(t_wire_record *wire, long sent, long received, uint32_t *histogram, double min, double max)
+{
+    wire->u.stats.transmitted = sent;
+    wire->u.stats.received = received;
+    if (histogram && received > 0) {
+        for (int i = 0; i < 4; i++) {
+            wire->u.stats.quantile_ns[i] =
+                (int64_t)(histogram_quantile(histogram, received, g_quantiles[i], min, max) * NSEC_PER_MSEC);
+        }
+    }
+}
+
+/**
+ * Set stdout up for the chosen format, before anything is written to it
+ * Machine formats are block buffered; the binary format starts with its
+ * header, so the output can be mapped and walked record by record.
+ *
+ * @param opts Options structure
+ */
+void format_begin(t_options *opts)
+{
+    t_wire_header header;
+
+    if (opts->format == FORMAT_TEXT) {
+        return;
+    }
+    setvbuf(stdout, g_output_buffer, _IOFBF, sizeof(g_output_buffer));
+
+    if (opts->format == FORMAT_BINARY) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, WIRE_MAGIC, sizeof(WIRE_MAGIC));
+        header.byte_order = WIRE_BYTE_ORDER;
+        header.version = WIRE_VERSION;
+        header.record_size = sizeof(t_wire_record);
+        header.start_ns = realtime_ns();
+        fwrite(&header, sizeof(header), 1, stdout);
+    }
+}
+
+/**
+ * Write one record taken from an output ring in a machine format
+ *
+ * @param out Output state
+ * @param rec Record to write
+ */
+void format_record(t_output *out, t_record *rec)
+{
+    t_wire_record wire;
+    int64_t time_ns;
+    char from[INET6_ADDRSTRLEN];
+
+    time_ns = rec->time_ns + out->wall_offset_ns;
+    if (out->opts->format == FORMAT_JSON) {
+        if (rec->type == RECORD_HEADER || rec->type == RECORD_TRACE) {
+            printf("{\"type\":\"target\",");
+            json_target(out->opts, rec->target, rec->name);
+            printf(",\"family\":%d", rec->target->addr.sa.sa_family == AF_INET6 ? 6 : 4);
+            if (rec->type == RECORD_TRACE) {
+                printf(",\"max_hops\":%d", rec->ttl);
+            }
+            printf("}\n");
+        } else if (rec->type == RECORD_REPLY) {
+            printf("{\"type\":\"reply\",");
+            json_target(out->opts, rec->target, rec->name);
+            printf(",\"seq\":%d,\"bytes\":%d", rec->seq, rec->bytes);
+            if (rec->ttl > 0) {
+                printf(",\"ttl\":%d", rec->ttl);
+            }
+            if (rec->status != REPLY_OK) {
+                printf(",\"status\":\"%s\"", reply_kind_name(rec->status));
+            }
+            printf(",\"rtt_ms\":%.3f,\"time_ns\":%lld}\n", rec->rtt, (long long)time_ns);
+        } else if (rec->type == RECORD_HOP) {
+            printf("{\"type\":\"hop\",");
+            json_target(out->opts, rec->target, rec->name);
+            printf(",\"hop\":%d,\"status\":\"%s\"", rec->ttl, hop_status_name(rec->status));
+            if (rec->status != HOP_TIMEOUT && rec->status != HOP_PENDING) {
+                printf(",\"from\":\"%s\",\"rtt_ms\":%.3f",
+                       sockaddr_str(&rec->from, from, sizeof(from)), rec->rtt);
+            }
+            if (rec->status == HOP_ERROR) {
+                printf(",\"icmp_type\":%d,\"icmp_code\":%d", rec->icmp_type, rec->icmp_code);
+            }
+            printf(",\"time_ns\":%lld}\n", (long long)time_ns);
+        } else if (rec->type == RECORD_PMTU) {
+            printf("{\"type\":\"pmtu\",");
+            json_target(out->opts, rec->target, rec->name);
+            printf(",\"status\":\"%s\"", pmtu_status_name(rec->status));
+            if (rec->status != PMTU_NONE) {
+                printf(",\"mtu\":%u,\"bytes\":%d", rec->mtu, rec->bytes);
+            }
+            printf(",\"rounds\":%d,\"time_ns\":%lld}\n", rec->seq, (long long)time_ns);
+        } else if (rec->type == RECORD_TIMEOUT) {
+            printf("{\"type\":\"timeout\",");
+            json_target(out->opts, rec->target, rec->name);
+            printf(",\"seq\":%d,\"time_ns\":%lld}\n", rec->seq, (long long)time_ns);
+        } else if (rec->type == RECORD_ERROR) {
+            printf("{\"type\":\"error\",");
+            json_target(out->opts, rec->target, rec->name);
+            printf(",\"seq\":%d,\"error\":\"%s\",\"icmp_type\":%d,\"icmp_code\":%d,\"from\":\"%s\"",
+                   rec->seq, icmp_error_name(rec->error), rec->icmp_type, rec->icmp_code,
+                   sockaddr_str(&rec->from, from, sizeof(from)));
+            if (rec->mtu) {
+                printf(",\"mtu\":%u", rec->mtu);
+            }
+            printf(",\"bytes\":%d,\"rtt_ms\":%.3f,\"time_ns\":%lld}\n",
+                   rec->bytes, rec->rtt, (long long)time_ns);
+        }
+        return;
+    }
+
+    memset(&wire, 0, sizeof(wire));
+    if (rec->type == RECORD_HEADER || rec->type == RECORD_TRACE) {
+        wire_target(out->opts, &wire, WIRE_TARGET, rec->target);
+        strncpy(wire.u.name, rec->name, WIRE_NAME_MAX - 1);
+    } else if (rec->type == RECORD_REPLY || rec->type == RECORD_TIMEOUT) {
+        wire_target(out->opts, &wire, rec->type == RECORD_REPLY ? WIRE_REPLY : WIRE_TIMEOUT, rec->target);
+        wire.u.probe.seq = rec->seq;
+        wire.u.probe.bytes = rec->bytes;
+        wire.u.probe.time_ns = time_ns;
+        wire.u.probe.rtt_ns = (int64_t)(rec->rtt * NSEC_PER_MSEC);
+        wire.u.probe.ttl = rec->ttl;
+        wire.u.probe.status = rec->status;
+    } else if (rec->type == RECORD_ERROR) {
+        wire_target(out->opts, &wire, WIRE_ERROR, rec->target);
+        wire.u.probe.seq = rec->seq;
+        wire.u.probe.bytes = rec->bytes;
+        wire.u.probe.time_ns = time_ns;
+        wire.u.probe.rtt_ns = (int64_t)(rec->rtt * NSEC_PER_MSEC);
+        wire.u.probe.error = rec->error;
+        wire.u.probe.icmp_type = rec->icmp_type;
+        wire.u.probe.icmp_code = rec->icmp_code;
+        wire.u.probe.mtu = rec->mtu;
+        wire_from(&wire, &rec->from);
+    } else if (rec->type == RECORD_PMTU) {
+        wire_target(out->opts, &wire, WIRE_PMTU, rec->target);
+        wire.u.probe.seq = rec->seq;
+        wire.u.probe.bytes = rec->bytes;
+        wire.u.probe.mtu = rec->mtu;
+        wire.u.probe.status = rec->status;
+        wire.u.probe.time_ns = time_ns;
+    } else if (rec->type == RECORD_HOP) {
+        wire_target(out->opts, &wire, WIRE_HOP, rec->target);
+        wire.u.probe.time_ns = time_ns;
+        wire.u.probe.ttl = rec->ttl;
+        wire.u.probe.status = rec->status;
+        if (rec->status != HOP_TIMEOUT && rec->status != HOP_PENDING) {
+            wire.u.probe.rtt_ns = (int64_t)(rec->rtt * NSEC_PER_MSEC);
+            wire.u.probe.icmp_type = rec->icmp_type;
+            wire.u.probe.icmp_code = rec->icmp_code;
+            wire_from(&wire, &rec->from);
+        }
+    } else {
+        return;
+    }
+    fwrite(&wire, sizeof(wire), 1, stdout);
+}
+
+/**
+ * Write the final statistics of one target in a machine format
+ *
+ * @param opts Options structure
+ * @param stats Statistics of the target
+ */
+void format_stats(t_options *opts, t_ping_stats *stats)
+{
+    t_wire_record wire;
+    double avg;
+
+    avg = stats->packets_received > 0 ? stats->total_time / stats->packets_received : 0.0;
+    if (opts->format == FORMAT_JSON) {
+        printf("{\"type\":\"stats\",");
+        json_target(opts, stats->target, stats->hostname);
+        json_counts(stats->packets_sent, stats->packets_received, stats->histogram, stats->min_time, stats->max_time);
+        json_errors(stats->errors);
+        json_replies(stats->replies);
+        if (stats->packets_received > 0) {
+            printf(",\"min_ms\":%.3f,\"avg_ms\":%.3f,\"max_ms\":%.3f,\"mdev_ms\":%.3f",
+                   stats->min_time, avg, stats->max_time, stats_mdev(stats));
+        }
+        printf("}\n");
+        return;
+    }
+
+    memset(&wire, 0, sizeof(wire));
+    wire_target(opts, &wire, WIRE_STATS, stats->target);
+    wire_counts(&wire, stats->packets_sent, stats->packets_received, stats->histogram,
+                stats->min_time, stats->max_time);
+    for (int i = 0; i < ICMP_ERR_KINDS; i++) {
+        wire.u.stats.errors[i] = stats->errors[i];
+    }
+    for (int i = 0; i < REPLY_KINDS; i++) {
+        wire.u.stats.replies[i] = stats->replies[i];
+    }
+    if (stats->packets_received > 0) {
+        wire.u.stats.min_ns = (int64_t)(stats->min_time * NSEC_PER_MSEC);
+        wire.u.stats.avg_ns = (int64_t)(avg * NSEC_PER_MSEC);
+        wire.u.stats.max_ns = (int64_t)(stats->max_time * NSEC_PER_MSEC);
+        wire.u.stats.mdev_ns = (int64_t)(stats_mdev(stats) * NSEC_PER_MSEC);
+    }
+    fwrite(&wire, sizeof(wire), 1, stdout);
+}
+
+/**
+ * Write the totals over every target in a machine format, then flush
+ *
+ * @param opts Options structure
+ * @param stats Per-target statistics
+ * @param count Number of targets
+ * @param elapsed_ns Duration of the run
+ */
+void format_summary(t_options *opts, t_ping_stats *stats, int count, int64_t elapsed_ns)
+{
+    uint32_t histogram[HIST_BUCKETS];
+    t_ping_stats total;
+    t_wire_record wire;
+    int alive;
+
+    alive = merge_stats(&total, histogram, stats, count);
+    if (opts->format == FORMAT_JSON) {
+        printf("{\"type\":\"summary\",\"targets\":%d,\"alive\":%d", count, alive);
+        json_counts(total.packets_sent, total.packets_received, histogram, total.min_time, total.max_time);
+        json_errors(total.errors);
+        json_replies(total.replies);
+        printf(",\"elapsed_ms\":%.3f,\"pps\":%.1f}\n",
+               (double)elapsed_ns / NSEC_PER_MSEC,
+               elapsed_ns > 0 ? total.packets_sent * (double)NSEC_PER_SEC / elapsed_ns : 0.0);
+    } else {
+        memset(&wire, 0, sizeof(wire));
+        wire.type = WIRE_SUMMARY;
+        wire.target = WIRE_NO_TARGET;
+        wire_counts(&wire, total.packets_sent, total.packets_received, histogram, total.min_time, total.max_time);
+        for (int i = 0; i < ICMP_ERR_KINDS; i++) {
+            wire.u.stats.errors[i] = total.errors[i];
+        }
+        for (int i = 0; i < REPLY_KINDS; i++) {
+            wire.u.stats.replies[i] = total.replies[i];
+        }
+        fwrite(&wire, sizeof(wire), 1, stdout);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,231 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Initialize the table of outstanding probes
+ *
+ * @param table Table to initialize
+ * @param slots Zeroed storage for the table, owned by the caller
+ * @param size Number of slots (must be a power of two, at most INFLIGHT_WINDOW)
+ */
+void inflight_init(t_inflight *table, t_probe *slots, int size)
+{
+    memset(table, 0, sizeof(t_inflight));
+    table->slots = slots;
+    table->size = size;
+}
+
+/**
+ * Compute the window needed to keep every unexpired probe of a target
+ *
+ * @param interval_ns Time between two probes to the same target
+ * @param timeout_ns Time after which a probe is expired
+ * @return Number of slots (power of two, at most INFLIGHT_WINDOW)
+ */
+int inflight_window(int64_t interval_ns, int64_t timeout_ns)
+{
+    int64_t needed;
+    int size;
+
+    /* One slot per probe sent during a timeout, plus the one being sent */
+    needed = (interval_ns > 0 ? timeout_ns / interval_ns : INFLIGHT_WINDOW) + 2;
+
+    size = 1;
+    while (size < needed && size < INFLIGHT_WINDOW) {
+        size <<= 1;
+    }
+
+    return size;
+}
+
+/**
+ * Register a new probe under the next sequence number
+ * If the window is full, the oldest probe is overwritten; it is copied out
+ * first so the caller can count it as expired.
+ *
+ * @param table Table of outstanding probes
+ * @param now_ns Send time of the probe (monotonic)
+ * @param evicted Copy of the probe overwritten, outstanding only if it was still waiting (output)
+ * @return Slot describing the new probe
+ */
+t_probe *inflight_add(t_inflight *table, int64_t now_ns, t_probe *evicted)
+{
+    t_probe *probe;
+
+    probe = &table->slots[table->next & (table->size - 1)];
+    *evicted = *probe;
+    if (probe->outstanding) {
+        table->count--;
+    }
+
+    probe->seq = table->next++;
+    probe->send_ns = now_ns;
+    probe->tx_sw_ns = 0;
+    probe->tx_hw_ns = 0;
+    probe->outstanding = true;
+    probe->answered = false;
+    table->count++;
+
+    return probe;
+}
+
+/**
+ * Match a reply to its outstanding probe and retire it
+ *
+ * @param table Table of outstanding probes
+ * @param seq Sequence number carried by the reply (16 bits on the wire)
+ * @param out Copy of the matched probe (output)
+ * @return 0 if the probe was outstanding, -1 for unknown, expired or duplicate replies
+ */
+int inflight_match(t_inflight *table, uint16_t seq, t_probe *out)
+{
+    t_probe *probe;
+
+    probe = &table->slots[seq & (table->size - 1)];
+    if (!probe->outstanding || (uint16_t)probe->seq != seq) {
+        return -1;
+    }
+
+    *out = *probe;
+    probe->outstanding = false;
+    table->count--;
+
+    return 0;
+}
+
+/**
+ * Match an echo reply to its probe, telling late and duplicate replies apart
+ * A slot remembers that its probe was answered until the sequence number
+ * wraps around the window onto it, so a second copy of a reply is known as
+ * such; a reply whose slot moved on is only known to be late.
+ *
+ * @param table Table of outstanding probes
+ * @param seq Sequence number carried by the reply (16 bits on the wire)
+ * @param out Copy of the probe, or only its sequence number if the slot moved on (output)
+ * @return REPLY_OK if the probe was outstanding, REPLY_LATE or REPLY_DUPLICATE otherwise
+ */
+int inflight_reply(t_inflight *table, uint16_t seq, t_probe *out)
+{
+    t_probe *probe;
+
+    probe = &table->slots[seq & (table->size - 1)];
+    if ((uint16_t)probe->seq != seq) {
+        memset(out, 0, sizeof(t_probe));
+        out->seq = seq;
+        return REPLY_LATE;
+    }
+
+    *out = *probe;
+    if (probe->outstanding) {
+        probe->outstanding = false;
+        probe->answered = true;
+        table->count--;
+        return REPLY_OK;
+    }
+    if (probe->answered) {
+        return REPLY_DUPLICATE;
+    }
+    probe->answered = true;
+
+    return REPLY_LATE;
+}
+
+/**
+ * Check whether a probe is still waiting for its reply
+ *
+ * @param table Table of outstanding probes
+ * @param seq Full sequence number of the probe
+ * @return true if the probe is outstanding
+ */
+bool inflight_pending(t_inflight *table, int seq)
+{
+    t_probe *probe;
+
+    probe = &table->slots[seq & (table->size - 1)];
+    return probe->outstanding && probe->seq == seq;
+}
+
+/**
+ * Allocate the queue of probes ordered by send time
+ *
+ * @param queue Queue to initialize
+ * @param size Maximum number of queued probes
+ * @return 0 on success, -1 on error
+ */
+int expiry_init(t_expiry_queue *queue, int size)
+{
+    memset(queue, 0, sizeof(t_expiry_queue));
+
+    queue->entries = malloc(size * sizeof(t_expiry));
+    if (!queue->entries) {
+        return -1;
+    }
+    queue->size = size;
+
+    return 0;
+}
+
+/**
+ * Release the queue of probes ordered by send time
+ *
+ * @param queue Queue to release
+ */
+void expiry_free(t_expiry_queue *queue)
+{
+    free(queue->entries);
+    queue->entries = NULL;
+    queue->size = 0;
+    queue->count = 0;
+}
+
+/**
+ * Queue a probe for expiry
+ * Probes are pushed in send order, so with a common timeout the head is
+ * always the next probe to expire. When the queue is full the head is
+ * dropped; its probe is then only retired when its slot is reused.
+ *
+ * @param queue Expiry queue
+ * @param target Position of the probed target
+ * @param probe Probe that was just sent
+ */
+void expiry_push(t_expiry_queue *queue, int target, t_probe *probe)
+{
+    t_expiry *entry;
+
+    if (queue->count == queue->size) {
+        expiry_pop(queue);
+    }
+
+    entry = &queue->entries[(queue->head + queue->count) % queue->size];
+    entry->send_ns = probe->send_ns;
+    entry->target = target;
+    entry->seq = probe->seq;
+    queue->count++;
+}
+
+/**
+ * Get the oldest queued probe
+ *
+ * @param queue Expiry queue
+ * @return Oldest entry or NULL if the queue is empty
+ */
+t_expiry *expiry_peek(t_expiry_queue *queue)
+{
+    if (queue->count == 0) {
+        return NULL;
+    }
+    return &queue->entries[queue->head];
+}
+
+/**
+ * Remove the oldest queued probe
+ *
+ * @param queue Expiry queue
+ */
+void expiry_pop(t_expiry_queue *queue)
+{
+    if (queue->count == 0) {
+        return;
+    }
+    queue->head = (queue->head + 1) % queue->size;
+    queue->count--;
+}
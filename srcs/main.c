@@ -1,8 +1,6 @@
 #include "../includes/ft_ping.h"
 
 /* Global variables */
-volatile int g_ping_count = 0;
-volatile int g_ping_received = 0;
 volatile bool g_running = true;
 
 /**
@@ -10,9 +8,27 @@ volatile bool g_running = true;
  */
 void print_usage(void)
 {
-    printf("Usage: ft_ping [options] <destination>\n");
+    printf("Usage: ft_ping [options] <destination> [destination...]\n");
     printf("\nOptions:\n");
+    printf("  -4                 use IPv4 only\n");
+    printf("  -6                 use IPv6 only\n");
     printf("  -v                 verbose output\n");
+    printf("  -F <file>          read destinations from file, one per line (- for stdin)\n");
+    printf("  -K                 measure rtt with kernel (and hardware) timestamps\n");
+    printf("  -i <interval>      seconds between probes to each destination (sub-ms allowed)\n");
+    printf("  -s <size>          bytes of data per probe (default %d, %d-%d)\n",
+           PACKET_SIZE - ICMP_HEADER_SIZE, PAYLOAD_MIN, PACKET_MAX - ICMP_HEADER_SIZE);
+    printf("  -f                 flood: send as fast as outstanding replies allow\n");
+    printf("  -A                 adaptive: raise the rate until loss or rtt inflation\n");
+    printf("  -H                 show names of numeric destinations (reverse dns)\n");
+    printf("  -t <hops>          trace the path: send ttl 1 to hops at once, print each router\n");
+    printf("  -P                 find the path mtu, probing sizes up to -s (default mtu %d)\n", PMTU_MAX);
+    printf("  -m <mode>          path mtu discovery: do (set df), want, dont or probe (df, ignore known mtu)\n");
+    printf("  -T <threads>       split destinations over threads, each with its own socket\n");
+    printf("  -o <format>        output format: text, json (one object per line) or binary\n");
+    printf("  -w <file>          record every probe to a circular capture file\n");
+    printf("  -W <samples>       samples kept per thread in the capture file (default %d)\n", CAPTURE_SAMPLES);
+    printf("  -M <port|path>     serve prometheus metrics on a localhost port or unix socket\n");
     printf("  -?                 print help and exit\n");
     printf("\nArguments:\n");
     printf("  destination        dns name or ip address\n");
@@ -29,10 +45,19 @@ void print_usage(void)
 void parse_args(int argc, char **argv, t_options *opts)
 {
     int opt;
+    double interval;
+    long shards, samples, hops, size;
+    char *end;
 //    int option_index = 0;
 
     /* Set default values */
     memset(opts, 0, sizeof(t_options));
+    opts->interval_ns = DEFAULT_INTERVAL * NSEC_PER_SEC;
+    opts->family = AF_UNSPEC;
+    opts->shards = 1;
+    opts->capture_samples = CAPTURE_SAMPLES;
+    opts->packet_size = PACKET_SIZE;
+    opts->pmtu_discover = PMTU_DEFAULT;
 
     /* Check for explicit help option before regular parsing */
     for (int i = 1; i < argc; i++) {
@@ -43,26 +68,187 @@ void parse_args(int argc, char **argv, t_options *opts)
     }
 
     /* Parse options */
-    while ((opt = getopt(argc, argv, "v")) != -1) {
+    while ((opt = getopt(argc, argv, "46vF:Ki:s:fAHt:Pm:T:o:w:W:M:")) != -1) {
         switch (opt) {
+            case '4':
+                opts->family = AF_INET;
+                break;
+            case '6':
+                opts->family = AF_INET6;
+                break;
             case 'v':
                 opts->verbose = true;
                 break;
+            case 'F':
+                opts->target_file = optarg;
+                break;
+            case 'K':
+                opts->kernel_timestamps = true;
+                break;
+            case 'i':
+                interval = strtod(optarg, &end);
+                if (*end != '\0' || !(interval > 0) || interval > 3600) {
+                    fprintf(stderr, "ft_ping: invalid interval: '%s'\n", optarg);
+                    exit(1);
+                }
+                opts->interval_ns = (int64_t)(interval * NSEC_PER_SEC);
+                opts->interval_set = true;
+                break;
+            case 's':
+                size = strtol(optarg, &end, 10);
+                if (*end != '\0' || size < PAYLOAD_MIN || size > PACKET_MAX - ICMP_HEADER_SIZE) {
+                    fprintf(stderr, "ft_ping: invalid packet size: '%s' (%d-%d)\n",
+                            optarg, PAYLOAD_MIN, PACKET_MAX - ICMP_HEADER_SIZE);
+                    exit(1);
+                }
+                opts->packet_size = ICMP_HEADER_SIZE + (int)size;
+                opts->size_set = true;
+                break;
+            case 'f':
+                opts->flood = true;
+                break;
+            case 'A':
+                opts->adaptive = true;
+                break;
+            case 'H':
+                opts->reverse_dns = true;
+                break;
+            case 't':
+                hops = strtol(optarg, &end, 10);
+                if (*end != '\0' || hops < 1 || hops > TRACE_HOPS_MAX) {
+                    fprintf(stderr, "ft_ping: invalid hop count: '%s' (1-%d)\n", optarg, TRACE_HOPS_MAX);
+                    exit(1);
+                }
+                opts->trace_hops = (int)hops;
+                break;
+            case 'P':
+                opts->pmtu_search = true;
+                break;
+            case 'm':
+                if (strcmp(optarg, "do") == 0) {
+                    opts->pmtu_discover = IP_PMTUDISC_DO;
+                } else if (strcmp(optarg, "want") == 0) {
+                    opts->pmtu_discover = IP_PMTUDISC_WANT;
+                } else if (strcmp(optarg, "dont") == 0) {
+                    opts->pmtu_discover = IP_PMTUDISC_DONT;
+                } else if (strcmp(optarg, "probe") == 0) {
+                    opts->pmtu_discover = IP_PMTUDISC_PROBE;
+                } else {
+                    fprintf(stderr, "ft_ping: invalid mtu discovery mode: '%s' (do, want, dont or probe)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'T':
+                shards = strtol(optarg, &end, 10);
+                if (*end != '\0' || shards < 1 || shards > SHARD_MAX) {
+                    fprintf(stderr, "ft_ping: invalid thread count: '%s' (1-%d)\n", optarg, SHARD_MAX);
+                    exit(1);
+                }
+                opts->shards = (int)shards;
+                break;
+            case 'o':
+                if (strcmp(optarg, "text") == 0) {
+                    opts->format = FORMAT_TEXT;
+                } else if (strcmp(optarg, "json") == 0) {
+                    opts->format = FORMAT_JSON;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    opts->format = FORMAT_BINARY;
+                } else {
+                    fprintf(stderr, "ft_ping: invalid output format: '%s' (text, json or binary)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'w':
+                opts->capture_file = optarg;
+                break;
+            case 'M':
+                opts->metrics_endpoint = optarg;
+                break;
+            case 'W':
+                samples = strtol(optarg, &end, 10);
+                if (*end != '\0' || samples < 1 || samples > CAPTURE_SAMPLES_MAX) {
+                    fprintf(stderr, "ft_ping: invalid sample count: '%s' (1-%d)\n", optarg, CAPTURE_SAMPLES_MAX);
+                    exit(1);
+                }
+                opts->capture_samples = samples;
+                break;
             default:
                 fprintf(stderr, "Try 'ft_ping -?' for more information.\n");
                 exit(1);
         }
     }
 
+    if (opts->flood && opts->adaptive) {
+        fprintf(stderr, "ft_ping: -f and -A are mutually exclusive\n");
+        exit(1);
+    }
+    if (opts->trace_hops && (opts->flood || opts->adaptive)) {
+        fprintf(stderr, "ft_ping: -t sends one sweep per destination, not with -f or -A\n");
+        exit(1);
+    }
+    if (opts->pmtu_search && (opts->trace_hops || opts->flood || opts->adaptive)) {
+        fprintf(stderr, "ft_ping: -P sends its own rounds, not with -t, -f or -A\n");
+        exit(1);
+    }
+    if (opts->pmtu_search && (opts->pmtu_discover == IP_PMTUDISC_DONT || opts->pmtu_discover == IP_PMTUDISC_WANT)) {
+        fprintf(stderr, "ft_ping: -P needs the DF bit, not with -m dont or want\n");
+        exit(1);
+    }
+
+    /* A search sets DF past any MTU already known, up to jumbo frames by default */
+    if (opts->pmtu_search) {
+        if (opts->pmtu_discover == PMTU_DEFAULT) {
+            opts->pmtu_discover = IP_PMTUDISC_PROBE;
+        }
+        if (!opts->size_set) {
+            opts->packet_size = PMTU_MAX - (int)sizeof(struct ip);
+        }
+    }
+    if (opts->format == FORMAT_BINARY && isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "ft_ping: refusing to write binary output to a terminal\n");
+        exit(1);
+    }
+    if (opts->interval_ns < 1) {
+        opts->interval_ns = 1;
+    }
+
     /* Check if target is provided */
-    if (optind >= argc) {
+    if (optind >= argc && !opts->target_file) {
         fprintf(stderr, "ft_ping: missing host operand\n");
         fprintf(stderr, "Try 'ft_ping -?' for more information.\n");
         exit(1);
     }
 
-    /* Get target hostname or IP */
-    opts->target = argv[optind];
+    /* Get target hostnames or IPs */
+    opts->names = &argv[optind];
+    opts->name_count = argc - optind;
+}
+
+/**
+ * Collect every destination given on the command line or in a file
+ * Names are resolved in the background once pinging starts; unknown hosts
+ * are reported and skipped then, and are fatal only if none is left.
+ *
+ * @param opts Options structure
+ * @return 0 on success, or an error code to exit with
+ */
+static int collect_targets(t_options *opts)
+{
+    for (int i = 0; i < opts->name_count; i++) {
+        if (add_target(opts, opts->names[i]) < 0) {
+            fprintf(stderr, "ft_ping: memory allocation failed\n");
+            return 1;
+        }
+    }
+
+    if (opts->target_file && read_target_file(opts, opts->target_file) < 0) {
+        return 1;
+    }
+
+    if (opts->target_count == 0) {
+        return ERR_ADDR;
+    }
+    return 0;
 }
 
 /**
@@ -97,12 +283,6 @@ int main(int argc, char **argv)
     t_options opts;
     int ret;
 
-    /* Check if running as root or with capabilities */
-    if (getuid() != 0) {
-        fprintf(stderr, "ft_ping: Operation not permitted\n");
-        return ERR_PERMISSION;
-    }
-
     /* Initialize options structure */
     memset(&opts, 0, sizeof(t_options));
 
@@ -120,26 +300,17 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    /* Resolve hostname to IP address */
-    if ((ret = resolve_hostname(opts.target, &opts.addr, &opts.ipstr)) != 0) {
-        fprintf(stderr, "ft_ping: unknown host %s\n", opts.target);
-        return ERR_ADDR;
-    }
-
-    /* Store original hostname for display */
-    opts.hostname = strdup(opts.target);
-    if (!opts.hostname) {
-        fprintf(stderr, "ft_ping: memory allocation failed\n");
-        free(opts.ipstr);
-        return 1;
+    /* Gather the destinations; start_ping resolves them */
+    if ((ret = collect_targets(&opts)) != 0) {
+        free_targets(&opts);
+        return ret;
     }
 
     /* Start pinging */
     ret = start_ping(&opts);
 
     /* Clean up */
-    free(opts.hostname);
-    free(opts.ipstr);
+    free_targets(&opts);
 
     return ret;
 }
@@ -0,0 +1,518 @@
+#include "../includes/ft_ping.h"
+
+/* Upper bounds of the exposed RTT buckets, in seconds */
+static const double g_bounds[METRICS_BUCKETS] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+
+/* Exposed bucket of every histogram bucket, filled before any shard runs */
+static uint8_t g_bucket_of[HIST_BUCKETS];
+
+/**
+ * Map every histogram bucket to the first exposed bucket holding it
+ */
+static void map_buckets(void)
+{
+    uint64_t value;
+    int b;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        value = histogram_value(i);
+        b = 0;
+        while (b < METRICS_BUCKETS && value > g_bounds[b] * NSEC_PER_SEC) {
+            b++;
+        }
+        g_bucket_of[i] = b;
+    }
+}
+
+/**
+ * Publish the current state of a shard's targets
+ * Called by the shard itself. The sequence is odd while the snapshot is
+ * rewritten, so the metrics thread retries instead of ever making the
+ * shard wait. Buckets are only refolded for targets that got replies.
+ *
+ * @param m Snapshot of the shard
+ * @param stats Statistics of the shard's targets
+ */
+void metrics_publish(t_metrics_shard *m, t_ping_stats *stats)
+{
+    t_metrics_target *t;
+
+    __atomic_store_n(&m->sequence, m->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (int i = 0; i < m->count; i++) {
+        t = &m->snapshot[i];
+        t->active = m->targets[i].state == TARGET_ACTIVE;
+        t->sent = stats[i].packets_sent;
+        for (int k = 0; k < ICMP_ERR_KINDS; k++) {
+            t->errors[k] = stats[i].errors[k];
+        }
+        for (int k = 0; k < REPLY_KINDS; k++) {
+            t->replies[k] = stats[i].replies[k];
+        }
+        if (t->received != stats[i].packets_received) {
+            t->received = stats[i].packets_received;
+            t->rtt_sum = stats[i].total_time;
+            memset(t->buckets, 0, sizeof(t->buckets));
+            for (int j = 0; j < HIST_BUCKETS; j++) {
+                t->buckets[g_bucket_of[j]] += stats[i].histogram[j];
+            }
+        }
+    }
+    __atomic_store_n(&m->sequence, m->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy the snapshot of a shard, retrying while the shard rewrites it
+ *
+ * @param m Snapshot of the shard
+ * @param out Copy (output, m->count entries)
+ */
+static void copy_snapshot(t_metrics_shard *m, t_metrics_target *out)
+{
+    uint32_t before, after;
+
+    for (;;) {
+        before = __atomic_load_n(&m->sequence, __ATOMIC_ACQUIRE);
+        if (!(before & 1)) {
+            memcpy(out, m->snapshot, m->count * sizeof(t_metrics_target));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            after = __atomic_load_n(&m->sequence, __ATOMIC_RELAXED);
+            if (after == before) {
+                return;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/**
+ * Write a label value, escaped as the exposition format requires
+ *
+ * @param out Stream
+ * @param value Label value
+ */
+static void write_label(FILE *out, const char *value)
+{
+    for (; *value; value++) {
+        if (*value == '\\' || *value == '"') {
+            fprintf(out, "\\%c", *value);
+        } else if (*value == '\n') {
+            fputs("\\n", out);
+        } else {
+            fputc(*value, out);
+        }
+    }
+}
+
+/**
+ * Write the labels naming a target
+ *
+ * @param out Stream
+ * @param t Target
+ */
+static void write_target(FILE *out, t_target *t)
+{
+    fputs("target=\"", out);
+    write_label(out, t->hostname);
+    fputs("\",addr=\"", out);
+    write_label(out, t->ipstr);
+    fputc('"', out);
+}
+
+/**
+ * Write every metric in the Prometheus text exposition format
+ * Only targets being probed are listed; their address no longer changes.
+ *
+ * @param m Metrics state
+ * @param out Stream
+ */
+static void write_metrics(t_metrics *m, FILE *out)
+{
+    t_metrics_target *snap;
+    t_target *t;
+    uint64_t cumulative;
+    int first;
+
+    first = 0;
+    for (int s = 0; s < m->count; s++) {
+        copy_snapshot(&m->shards[s], &m->scratch[first]);
+        first += m->shards[s].count;
+    }
+
+    fprintf(out, "# HELP ft_ping_probes_sent_total Echo requests sent.\n");
+    fprintf(out, "# TYPE ft_ping_probes_sent_total counter\n");
+    for (int s = 0, i = 0; s < m->count; s++) {
+        for (int j = 0; j < m->shards[s].count; j++, i++) {
+            if (m->scratch[i].active) {
+                fprintf(out, "ft_ping_probes_sent_total{");
+                write_target(out, &m->shards[s].targets[j]);
+                fprintf(out, "} %ld\n", m->scratch[i].sent);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP ft_ping_replies_received_total Echo replies matched to a probe.\n");
+    fprintf(out, "# TYPE ft_ping_replies_received_total counter\n");
+    for (int s = 0, i = 0; s < m->count; s++) {
+        for (int j = 0; j < m->shards[s].count; j++, i++) {
+            if (m->scratch[i].active) {
+                fprintf(out, "ft_ping_replies_received_total{");
+                write_target(out, &m->shards[s].targets[j]);
+                fprintf(out, "} %ld\n", m->scratch[i].received);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP ft_ping_icmp_errors_total ICMP errors quoting a probe, by kind.\n");
+    fprintf(out, "# TYPE ft_ping_icmp_errors_total counter\n");
+    for (int s = 0, i = 0; s < m->count; s++) {
+        for (int j = 0; j < m->shards[s].count; j++, i++) {
+            if (!m->scratch[i].active) {
+                continue;
+            }
+            for (int k = 0; k < ICMP_ERR_KINDS; k++) {
+                fprintf(out, "ft_ping_icmp_errors_total{");
+                write_target(out, &m->shards[s].targets[j]);
+                fprintf(out, ",kind=\"%s\"} %ld\n", icmp_error_name(k), m->scratch[i].errors[k]);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP ft_ping_unexpected_replies_total Replies that were late, duplicated, corrupted or from another run.\n");
+    fprintf(out, "# TYPE ft_ping_unexpected_replies_total counter\n");
+    for (int s = 0, i = 0; s < m->count; s++) {
+        for (int j = 0; j < m->shards[s].count; j++, i++) {
+            if (!m->scratch[i].active) {
+                continue;
+            }
+            for (int k = REPLY_LATE; k < REPLY_KINDS; k++) {
+                fprintf(out, "ft_ping_unexpected_replies_total{");
+                write_target(out, &m->shards[s].targets[j]);
+                fprintf(out, ",kind=\"%s\"} %ld\n", reply_kind_name(k), m->scratch[i].replies[k]);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP ft_ping_rtt_seconds Round-trip time of answered probes.\n");
+    fprintf(out, "# TYPE ft_ping_rtt_seconds histogram\n");
+    for (int s = 0, i = 0; s < m->count; s++) {
+        for (int j = 0; j < m->shards[s].count; j++, i++) {
+            snap = &m->scratch[i];
+            t = &m->shards[s].targets[j];
+            if (!snap->active) {
+                continue;
+            }
+            cumulative = 0;
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                cumulative += snap->buckets[b];
+                fprintf(out, "ft_ping_rtt_seconds_bucket{");
+                write_target(out, t);
+                fprintf(out, ",le=\"%g\"} %llu\n", g_bounds[b], (unsigned long long)cumulative);
+            }
+            fprintf(out, "ft_ping_rtt_seconds_bucket{");
+            write_target(out, t);
+            fprintf(out, ",le=\"+Inf\"} %ld\n", snap->received);
+            fprintf(out, "ft_ping_rtt_seconds_sum{");
+            write_target(out, t);
+            fprintf(out, "} %.9f\n", snap->rtt_sum / 1000.0);
+            fprintf(out, "ft_ping_rtt_seconds_count{");
+            write_target(out, t);
+            fprintf(out, "} %ld\n", snap->received);
+        }
+    }
+}
+
+/**
+ * Write a whole buffer to a socket
+ *
+ * @param fd Socket
+ * @param data Bytes to write
+ * @param size Number of bytes
+ * @return 0 on success, -1 on error
+ */
+static int write_all(int fd, const char *data, size_t size)
+{
+    ssize_t n;
+
+    while (size > 0) {
+        n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Answer one scrape: read the request, whatever it is, and send the metrics
+ * Clients that stall are dropped after METRICS_TIMEOUT_MS.
+ *
+ * @param m Metrics state
+ * @param fd Accepted connection
+ */
+static void serve_client(t_metrics *m, int fd)
+{
+    struct timeval timeout;
+    char request[METRICS_REQUEST_MAX + 1];
+    char header[128];
+    size_t used, body_size;
+    char *body;
+    FILE *out;
+    ssize_t n;
+
+    timeout.tv_sec = METRICS_TIMEOUT_MS / 1000;
+    timeout.tv_usec = METRICS_TIMEOUT_MS % 1000 * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* The request ends with an empty line */
+    used = 0;
+    while (used < METRICS_REQUEST_MAX) {
+        n = recv(fd, request + used, METRICS_REQUEST_MAX - used, 0);
+        if (n <= 0) {
+            break;
+        }
+        used += n;
+        request[used] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            break;
+        }
+    }
+
+    out = open_memstream(&body, &body_size);
+    if (!out) {
+        perror("open_memstream");
+        return;
+    }
+    write_metrics(m, out);
+    if (fclose(out) != 0) {
+        perror("open_memstream");
+        return;
+    }
+
+    n = snprintf(header, sizeof(header),
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\n\r\n", body_size);
+    if (write_all(fd, header, n) == 0) {
+        write_all(fd, body, body_size);
+    }
+    free(body);
+}
+
+/**
+ * Metrics thread: accept scrapes until stopped
+ *
+ * @param arg Metrics state
+ * @return NULL
+ */
+static void *metrics_main(void *arg)
+{
+    t_metrics *m = arg;
+    struct pollfd pfd[2];
+    int fd;
+
+    pfd[0].fd = m->listenfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = m->stopfd;
+    pfd[1].events = POLLIN;
+    for (;;) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+        fd = accept4(m->listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        serve_client(m, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/**
+ * Open the listening socket: a port on localhost, or a Unix socket path
+ *
+ * @param m Metrics state (endpoint set)
+ * @return 0 on success, -1 on error
+ */
+static int metrics_listen(t_metrics *m)
+{
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    char *end;
+    long port;
+    int one = 1;
+
+    port = strtol(m->endpoint, &end, 10);
+    m->unix_socket = *m->endpoint == '\0' || *end != '\0';
+    if (!m->unix_socket && (port < 1 || port > 65535)) {
+        fprintf(stderr, "ft_ping: invalid metrics port: '%s'\n", m->endpoint);
+        return -1;
+    }
+    if (m->unix_socket && strlen(m->endpoint) >= sizeof(un.sun_path)) {
+        fprintf(stderr, "ft_ping: metrics socket path too long: '%s'\n", m->endpoint);
+        return -1;
+    }
+
+    m->listenfd = socket(m->unix_socket ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m->listenfd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (m->unix_socket) {
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, m->endpoint);
+        unlink(m->endpoint);
+        if (bind(m->listenfd, (struct sockaddr *)&un, sizeof(un)) < 0) {
+            perror(m->endpoint);
+            close(m->listenfd);
+            return -1;
+        }
+    } else {
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = htons(port);
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        setsockopt(m->listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(m->listenfd, (struct sockaddr *)&in, sizeof(in)) < 0) {
+            perror("bind metrics port");
+            close(m->listenfd);
+            return -1;
+        }
+    }
+    if (listen(m->listenfd, METRICS_BACKLOG) < 0) {
+        perror("listen");
+        close(m->listenfd);
+        if (m->unix_socket) {
+            unlink(m->endpoint);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Release the snapshots and the listening socket
+ *
+ * @param m Metrics state
+ */
+static void metrics_free(t_metrics *m)
+{
+    for (int s = 0; s < m->count; s++) {
+        free(m->shards[s].snapshot);
+    }
+    free(m->shards);
+    free(m->scratch);
+    close(m->listenfd);
+    if (m->unix_socket) {
+        unlink(m->endpoint);
+    }
+}
+
+/**
+ * Start serving metrics and give every shard a snapshot to publish to
+ *
+ * @param m Metrics state (output)
+ * @param opts Options structure
+ * @param shards Pinger state of every shard (target slices set)
+ * @param count Number of shards
+ * @return 0 on success, -1 on error
+ */
+int metrics_start(t_metrics *m, t_options *opts, t_pinger *shards, int count)
+{
+    sigset_t all, saved;
+    bool ok;
+    int ret;
+
+    memset(m, 0, sizeof(t_metrics));
+    m->endpoint = opts->metrics_endpoint;
+    if (metrics_listen(m) < 0) {
+        return -1;
+    }
+    map_buckets();
+
+    m->count = count;
+    m->shards = aligned_alloc(CACHE_LINE, count * sizeof(t_metrics_shard));
+    if (!m->shards) {
+        perror("malloc");
+        m->count = 0;
+        metrics_free(m);
+        return -1;
+    }
+    memset(m->shards, 0, count * sizeof(t_metrics_shard));
+    m->scratch = calloc(opts->target_count ? opts->target_count : 1, sizeof(t_metrics_target));
+    ok = m->scratch != NULL;
+    for (int s = 0; s < count; s++) {
+        m->shards[s].count = shards[s].count;
+        m->shards[s].targets = shards[s].targets;
+        m->shards[s].snapshot = calloc(shards[s].count ? shards[s].count : 1, sizeof(t_metrics_target));
+        ok = ok && m->shards[s].snapshot;
+    }
+    if (!ok) {
+        perror("malloc");
+        metrics_free(m);
+        return -1;
+    }
+
+    m->stopfd = eventfd(0, EFD_CLOEXEC);
+    if (m->stopfd < 0) {
+        perror("eventfd");
+        metrics_free(m);
+        return -1;
+    }
+
+    /* Signals keep reaching the probers */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    ret = pthread_create(&m->thread, NULL, metrics_main, m);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "ft_ping: cannot start metrics thread\n");
+        close(m->stopfd);
+        metrics_free(m);
+        return -1;
+    }
+
+    for (int s = 0; s < count; s++) {
+        shards[s].metrics = &m->shards[s];
+    }
+
+    return 0;
+}
+
+/**
+ * Stop serving metrics; every shard must be done publishing
+ *
+ * @param m Metrics state
+ */
+void metrics_stop(t_metrics *m)
+{
+    uint64_t one = 1;
+
+    if (write(m->stopfd, &one, sizeof(one)) < 0) {
+        perror("write eventfd");
+    }
+    pthread_join(m->thread, NULL);
+    close(m->stopfd);
+    metrics_free(m);
+}
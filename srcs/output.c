@@ -0,0 +1,261 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Append a record to a ring (producer side)
+ * Only the producer writes head and only the consumer writes tail, so
+ * acquire/release ordering on those two indexes is all the ring needs.
+ *
+ * @param ring Ring owned by the calling shard
+ * @param rec Record to copy in
+ * @return true if the record was queued, false if the ring was full
+ */
+static bool ring_push(t_ring *ring, const t_record *rec)
+{
+    uint32_t head;
+
+    head = ring->head;
+    if (head - ring->tail_cache == OUTPUT_RING_SIZE) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->tail_cache == OUTPUT_RING_SIZE) {
+            return false;
+        }
+    }
+
+    ring->slots[head & (OUTPUT_RING_SIZE - 1)] = *rec;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Take the oldest record of a ring (consumer side)
+ *
+ * @param ring Ring to read
+ * @param rec Record (output)
+ * @return true if a record was taken, false if the ring was empty
+ */
+static bool ring_pop(t_ring *ring, t_record *rec)
+{
+    uint32_t tail;
+
+    tail = ring->tail;
+    if (tail == ring->head_cache) {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == ring->head_cache) {
+            return false;
+        }
+    }
+
+    *rec = ring->slots[tail & (OUTPUT_RING_SIZE - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Write every queued record of every ring
+ *
+ * @param out Output state
+ * @return Number of records written
+ */
+static long output_drain(t_output *out)
+{
+    t_record rec;
+    long written = 0;
+
+    for (int i = 0; i < out->count; i++) {
+        while (ring_pop(&out->rings[i], &rec)) {
+            if (out->opts->format == FORMAT_TEXT) {
+                print_record(&rec);
+            } else {
+                format_record(out, &rec);
+            }
+            written++;
+        }
+    }
+
+    return written;
+}
+
+/**
+ * Check whether any ring holds records
+ *
+ * @param out Output state
+ * @return true if at least one record is queued
+ */
+static bool output_pending(t_output *out)
+{
+    for (int i = 0; i < out->count; i++) {
+        if (__atomic_load_n(&out->rings[i].head, __ATOMIC_ACQUIRE) != out->rings[i].tail) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Output thread: format and write records until stopped
+ * It sleeps on an eventfd only once every ring is empty. Producers only
+ * write to the eventfd when they see it asleep, so a busy run costs no
+ * syscall per record. Text is flushed after every drain so lines show up
+ * as replies arrive; machine formats fill whole stdio blocks and a partial
+ * block is only written once the thread has been idle for OUTPUT_FLUSH_MS.
+ *
+ * @param arg Output state
+ * @return NULL
+ */
+static void *output_main(void *arg)
+{
+    t_output *out = arg;
+    struct pollfd pfd;
+    uint64_t value;
+    bool unflushed;
+    int ret;
+
+    pfd.fd = out->wakefd;
+    pfd.events = POLLIN;
+    unflushed = false;
+    for (;;) {
+        if (output_drain(out) > 0) {
+            if (out->opts->format == FORMAT_TEXT) {
+                fflush(stdout);
+            } else {
+                unflushed = true;
+            }
+            continue;
+        }
+        if (__atomic_load_n(&out->stopping, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        /* Announce the sleep, then look again so no wakeup is missed */
+        __atomic_store_n(&out->sleeping, true, __ATOMIC_SEQ_CST);
+        if (!output_pending(out) && !__atomic_load_n(&out->stopping, __ATOMIC_SEQ_CST)) {
+            ret = poll(&pfd, 1, unflushed ? OUTPUT_FLUSH_MS : -1);
+            if (ret < 0 && errno != EINTR) {
+                perror("poll");
+            } else if (ret == 0) {
+                fflush(stdout);
+                unflushed = false;
+            }
+            if (read(out->wakefd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                perror("read eventfd");
+            }
+        }
+        __atomic_store_n(&out->sleeping, false, __ATOMIC_SEQ_CST);
+    }
+
+    /* Producers are gone; write whatever they left */
+    output_drain(out);
+    fflush(stdout);
+    return NULL;
+}
+
+/**
+ * Wake the output thread if it is asleep
+ *
+ * @param out Output state
+ */
+static void output_wake(t_output *out)
+{
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&out->sleeping, false, __ATOMIC_SEQ_CST) &&
+        write(out->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("write eventfd");
+    }
+}
+
+/**
+ * Start the output thread with one ring per producer
+ * Signals are blocked in the thread, so they keep reaching the probers.
+ *
+ * @param out Output state (output)
+ * @param opts Options structure
+ * @param count Number of producers (shards)
+ * @return 0 on success, -1 on error
+ */
+int output_start(t_output *out, t_options *opts, int count)
+{
+    sigset_t all, saved;
+    int ret;
+
+    memset(out, 0, sizeof(t_output));
+    out->opts = opts;
+    out->wall_offset_ns = realtime_ns() - monotonic_ns();
+    out->count = count;
+    out->rings = aligned_alloc(CACHE_LINE, count * sizeof(t_ring));
+    if (!out->rings) {
+        perror("malloc");
+        return -1;
+    }
+    memset(out->rings, 0, count * sizeof(t_ring));
+
+    out->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (out->wakefd < 0) {
+        perror("eventfd");
+        free(out->rings);
+        return -1;
+    }
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    ret = pthread_create(&out->thread, NULL, output_main, out);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "ft_ping: cannot start output thread\n");
+        close(out->wakefd);
+        free(out->rings);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Write the remaining records and stop the output thread
+ * Every producer must be done pushing.
+ *
+ * @param out Output state
+ * @return Number of records dropped because a ring was full
+ */
+long output_stop(t_output *out)
+{
+    uint64_t one = 1;
+    long dropped = 0;
+
+    __atomic_store_n(&out->stopping, true, __ATOMIC_SEQ_CST);
+    if (write(out->wakefd, &one, sizeof(one)) < 0) {
+        perror("write eventfd");
+    }
+    pthread_join(out->thread, NULL);
+
+    for (int i = 0; i < out->count; i++) {
+        dropped += out->rings[i].dropped;
+    }
+    close(out->wakefd);
+    free(out->rings);
+
+    return dropped;
+}
+
+/**
+ * Queue a record for the output thread (called by the prober)
+ * A full ring never blocks the prober: the record is dropped and counted.
+ *
+ * @param out Output state
+ * @param ring Ring of the calling shard
+ * @param rec Record to queue
+ */
+void output_push(t_output *out, t_ring *ring, const t_record *rec)
+{
+    if (!ring_push(ring, rec)) {
+        ring->dropped++;
+        return;
+    }
+
+    /* Pairs with the consumer's announce-then-recheck */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&out->sleeping, __ATOMIC_RELAXED)) {
+        output_wake(out);
+    }
+}
@@ -0,0 +1,95 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Initialize the send pacer from the command line options
+ *
+ * @param pacer Pacer to initialize
+ * @param opts Options structure
+ * @param now_ns Current time (monotonic)
+ */
+void pacer_init(t_pacer *pacer, t_options *opts, int64_t now_ns)
+{
+    memset(pacer, 0, sizeof(t_pacer));
+    pacer->adaptive = opts->adaptive;
+    pacer->interval_ns = opts->interval_ns;
+    pacer->window_start = now_ns;
+    pacer->baseline_rtt = -1;
+
+    /* Ramp up from a sensible rate unless one was asked for */
+    if (opts->adaptive && !opts->interval_set) {
+        pacer->interval_ns = ADAPT_START_INTERVAL_NS;
+    }
+}
+
+/**
+ * Account for a reply in the current adaptation window
+ *
+ * @param pacer Send pacer
+ * @param rtt Round-trip time in milliseconds
+ */
+void pacer_reply(t_pacer *pacer, double rtt)
+{
+    pacer->window_received++;
+    pacer->window_rtt_total += rtt;
+}
+
+/**
+ * Account for an expired probe in the current adaptation window
+ *
+ * @param pacer Send pacer
+ */
+void pacer_expire(t_pacer *pacer)
+{
+    pacer->window_lost++;
+}
+
+/**
+ * Adjust the send rate at the end of each adaptation window
+ * While loss and RTT stay under their thresholds the rate doubles every
+ * window; the first time either threshold is crossed the rate is halved,
+ * which lands on the last rate that was fine, and held there for the rest
+ * of the run, whatever later windows show.
+ *
+ * @param pacer Send pacer
+ * @param now_ns Current time (monotonic)
+ * @return true if the interval changed
+ */
+bool pacer_adapt(t_pacer *pacer, int64_t now_ns)
+{
+    int64_t interval;
+    double avg, loss;
+
+    if (!pacer->adaptive || pacer->settled || now_ns - pacer->window_start < ADAPT_WINDOW_NS ||
+        pacer->window_received + pacer->window_lost < ADAPT_MIN_SAMPLES) {
+        return false;
+    }
+
+    avg = pacer->window_received ? pacer->window_rtt_total / pacer->window_received : 0.0;
+    loss = (double)pacer->window_lost / (pacer->window_received + pacer->window_lost);
+    if (pacer->window_received && (pacer->baseline_rtt < 0 || avg < pacer->baseline_rtt)) {
+        pacer->baseline_rtt = avg;
+    }
+
+    interval = pacer->interval_ns;
+    if (loss > ADAPT_MAX_LOSS || avg > pacer->baseline_rtt * ADAPT_MAX_RTT_INFLATION) {
+        /* Threshold crossed: back off once and hold that rate */
+        interval *= 2;
+        pacer->settled = true;
+    } else {
+        interval /= 2;
+        if (interval < ADAPT_MIN_INTERVAL_NS) {
+            interval = ADAPT_MIN_INTERVAL_NS;
+        }
+    }
+
+    pacer->window_start = now_ns;
+    pacer->window_received = 0;
+    pacer->window_lost = 0;
+    pacer->window_rtt_total = 0.0;
+
+    if (interval == pacer->interval_ns) {
+        return false;
+    }
+    pacer->interval_ns = interval;
+    return true;
+}
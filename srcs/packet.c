@@ -1,17 +1,100 @@
 #include "ft_ping.h"
 
+/**
+ * Mix a 64-bit value into a well-spread 64-bit value (splitmix64 finalizer)
+ *
+ * @param x Value to mix
+ * @return Mixed value
+ */
+static uint64_t mix64(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Fill a buffer with the pseudo-random pattern of a seed
+ * Eight bytes per step of a splitmix64 sequence: as fast as a memset in
+ * practice, and any flipped, shifted or truncated byte shows up.
+ *
+ * @param buffer Buffer to fill
+ * @param size Size of the buffer
+ * @param seed Seed of the pattern
+ */
+void fill_pattern(void *buffer, size_t size, uint64_t seed)
+{
+    uint8_t *data;
+    uint64_t state, word;
+
+    data = buffer;
+    state = seed;
+    while (size >= sizeof(word)) {
+        state += 0x9E3779B97F4A7C15ULL;
+        word = mix64(state);
+        memcpy(data, &word, sizeof(word));
+        data += sizeof(word);
+        size -= sizeof(word);
+    }
+    if (size > 0) {
+        state += 0x9E3779B97F4A7C15ULL;
+        word = mix64(state);
+        memcpy(data, &word, size);
+    }
+}
+
+/**
+ * Compute the check word of a payload header
+ *
+ * @param send_ns Send time carried by the payload
+ * @param nonce Nonce carried by the payload
+ * @param seq Sequence number of the echo
+ * @return Check word
+ */
+static uint32_t payload_check(int64_t send_ns, uint32_t nonce, uint16_t seq)
+{
+    uint64_t x;
+
+    x = mix64((uint64_t)send_ns ^ ((uint64_t)nonce << 16 | seq));
+    return (uint32_t)(x ^ (x >> 32));
+}
+
+/**
+ * Add 16-bit words to a checksum whose packet held zeros in their place
+ *
+ * @param check Checksum before the change
+ * @param data Words now in the packet, as stored in the packet
+ * @param size Bytes of words (even)
+ * @return Checksum after the change
+ */
+static uint16_t checksum_add(uint16_t check, const void *data, size_t size)
+{
+    uint32_t sum;
+    uint16_t word;
+
+    sum = (uint16_t)~check;
+    for (size_t i = 0; i < size; i += sizeof(word)) {
+        memcpy(&word, (const uint8_t *)data + i, sizeof(word));
+        sum += word;
+    }
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return ~sum;
+}
+
 /**
  * Initialize an ICMP echo request packet
  *
  * @param packet Buffer to initialize
  * @param size Size of the buffer
  * @param seq Sequence number
+ * @param nonce Seed of the payload pattern
  */
-void init_packet(void *packet, int size, int seq)
+void init_packet(void *packet, int size, int seq, uint32_t nonce)
 {
     struct icmphdr *icmp;
     char *data;
-//    int i;
     size_t data_size;
 
     /* Clear the packet buffer */
@@ -27,9 +110,7 @@ void init_packet(void *packet, int size, int seq)
     /* Calculate data size and fill the data section with a pattern */
     data = (char *)packet + sizeof(struct icmphdr);
     data_size = size - sizeof(struct icmphdr);
-    for (size_t i = 0; i < data_size; i++) {
-        data[i] = 'a' + (i % 26);
-    }
+    fill_pattern(data, data_size, nonce);
 
     /* Calculate and set the checksum */
     icmp->checksum = 0;
@@ -37,129 +118,416 @@ void init_packet(void *packet, int size, int seq)
 }
 
 /**
- * Compute the checksum of an ICMP packet
+ * Build the echo request template shared by every probe of one size
+ * Everything but the sequence number and the payload header is constant,
+ * so the payload pattern, identifier and checksum are computed once here
+ * instead of per send. The payload starts with a t_payload whose send time
+ * and check word are left zero, to be filled in by stamp_packet. Smaller
+ * probes are a prefix of the template.
+ * ICMPv6 echo requests share the ICMP layout; their checksum covers an IPv6
+ * pseudo-header and is always filled in by the kernel (RFC 3542, 3.1).
  *
- * @param addr Buffer to compute checksum for
- * @param count Number of bytes
- * @return Checksum value
+ * @param tpl Template to fill
+ * @param family AF_INET or AF_INET6
+ * @param size Size of the packet, at least an ICMP header and a t_payload
+ * @param ident Echo identifier (host byte order)
+ * @param nonce Nonce of the run, also the seed of the pattern
+ * @return 0 on success, -1 on error
  */
-uint16_t compute_checksum(void *addr, int count)
+int init_template(t_packet_template *tpl, int family, int size, uint16_t ident, uint32_t nonce)
 {
-    uint32_t sum = 0;
-    uint16_t *ptr = addr;
+    struct icmphdr *icmp;
+    t_payload header;
 
-    /* Sum up 16-bit words */
-    while (count > 1) {
-        sum += *ptr++;
-        count -= 2;
+    tpl->packet = malloc(size);
+    if (!tpl->packet) {
+        return -1;
     }
+    init_packet(tpl->packet, size, 0, nonce);
+
+    /* Replace the identifier init_packet derived from getpid() */
+    icmp = (struct icmphdr *)tpl->packet;
+    icmp->un.echo.id = htons(ident);
+    icmp->checksum = 0;
+
+    memset(&header, 0, sizeof(header));
+    header.nonce = nonce;
+    memcpy(icmp + 1, &header, sizeof(header));
 
-    /* Add left-over byte, if any */
-    if (count > 0) {
-        sum += *(uint8_t *)ptr;
+    tpl->size = size;
+    tpl->nonce = nonce;
+    tpl->kernel_checksum = family == AF_INET6;
+    if (tpl->kernel_checksum) {
+        icmp->type = ICMP6_ECHO_REQUEST;
+    } else {
+        icmp->checksum = compute_checksum(tpl->packet, size);
     }
+    tpl->checksum = icmp->checksum;
 
-    /* Fold 32-bit sum to 16 bits */
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    return 0;
+}
+
+/**
+ * Release the packet of a template
+ *
+ * @param tpl Template
+ */
+void free_template(t_packet_template *tpl)
+{
+    free(tpl->packet);
+    tpl->packet = NULL;
+}
+
+/**
+ * Turn a copy of the template into the probe with a given sequence number
+ * Only the sequence field, send time and check word differ from the
+ * template, where they are zero, so the checksum is patched incrementally
+ * (RFC 1624) and the cost does not depend on size. A probe cut shorter
+ * than the template (path MTU search) has its checksum computed in full.
+ *
+ * @param tpl Template the packet was copied from
+ * @param packet Packet buffer holding a copy of the template
+ * @param size Size of the probe, at most the template's
+ * @param seq Sequence number
+ * @param send_ns Send time to carry (monotonic)
+ */
+void stamp_packet(t_packet_template *tpl, void *packet, int size, int seq, int64_t send_ns)
+{
+    struct icmphdr *icmp;
+    t_payload header;
+
+    icmp = (struct icmphdr *)packet;
+    icmp->un.echo.sequence = htons(seq);
+    header.send_ns = send_ns;
+    header.nonce = tpl->nonce;
+    header.check = payload_check(send_ns, tpl->nonce, seq);
+    memcpy(icmp + 1, &header, sizeof(header));
+    if (!tpl->kernel_checksum && size != tpl->size) {
+        icmp->checksum = 0;
+        icmp->checksum = compute_checksum(packet, size);
+    } else if (!tpl->kernel_checksum) {
+        icmp->checksum = checksum_add(tpl->checksum, &header.send_ns, sizeof(header.send_ns));
+        icmp->checksum = checksum_add(icmp->checksum, &header.check, sizeof(header.check));
+        icmp->checksum = checksum_update(icmp->checksum, 0, icmp->un.echo.sequence);
+    }
+}
+
+/**
+ * Check that a reply carries the payload we sent and recover its send time
+ * The header is checked before the nonce, so a damaged nonce counts as
+ * corruption and only an intact header from another run as a mismatch.
+ * Probes may be shorter than the template, so the caller still compares
+ * the size with the probe's.
+ *
+ * @param tpl Template of the endpoint the reply was read on
+ * @param reply Parsed echo reply (send time filled in when intact)
+ * @return REPLY_OK, REPLY_CORRUPTED or REPLY_MISMATCHED
+ */
+int check_payload(t_packet_template *tpl, t_reply *reply)
+{
+    t_payload header;
+    size_t offset;
+
+    reply->send_ns = 0;
+    offset = sizeof(struct icmphdr) + sizeof(header);
+    if (reply->bytes < (int)offset || reply->bytes > tpl->size) {
+        return REPLY_CORRUPTED;
+    }
+    memcpy(&header, reply->payload, sizeof(header));
+    if (header.check != payload_check(header.send_ns, header.nonce, reply->seq)) {
+        return REPLY_CORRUPTED;
+    }
+    if (header.nonce != tpl->nonce) {
+        return REPLY_MISMATCHED;
+    }
+    if (memcmp((char *)reply->payload + sizeof(header), tpl->packet + offset, reply->bytes - offset) != 0) {
+        return REPLY_CORRUPTED;
     }
+    reply->send_ns = header.send_ns;
+
+    return REPLY_OK;
+}
+
+/**
+ * Get the short name of a kind of reply, as used in machine output
+ *
+ * @param kind REPLY_* kind
+ * @return Name
+ */
+const char *reply_kind_name(int kind)
+{
+    static const char *names[REPLY_KINDS] = {
+        "ok", "late", "duplicate", "corrupted", "mismatched",
+    };
+
+    return kind >= 0 && kind < REPLY_KINDS ? names[kind] : "unknown";
+}
+
+/**
+ * Update a checksum after one 16-bit word changed (RFC 1624, eqn. 3)
+ *
+ * @param check Checksum before the change
+ * @param old_word Previous value of the word, as stored in the packet
+ * @param new_word New value of the word, as stored in the packet
+ * @return Checksum after the change
+ */
+uint16_t checksum_update(uint16_t check, uint16_t old_word, uint16_t new_word)
+{
+    uint32_t sum;
+
+    /* HC' = ~(~HC + ~m + m') */
+    sum = (uint16_t)~check + (uint16_t)~old_word + new_word;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
 
     return ~sum;
 }
 
 /**
- * Send an ICMP packet
+ * Classify an ICMP error
  *
- * @param sockfd Socket file descriptor
- * @param addr Target address
- * @param packet Packet to send
- * @param size Size of the packet
- * @return Number of bytes sent or -1 on error
+ * @param family AF_INET or AF_INET6
+ * @param type ICMP or ICMPv6 type
+ * @param code ICMP or ICMPv6 code
+ * @return ICMP_ERR_* kind, or ICMP_ERR_NONE if the message is not an error we decode
  */
-int send_packet(int sockfd, struct sockaddr_in *addr, void *packet, int size)
+int icmp_error_kind(int family, int type, int code)
 {
-    int ret;
+    if (family == AF_INET6) {
+        switch (type) {
+            case ICMP6_DST_UNREACH: return ICMP_ERR_UNREACH;
+            case ICMP6_PACKET_TOO_BIG: return ICMP_ERR_TOO_BIG;
+            case ICMP6_TIME_EXCEEDED: return ICMP_ERR_TIME_EXCEEDED;
+            case ICMP6_PARAM_PROB: return ICMP_ERR_PARAMPROB;
+            default: return ICMP_ERR_NONE;
+        }
+    }
 
-    ret = sendto(sockfd, packet, size, 0,
-                 (struct sockaddr *)addr, sizeof(struct sockaddr_in));
-    if (ret < 0) {
-        perror("sendto");
-        return -1;
+    switch (type) {
+        case ICMP_DEST_UNREACH:
+            return code == ICMP_FRAG_NEEDED ? ICMP_ERR_TOO_BIG : ICMP_ERR_UNREACH;
+        case ICMP_TIME_EXCEEDED: return ICMP_ERR_TIME_EXCEEDED;
+        case ICMP_REDIRECT: return ICMP_ERR_REDIRECT;
+        case ICMP_PARAMETERPROB: return ICMP_ERR_PARAMPROB;
+        default: return ICMP_ERR_NONE;
     }
+}
 
-    return ret;
+/**
+ * Get the short name of a kind of ICMP error, as used in machine output
+ *
+ * @param kind ICMP_ERR_* kind
+ * @return Name
+ */
+const char *icmp_error_name(int kind)
+{
+    static const char *names[ICMP_ERR_KINDS] = {
+        "unreachable", "too_big", "time_exceeded", "redirect", "parameter_problem",
+    };
+
+    return kind >= 0 && kind < ICMP_ERR_KINDS ? names[kind] : "unknown";
 }
 
 /**
- * Receive and validate an ICMP response packet
+ * Decode an ICMP error read on a raw socket
+ * The error quotes the IP header of the request that triggered it and at
+ * least its first 8 bytes (RFC 792), which is our whole echo header: the
+ * quoted destination names the target and the quoted echo its probe.
  *
- * @param sockfd Socket file descriptor
- * @param addr Source address (output)
- * @param buffer Buffer to store received data
- * @param size Size of the buffer
- * @param tv Timeout value
- * @return Number of bytes received or -1 on error
+ * @param icmp ICMP header of the error
+ * @param len Bytes from the ICMP header on
+ * @param family AF_INET or AF_INET6
+ * @param kind ICMP_ERR_* kind of the error
+ * @param ident Echo identifier of our requests (host byte order)
+ * @param reply Parsed error (output)
+ * @return 0 if the error quotes one of our requests, -1 otherwise
  */
-int receive_packet(int sockfd, struct sockaddr_in *addr, void *buffer, int size, struct timeval *tv)
+static int parse_error(struct icmphdr *icmp, int len, int family, int kind, uint16_t ident, t_reply *reply)
 {
-    int ret, addr_len, hlen;
-    fd_set readfds;
+    struct icmphdr *quoted;
+    struct ip6_hdr *ip6;
     struct ip *ip;
-    struct icmphdr *icmp;
-    uint16_t received_id;
+    int hlen;
 
-    /* Set up select for timeout */
-    FD_ZERO(&readfds);
-    FD_SET(sockfd, &readfds);
+    if (family == AF_INET6) {
+        /* Quoted IPv6 header, assumed without extension headers: we add none */
+        if ((size_t)len < sizeof(struct icmp6_hdr) + sizeof(struct ip6_hdr) + sizeof(struct icmphdr)) {
+            return -1;
+        }
+        ip6 = (struct ip6_hdr *)((char *)icmp + sizeof(struct icmp6_hdr));
+        quoted = (struct icmphdr *)(ip6 + 1);
+        if (ip6->ip6_nxt != IPPROTO_ICMPV6 || quoted->type != ICMP6_ECHO_REQUEST) {
+            return -1;
+        }
+        memset(&reply->target, 0, sizeof(reply->target));
+        reply->target.v6.sin6_family = AF_INET6;
+        reply->target.v6.sin6_addr = ip6->ip6_dst;
+        if (kind == ICMP_ERR_TOO_BIG) {
+            reply->mtu = ntohl(((struct icmp6_hdr *)icmp)->icmp6_mtu);
+        }
+    } else {
+        if ((size_t)len < sizeof(struct icmphdr) + sizeof(struct ip)) {
+            return -1;
+        }
+        ip = (struct ip *)((char *)icmp + sizeof(struct icmphdr));
+        hlen = ip->ip_hl << 2;
+        if (ip->ip_p != IPPROTO_ICMP || (size_t)len < sizeof(struct icmphdr) + hlen + sizeof(struct icmphdr)) {
+            return -1;
+        }
+        quoted = (struct icmphdr *)((char *)ip + hlen);
+        if (quoted->type != ICMP_ECHO_REQUEST) {
+            return -1;
+        }
 
-    /* Wait for data with timeout */
-    ret = select(sockfd + 1, &readfds, NULL, NULL, tv);
-    if (ret <= 0) {
-        return -1; /* Timeout or error */
+        /* The error itself is checksummed like any ICMP message */
+        if (compute_checksum(icmp, len) != 0) {
+            return -1;
+        }
+        memset(&reply->target, 0, sizeof(reply->target));
+        reply->target.v4.sin_family = AF_INET;
+        reply->target.v4.sin_addr = ip->ip_dst;
+        if (kind == ICMP_ERR_TOO_BIG) {
+            reply->mtu = ntohs(icmp->un.frag.mtu);
+        }
     }
 
-    /* Receive packet */
-    addr_len = sizeof(struct sockaddr_in);
-    ret = recvfrom(sockfd, buffer, size, 0,
-                   (struct sockaddr *)addr, (socklen_t *)&addr_len);
-    if (ret < 0) {
-        if (errno != EAGAIN && errno != EINTR) {
-            perror("recvfrom");
-        }
+    if (ntohs(quoted->un.echo.id) != ident) {
         return -1;
     }
+    reply->seq = ntohs(quoted->un.echo.sequence);
+    reply->bytes = len;
+    reply->error = kind;
+    reply->icmp_type = icmp->type;
+    reply->icmp_code = icmp->code;
 
-    /* Extract IP and ICMP headers */
-    ip = (struct ip *)buffer;
-    hlen = ip->ip_hl << 2; /* IP header length in bytes */
+    return 0;
+}
+
+/**
+ * Validate a received datagram and extract the echo reply fields
+ * ICMP errors quoting one of our requests are decoded too, with the
+ * error kind set in the reply.
+ *
+ * @param buffer Datagram, starting with the IP header on raw IPv4 sockets
+ * @param len Number of bytes received
+ * @param family AF_INET or AF_INET6
+ * @param kind Kind of socket the datagram was read from
+ * @param ident Echo identifier of our requests (host byte order)
+ * @param reply Parsed reply (output, source address left untouched)
+ * @return 0 if the datagram is a valid reply or error about one of our requests, -1 otherwise
+ */
+int parse_reply(void *buffer, int len, int family, int kind, uint16_t ident, t_reply *reply)
+{
+    int hlen, error;
+    struct ip *ip;
+    struct icmphdr *icmp;
+    uint16_t received_id;
+
+    /* Extract IP and ICMP headers (ping and IPv6 sockets strip the IP header,
+       the caller then reads the TTL from the ancillary data) */
+    hlen = 0;
+    reply->ttl = 0;
+    if (family == AF_INET && kind == SOCKET_RAW) {
+        ip = (struct ip *)buffer;
+        hlen = ip->ip_hl << 2; /* IP header length in bytes */
+        reply->ttl = ip->ip_ttl;
+    }
 
     /* Check if we have a complete ICMP header */
-    if ((size_t)ret < hlen + sizeof(struct icmphdr)) {
+    if ((size_t)len < hlen + sizeof(struct icmphdr)) {
         return -1;
     }
 
     /* Get ICMP header from the received packet */
     icmp = (struct icmphdr *)((char *)buffer + hlen);
+    reply->error = ICMP_ERR_NONE;
+    reply->mtu = 0;
 
-    /* Validate that it's an ICMP echo reply */
-    if (icmp->type != ICMP_ECHO_REPLY) {
-        /* If verbose is enabled, we could print info about other ICMP types here */
-        return -1;
+    /* Validate that it's an ICMP echo reply, or an error raw sockets see */
+    if (icmp->type != (family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHO_REPLY)) {
+        error = icmp_error_kind(family, icmp->type, icmp->code);
+        if (kind != SOCKET_RAW || error == ICMP_ERR_NONE) {
+            return -1;
+        }
+        return parse_error(icmp, len - hlen, family, error, ident, reply);
     }
 
     /* Extract ID (in network byte order) */
     received_id = ntohs(icmp->un.echo.id);
 
     /* Validate that it's a response to our request (check PID) */
-    if (received_id != (getpid() & 0xFFFF)) {
+    if (received_id != ident) {
         return -1;
     }
 
-    /* Verify checksum */
-    if (compute_checksum(icmp, ret - hlen) != 0) {
+    /* Verify checksum (the kernel already verified ICMPv6 pseudo-header checksums) */
+    if (family == AF_INET && compute_checksum(icmp, len - hlen) != 0) {
         /* If checksum is incorrect, packet might be corrupted */
         return -1;
     }
 
-    return ret;
+    /* Hand the fields needed for matching back to the caller */
+    reply->seq = ntohs(icmp->un.echo.sequence);
+    reply->bytes = len - hlen;
+    reply->payload = icmp + 1;
+
+    return 0;
+}
+
+/**
+ * Decode an ICMP error a ping socket queued on its error queue
+ * The kernel already matched the error to the socket through the quoted
+ * identifier; the payload starts at the quoted echo header, the message
+ * name is the quoted destination and the offender is the router.
+ *
+ * @param err Extended error of the message
+ * @param payload Quoted request, from its echo header on
+ * @param len Bytes of payload
+ * @param ident Echo identifier of our requests (host byte order)
+ * @param reply Parsed error (output, target already set by the caller)
+ * @return 0 if the error is about one of our requests, -1 otherwise
+ */
+int parse_queued_error(struct sock_extended_err *err, void *payload, int len, uint16_t ident, t_reply *reply)
+{
+    struct icmphdr *quoted;
+    struct sockaddr *offender;
+    int family, error;
+
+    if (err->ee_origin == SO_EE_ORIGIN_ICMP6) {
+        family = AF_INET6;
+    } else if (err->ee_origin == SO_EE_ORIGIN_ICMP) {
+        family = AF_INET;
+    } else {
+        return -1;
+    }
+    error = icmp_error_kind(family, err->ee_type, err->ee_code);
+    if (error == ICMP_ERR_NONE || (size_t)len < sizeof(struct icmphdr)) {
+        return -1;
+    }
+    quoted = (struct icmphdr *)payload;
+    if (ntohs(quoted->un.echo.id) != ident) {
+        return -1;
+    }
+
+    /* Without an offender the error came from the target itself */
+    offender = SO_EE_OFFENDER(err);
+    if (offender->sa_family == AF_INET6) {
+        memcpy(&reply->from, offender, sizeof(struct sockaddr_in6));
+    } else if (offender->sa_family == AF_INET) {
+        memcpy(&reply->from, offender, sizeof(struct sockaddr_in));
+    } else {
+        reply->from = reply->target;
+    }
+
+    /* Size of the error as sent: ICMP header, quoted IP header and payload */
+    reply->bytes = sizeof(struct icmphdr) + len +
+                   (family == AF_INET6 ? sizeof(struct ip6_hdr) : sizeof(struct ip));
+    reply->seq = ntohs(quoted->un.echo.sequence);
+    reply->error = error;
+    reply->icmp_type = err->ee_type;
+    reply->icmp_code = err->ee_code;
+    reply->mtu = error == ICMP_ERR_TOO_BIG ? err->ee_info : 0;
+    reply->ttl = 0; /* The error queue does not keep the error's own header */
+
+    return 0;
 }
@@ -1,135 +1,1871 @@
 #include "../includes/ft_ping.h"
 
 /**
- * Start pinging the target
+ * Get the endpoint whose socket reaches a target
  *
+ * @param p Pinger state
+ * @param target Position of the target
+ * @return Endpoint of the target's address family
+ */
+static t_endpoint *target_endpoint(t_pinger *p, int target)
+{
+    if (p->targets[target].addr.sa.sa_family == AF_INET6) {
+        return &p->endpoints[ENDPOINT_V6];
+    }
+    return &p->endpoints[ENDPOINT_V4];
+}
+
+/**
+ * Remember which probe the kernel will report a transmit timestamp for
+ *
+ * @param e Endpoint the probe was sent from
+ * @param target Position of the probed target
+ * @param seq Sequence number of the probe
+ */
+static void track_tx_key(t_endpoint *e, int target, int seq)
+{
+    t_tx_key *entry;
+
+    entry = &e->tx_keys[e->tx_key_next & (TX_KEY_RING - 1)];
+    entry->key = e->tx_key_next++;
+    entry->target = target;
+    entry->seq = seq;
+}
+
+/**
+ * Account for the outcome of one probe of a path MTU search
+ * The bounds only move inward: a size that came back raises the floor,
+ * one refused or lost lowers the ceiling, down to the next-hop MTU when
+ * a router quoted one. The next round is left to the event loop, which
+ * sends it once every probe of this one is resolved.
+ *
+ * @param p Pinger state
+ * @param target Position of the searched target
+ * @param probe Probe answered, refused, failed or expired
+ * @param outcome PMTU_FITS, PMTU_TOO_BIG or PMTU_LOST
+ * @param mtu Next-hop MTU quoted by a router, 0 if none
+ */
+static void pmtu_result(t_pinger *p, int target, t_probe *probe, int outcome, int mtu)
+{
+    t_pmtu *s;
+    int limit;
+
+    s = &p->pmtu[target];
+    if (p->reported[target] || probe->size == 0 || s->outstanding == 0) {
+        return;
+    }
+    if (outcome == PMTU_FITS) {
+        if (probe->size > s->lo) {
+            s->lo = probe->size;
+        }
+        if (s->hi <= s->lo) {
+            s->hi = s->lo + 1;
+        }
+    } else {
+        limit = probe->size;
+        if (outcome == PMTU_TOO_BIG && mtu > s->header && mtu - s->header < limit) {
+            limit = mtu - s->header + 1;
+        }
+        if (limit > s->lo && limit < s->hi) {
+            s->hi = limit;
+        }
+    }
+    if (--s->outstanding == 0) {
+        p->pmtu_ready++;
+    }
+}
+
+/**
+ * Send every probe queued on an endpoint and account for the ones that left
+ *
+ * @param p Pinger state
+ * @param e Endpoint to flush
+ */
+static void flush_probes(t_pinger *p, t_endpoint *e)
+{
+    t_send_batch *batch;
+    t_inflight *inflight;
+    t_probe *probe;
+    t_probe failed;
+    int queued, target;
+
+    batch = &e->send_batch;
+    queued = batch->count;
+    send_batch_flush(e->sockfd, batch, &p->batch_stats);
+
+    for (int i = 0; i < queued; i++) {
+        target = batch->targets[i];
+        inflight = &p->inflight[target];
+
+        if (batch->errors[i]) {
+            /* Retire the probe; its sequence number stays burnt so the schedule stays fixed */
+            inflight_match(inflight, (uint16_t)batch->seqs[i], &failed);
+            if (p->opts->pmtu_search) {
+                pmtu_result(p, target, &failed,
+                            batch->errors[i] == EMSGSIZE ? PMTU_TOO_BIG : PMTU_LOST, 0);
+            }
+            if (p->opts->verbose) {
+                print_verbose("Error sending %d bytes to %s: %s", (int)batch->msgs[i].msg_hdr.msg_iov->iov_len,
+                              p->targets[target].hostname, strerror(batch->errors[i]));
+            }
+            continue;
+        }
+
+        probe = &inflight->slots[batch->seqs[i] & (inflight->size - 1)];
+        expiry_push(&p->expiry, target, probe);
+        if (e->timestamps & TIMESTAMP_TX) {
+            track_tx_key(e, target, probe->seq);
+        }
+        p->stats[target].packets_sent++;
+    }
+}
+
+/**
+ * Send the probes queued on every endpoint
+ *
+ * @param p Pinger state
+ */
+static void flush_all_probes(t_pinger *p)
+{
+    for (int i = 0; i < ENDPOINT_COUNT; i++) {
+        if (p->endpoints[i].send_batch.count > 0) {
+            flush_probes(p, &p->endpoints[i]);
+        }
+    }
+}
+
+/**
+ * Record the outcome of a probe in the capture file, if there is one
+ *
+ * @param p Pinger state
+ * @param target Position of the target in the shard
+ * @param probe Probe answered, failed or expired
+ * @param reply Reply or ICMP error, or NULL if the probe expired
+ * @param rtt Round-trip time in milliseconds (reply or error)
+ * @param now_ns When the probe expired (monotonic)
+ */
+static void capture_probe(t_pinger *p, int target, t_probe *probe, t_reply *reply, double rtt, int64_t now_ns)
+{
+    t_sample sample;
+
+    if (!p->capture) {
+        return;
+    }
+    sample.target = (uint32_t)(p->targets - p->opts->targets) + target;
+    sample.seq = probe->seq;
+    sample.send_ns = probe->send_ns;
+    sample.ttl = reply ? reply->ttl : 0;
+    sample.icmp_type = 0;
+    sample.icmp_code = 0;
+    if (reply) {
+        sample.status = SAMPLE_REPLY;
+        if (reply->error != ICMP_ERR_NONE) {
+            sample.status = SAMPLE_ERROR;
+            sample.icmp_type = reply->icmp_type;
+            sample.icmp_code = reply->icmp_code;
+        }
+        sample.bytes = reply->bytes;
+        sample.recv_ns = reply->rx_ns;
+        sample.rtt_ns = (int64_t)(rtt * NSEC_PER_MSEC);
+    } else {
+        sample.status = SAMPLE_TIMEOUT;
+        sample.bytes = 0;
+        sample.recv_ns = now_ns;
+        sample.rtt_ns = 0;
+    }
+    capture_sample(p->capture, p->shard, &sample);
+}
+
+/**
+ * Account for a probe that got no reply in time
+ * Its loss shows in the counts already; the pacer, the capture file and
+ * machine formats are told here. A traced hop is reported by the caller.
+ *
+ * @param p Pinger state
+ * @param target Position of the target in the shard
+ * @param probe Expired probe
+ * @param now_ns Current time (monotonic)
+ */
+static void report_expired(t_pinger *p, int target, t_probe *probe, int64_t now_ns)
+{
+    t_record rec;
+
+    pacer_expire(&p->pacer);
+    capture_probe(p, target, probe, NULL, 0, now_ns);
+    if (!p->opts->trace_hops && p->opts->format != FORMAT_TEXT) {
+        memset(&rec, 0, sizeof(rec));
+        rec.type = RECORD_TIMEOUT;
+        rec.target = &p->targets[target];
+        rec.name = rec.target->rdns ? rec.target->rdns : rec.target->hostname;
+        rec.seq = probe->seq;
+        rec.time_ns = now_ns;
+        output_push(p->output, p->ring, &rec);
+    }
+}
+
+/**
+ * Queue the next probe to a target and register it as outstanding
+ * A full batch is sent first, so the probe always finds room. A probe
+ * still outstanding in the slot the new one takes (a window too small for
+ * the rate) expires there and then.
+ *
+ * @param p Pinger state
+ * @param target Position of the target to probe
+ * @param now_ns Current time (monotonic)
+ * @param ttl TTL of this probe, 0 for the socket's
+ * @param size Size of this probe (ICMP bytes), 0 for the template's
+ */
+static void queue_probe(t_pinger *p, int target, int64_t now_ns, int ttl, int size)
+{
+    t_endpoint *e;
+    t_inflight *inflight;
+    t_probe *probe, evicted;
+    void *packet;
+
+    e = target_endpoint(p, target);
+    if (e->send_batch.count == BATCH_SIZE) {
+        flush_probes(p, e);
+    }
+
+    inflight = &p->inflight[target];
+    packet = send_batch_add(&e->send_batch, &p->targets[target].addr,
+                            size ? size : e->tpl.size, target, inflight->next, ttl);
+    stamp_packet(&e->tpl, packet, size ? size : e->tpl.size, inflight->next, now_ns);
+    probe = inflight_add(inflight, now_ns, &evicted);
+    probe->ttl = ttl;
+    probe->size = size;
+
+    if (evicted.outstanding) {
+        report_expired(p, target, &evicted, now_ns);
+        if (p->opts->verbose) {
+            print_verbose("No response received from %s icmp_seq=%d before its slot was reused",
+                          p->targets[target].hostname, evicted.seq);
+        }
+    }
+}
+
+/**
+ * Send every probe whose slot in the schedule has come
+ * Targets are probed round-robin, spread evenly over the interval. Probes
+ * due within SEND_BATCH_WINDOW_US are sent early so they share a sendmmsg.
+ *
+ * @param p Pinger state
+ * @param now_ns Current time (monotonic)
+ */
+static void send_due_probes(t_pinger *p, int64_t now_ns)
+{
+    int64_t horizon;
+    int limit;
+
+    if (p->active_count == 0) {
+        return;
+    }
+    horizon = now_ns + SEND_BATCH_WINDOW_US * NSEC_PER_USEC;
+
+    /* Bound the burst after a stall so replies keep being drained */
+    limit = p->active_count > SEND_BURST_MAX ? p->active_count : SEND_BURST_MAX;
+    for (int i = 0; i < limit && p->next_send < horizon; i++) {
+        queue_probe(p, p->active[p->next_target], now_ns, 0, 0);
+        p->next_target = (p->next_target + 1) % p->active_count;
+        p->next_send += p->send_gap;
+    }
+
+    flush_all_probes(p);
+}
+
+/**
+ * Queue a flood mode mark for the output thread
+ * Machine formats report every reply instead, so they get no marks.
+ *
+ * @param p Pinger state
+ * @param mark '.' per probe sent, backspace per reply
+ */
+static void push_mark(t_pinger *p, char mark)
+{
+    t_record rec;
+
+    if (p->opts->format != FORMAT_TEXT) {
+        return;
+    }
+    rec.type = RECORD_MARK;
+    rec.mark = mark;
+    output_push(p->output, p->ring, &rec);
+}
+
+/**
+ * Keep every target's window of outstanding probes full (flood mode)
+ * Probes leave as soon as a reply or an expiry frees a slot, so the rate
+ * is bounded by FLOOD_WINDOW probes per round trip rather than by a timer.
+ *
+ * @param p Pinger state
+ * @param now_ns Current time (monotonic)
+ */
+static void send_flood_probes(t_pinger *p, int64_t now_ns)
+{
+    t_inflight *inflight;
+    int full, queued, target;
+
+    /* Visit targets round-robin, skipping those with a full window */
+    full = 0;
+    queued = 0;
+    while (queued < BATCH_SIZE && full < p->active_count) {
+        target = p->active[p->next_target];
+        inflight = &p->inflight[target];
+        if (inflight->count < inflight->size) {
+            queue_probe(p, target, now_ns, 0, 0);
+            push_mark(p, '.');
+            queued++;
+            full = 0;
+        } else {
+            full++;
+        }
+        p->next_target = (p->next_target + 1) % p->active_count;
+    }
+
+    flush_all_probes(p);
+}
+
+/**
+ * Send one echo per TTL from 1 to the trace length to a target, all at once
+ * Each probe carries its own TTL, so every router on the path answers
+ * within about one round trip instead of one TTL after the other.
+ *
+ * @param p Pinger state
+ * @param target Position of the target to trace
+ * @param now_ns Current time (monotonic)
+ */
+static void send_trace_probes(t_pinger *p, int target, int64_t now_ns)
+{
+    for (int ttl = 1; ttl <= p->opts->trace_hops; ttl++) {
+        queue_probe(p, target, now_ns, ttl, 0);
+    }
+    flush_all_probes(p);
+}
+
+/**
+ * Report the path of a target once every hop up to its end is known
+ * The path ends at the first hop that answered with anything but time
+ * exceeded: the target itself, or a router refusing to forward. Larger
+ * TTLs get the same answer, so they are not waited for.
+ *
+ * @param p Pinger state
+ * @param target Position of the traced target
+ * @param now_ns Current time (monotonic)
+ * @param force Report even with hops still pending (end of the run)
+ */
+static void trace_report(t_pinger *p, int target, int64_t now_ns, bool force)
+{
+    t_record rec;
+    t_target *t;
+    t_hop *hops;
+    int last;
+
+    if (p->reported[target]) {
+        return;
+    }
+    hops = &p->hops[(size_t)target * p->opts->trace_hops];
+    last = p->opts->trace_hops;
+    for (int i = 0; i < p->opts->trace_hops; i++) {
+        if (hops[i].status == HOP_PENDING && !force) {
+            return;
+        }
+        if (hops[i].status == HOP_REACHED || hops[i].status == HOP_ERROR) {
+            last = i + 1;
+            break;
+        }
+    }
+    p->reported[target] = true;
+    p->reported_count++;
+
+    t = &p->targets[target];
+    memset(&rec, 0, sizeof(rec));
+    rec.type = RECORD_TRACE;
+    rec.target = t;
+    rec.name = t->hostname;
+    rec.ttl = p->opts->trace_hops;
+    rec.bytes = p->opts->packet_size;
+    output_push(p->output, p->ring, &rec);
+    for (int i = 0; i < last; i++) {
+        memset(&rec, 0, sizeof(rec));
+        rec.type = RECORD_HOP;
+        rec.target = t;
+        rec.name = t->rdns ? t->rdns : t->hostname;
+        rec.ttl = i + 1;
+        rec.status = hops[i].status;
+        rec.rtt = hops[i].rtt;
+        rec.from = hops[i].from;
+        rec.icmp_type = hops[i].icmp_type;
+        rec.icmp_code = hops[i].icmp_code;
+        rec.time_ns = now_ns;
+        output_push(p->output, p->ring, &rec);
+    }
+}
+
+/**
+ * Record what came back for one TTL of a traced path
+ * Only the first outcome of a hop counts.
+ *
+ * @param p Pinger state
+ * @param target Position of the traced target
+ * @param probe Probe answered, failed or expired
+ * @param status HOP_*
+ * @param reply Reply or ICMP error, or NULL if the probe expired
+ * @param rtt Round-trip time in milliseconds (reply or error)
+ * @param now_ns Current time (monotonic)
+ */
+static void trace_hop(t_pinger *p, int target, t_probe *probe, int status, t_reply *reply, double rtt, int64_t now_ns)
+{
+    t_hop *hop;
+
+    if (probe->ttl == 0 || p->reported[target]) {
+        return;
+    }
+    hop = &p->hops[(size_t)target * p->opts->trace_hops + probe->ttl - 1];
+    if (hop->status != HOP_PENDING) {
+        return;
+    }
+    hop->status = status;
+    hop->rtt = rtt;
+    if (reply) {
+        hop->from = reply->from;
+        hop->icmp_type = reply->icmp_type;
+        hop->icmp_code = reply->icmp_code;
+    }
+    trace_report(p, target, now_ns, false);
+}
+
+/**
+ * Report the path MTU of a target, as far as the search got
+ *
+ * @param p Pinger state
+ * @param target Position of the searched target
+ * @param now_ns Current time (monotonic)
+ * @param force Search cut short (end of the run): the MTU is a floor
+ */
+static void pmtu_report(t_pinger *p, int target, int64_t now_ns, bool force)
+{
+    t_record rec;
+    t_target *t;
+    t_pmtu *s;
+
+    if (p->reported[target]) {
+        return;
+    }
+    p->reported[target] = true;
+    p->reported_count++;
+
+    s = &p->pmtu[target];
+    t = &p->targets[target];
+    memset(&rec, 0, sizeof(rec));
+    rec.type = RECORD_PMTU;
+    rec.target = t;
+    rec.name = t->rdns ? t->rdns : t->hostname;
+    rec.seq = s->rounds;
+    rec.bytes = s->lo;
+    rec.mtu = s->lo + s->header;
+    rec.status = force || s->hi - s->lo > 1 ? PMTU_PARTIAL : PMTU_FOUND;
+    if (s->lo < ICMP_HEADER_SIZE + PAYLOAD_MIN) {
+        rec.status = PMTU_NONE;
+    }
+    rec.time_ns = now_ns;
+    output_push(p->output, p->ring, &rec);
+}
+
+/**
+ * Send the next round of a path MTU search, or report it once it is over
+ * The largest size still possible goes first: it is the likely answer
+ * once a router quoted its MTU. The others split the rest of the range
+ * evenly, so a round narrows it PMTU_PROBES-fold rather than halving it.
+ *
+ * @param p Pinger state
+ * @param target Position of the searched target
+ * @param now_ns Current time (monotonic)
+ */
+static void pmtu_round(t_pinger *p, int target, int64_t now_ns)
+{
+    t_pmtu *s;
+    int span, count;
+
+    s = &p->pmtu[target];
+    span = s->hi - s->lo - 1;
+    if (span <= 0 || s->rounds == PMTU_ROUNDS_MAX) {
+        pmtu_report(p, target, now_ns, false);
+        return;
+    }
+    count = span < PMTU_PROBES ? span : PMTU_PROBES;
+
+    /* Counted first: a probe may fail while the others are queued */
+    s->outstanding = count;
+    s->rounds++;
+    queue_probe(p, target, now_ns, 0, s->hi - 1);
+    for (int k = 1; k < count; k++) {
+        queue_probe(p, target, now_ns, 0, s->lo + (int)((long)span * k / count));
+    }
+}
+
+/**
+ * Start the path MTU search of a target whose address is now known
+ * The search covers every size up to the template's. Unless the sockets
+ * probe past it, the MTU the kernel already knows for the route bounds it.
+ *
+ * @param p Pinger state
+ * @param target Position of the target
+ * @param now_ns Current time (monotonic)
+ */
+static void pmtu_start(t_pinger *p, int target, int64_t now_ns)
+{
+    t_endpoint *e;
+    t_pmtu *s;
+    int mtu;
+
+    e = target_endpoint(p, target);
+    s = &p->pmtu[target];
+    s->header = e->family == AF_INET6 ? sizeof(struct ip6_hdr) : sizeof(struct ip);
+    s->lo = ICMP_HEADER_SIZE + PAYLOAD_MIN - 1;
+    s->hi = e->tpl.size + 1;
+    if (!p->opts->size_set && PMTU_MAX - s->header < e->tpl.size) {
+        s->hi = PMTU_MAX - s->header + 1; /* The default size fits IPv4 headers */
+    }
+    if (p->opts->pmtu_discover != IP_PMTUDISC_PROBE) {
+        mtu = route_mtu(&p->targets[target].addr);
+        if (mtu > s->header && mtu - s->header < e->tpl.size) {
+            s->hi = mtu - s->header + 1;
+        }
+    }
+    pmtu_round(p, target, now_ns);
+    flush_all_probes(p);
+}
+
+/**
+ * Send the next round of every path MTU search whose round is over
+ * A round may end while its probes are sent, so this goes on until no
+ * search is left waiting.
+ *
+ * @param p Pinger state
+ * @param now_ns Current time (monotonic)
+ */
+static void send_pmtu_rounds(t_pinger *p, int64_t now_ns)
+{
+    int target;
+
+    while (p->pmtu_ready > 0) {
+        p->pmtu_ready = 0;
+        for (int i = 0; i < p->active_count; i++) {
+            target = p->active[i];
+            if (!p->reported[target] && p->pmtu[target].outstanding == 0) {
+                pmtu_round(p, target, now_ns);
+            }
+        }
+        flush_all_probes(p);
+    }
+}
+
+/**
+ * Compute the round-trip time of a reply with the most precise clock
+ * available for both ends: hardware stamps, then kernel software stamps,
+ * then the monotonic clock read around the syscalls. A transmit stamp
+ * still on the error queue when the reply is read leaves only the
+ * monotonic clock; wall clock stamps are never paired with anything else.
+ *
+ * @param p Pinger state
+ * @param probe Matched probe
+ * @param reply Parsed reply
+ * @return Round-trip time in milliseconds
+ */
+static double compute_rtt(t_pinger *p, t_probe *probe, t_reply *reply)
+{
+    if (probe->tx_hw_ns && reply->rx_hw_ns) {
+        p->rtt_sources[RTT_HARDWARE]++;
+        return (reply->rx_hw_ns - probe->tx_hw_ns) / (double)NSEC_PER_MSEC;
+    }
+    if (probe->tx_sw_ns && reply->rx_sw_ns && reply->rx_sw_ns >= probe->tx_sw_ns) {
+        p->rtt_sources[RTT_SOFTWARE]++;
+        return (reply->rx_sw_ns - probe->tx_sw_ns) / (double)NSEC_PER_MSEC;
+    }
+    p->rtt_sources[RTT_MONOTONIC]++;
+    return (reply->rx_ns - probe->send_ns) / (double)NSEC_PER_MSEC;
+}
+
+/**
+ * Match a reply against the outstanding probes and account for it
+ * The payload is checked first: a damaged one or one from another run
+ * is counted and dropped. An intact reply whose probe already expired is
+ * late and still counts as received, its send time read from the payload
+ * when the slot moved on; a second copy of a reply is only counted. A
+ * reply must also be as large as its probe, which sizes may vary (-P).
+ *
+ * @param p Pinger state
+ * @param reply Parsed reply
+ */
+static void handle_reply(t_pinger *p, t_reply *reply)
+{
+    t_record rec;
+    t_target *t;
+    t_packet_template *tpl;
+    t_probe probe;
+    double rtt;
+    int target, kind, size;
+    char ip[INET6_ADDRSTRLEN];
+
+    /* Demultiplex by source address, then by sequence number */
+    target = find_target(&p->index, &reply->from);
+    if (target < 0) {
+        if (p->opts->verbose) {
+            print_verbose("Ignoring unmatched reply from %s icmp_seq=%d",
+                          sockaddr_str(&reply->from, ip, sizeof(ip)), reply->seq);
+        }
+        return;
+    }
+    tpl = &target_endpoint(p, target)->tpl;
+    kind = check_payload(tpl, reply);
+    if (kind == REPLY_OK) {
+        kind = inflight_reply(&p->inflight[target], reply->seq, &probe);
+
+        /* An intact reply shorter than its probe was cut on the way; once
+           the slot moved on, the size of a search probe is not known */
+        size = probe.size ? probe.size : tpl->size;
+        if (reply->bytes != size && (probe.send_ns || !p->opts->pmtu_search)) {
+            if (kind == REPLY_OK && p->opts->pmtu_search) {
+                pmtu_result(p, target, &probe, PMTU_LOST, 0);
+            }
+            kind = REPLY_CORRUPTED;
+        }
+    }
+    p->stats[target].replies[kind]++;
+    if (kind == REPLY_CORRUPTED || kind == REPLY_MISMATCHED) {
+        if (p->opts->verbose) {
+            print_verbose("Ignoring %s reply from %s icmp_seq=%d", reply_kind_name(kind),
+                          sockaddr_str(&reply->from, ip, sizeof(ip)), reply->seq);
+        }
+        return;
+    }
+    if (!probe.send_ns) {
+        probe.send_ns = reply->send_ns;
+    }
+
+    /* Calculate round-trip time in milliseconds */
+    rtt = compute_rtt(p, &probe, reply);
+
+    /* Update statistics; only the first reply to a probe counts */
+    if (kind != REPLY_DUPLICATE) {
+        update_stats(&p->stats[target], rtt);
+        capture_probe(p, target, &probe, reply, rtt, reply->rx_ns);
+    }
+    if (kind == REPLY_OK) {
+        pacer_reply(&p->pacer, rtt);
+        if (p->opts->pmtu_search) {
+            pmtu_result(p, target, &probe, PMTU_FITS, 0);
+        }
+    }
+
+    /* Hand the result to the output thread */
+    if (p->opts->trace_hops) {
+        if (kind == REPLY_OK) {
+            trace_hop(p, target, &probe, HOP_REACHED, reply, rtt, reply->rx_ns);
+        }
+    } else if (p->opts->flood && p->opts->format == FORMAT_TEXT) {
+        if (kind == REPLY_OK) {
+            push_mark(p, '\b');
+        }
+    } else if (!p->opts->pmtu_search || p->opts->format != FORMAT_TEXT) {
+        t = &p->targets[target];
+        rec.type = RECORD_REPLY;
+        rec.target = t;
+        rec.name = t->rdns ? t->rdns : t->hostname;
+        rec.seq = probe.seq;
+        rec.bytes = reply->bytes;
+        rec.ttl = reply->ttl;
+        rec.status = kind;
+        rec.rtt = rtt;
+        rec.time_ns = reply->rx_ns;
+        output_push(p->output, p->ring, &rec);
+    }
+}
+
+/**
+ * Match an ICMP error to the probe it quotes and retire that probe
+ * The probe failed for good, so its slot is freed at once rather than
+ * after the timeout. A redirect only points at a better route while the
+ * probe goes on its way, so it is counted and nothing else.
+ *
+ * @param p Pinger state
+ * @param reply Parsed error
+ */
+static void handle_error(t_pinger *p, t_reply *reply)
+{
+    t_record rec;
+    t_target *t;
+    t_probe probe;
+    double rtt;
+    int target;
+    char ip[INET6_ADDRSTRLEN];
+
+    /* Demultiplex by the quoted destination, then by the quoted sequence */
+    target = find_target(&p->index, &reply->target);
+    if (target >= 0 && reply->error == ICMP_ERR_REDIRECT) {
+        p->stats[target].errors[ICMP_ERR_REDIRECT]++;
+        if (p->opts->verbose) {
+            print_verbose("Redirect from %s for %s icmp_seq=%d",
+                          sockaddr_str(&reply->from, ip, sizeof(ip)),
+                          p->targets[target].hostname, reply->seq);
+        }
+        return;
+    }
+    if (target < 0 || inflight_match(&p->inflight[target], reply->seq, &probe) < 0) {
+        if (p->opts->verbose) {
+            print_verbose("Ignoring unmatched ICMP error from %s icmp_seq=%d",
+                          sockaddr_str(&reply->from, ip, sizeof(ip)), reply->seq);
+        }
+        return;
+    }
+
+    /* Time until the error came back, from the router that sent it */
+    rtt = compute_rtt(p, &probe, reply);
+    p->stats[target].errors[reply->error]++;
+    pacer_expire(&p->pacer);
+    capture_probe(p, target, &probe, reply, rtt, reply->rx_ns);
+    if (p->opts->pmtu_search) {
+        pmtu_result(p, target, &probe, reply->error == ICMP_ERR_TOO_BIG ? PMTU_TOO_BIG : PMTU_LOST,
+                    reply->mtu);
+    }
+
+    /* Routers saying the TTL ran out draw the path of a trace */
+    if (p->opts->trace_hops) {
+        trace_hop(p, target, &probe, reply->error == ICMP_ERR_TIME_EXCEEDED ? HOP_ROUTER : HOP_ERROR,
+                  reply, rtt, reply->rx_ns);
+        return;
+    }
+    if (p->opts->flood && p->opts->format == FORMAT_TEXT) {
+        push_mark(p, '\b');
+        push_mark(p, 'E');
+        return;
+    }
+    if (p->opts->pmtu_search && p->opts->format == FORMAT_TEXT) {
+        return; /* Summed up by the search */
+    }
+    t = &p->targets[target];
+    memset(&rec, 0, sizeof(rec));
+    rec.type = RECORD_ERROR;
+    rec.target = t;
+    rec.name = t->rdns ? t->rdns : t->hostname;
+    rec.seq = probe.seq;
+    rec.bytes = reply->bytes;
+    rec.rtt = rtt;
+    rec.time_ns = reply->rx_ns;
+    rec.error = reply->error;
+    rec.icmp_type = reply->icmp_type;
+    rec.icmp_code = reply->icmp_code;
+    rec.mtu = reply->mtu;
+    rec.from = reply->from;
+    output_push(p->output, p->ring, &rec);
+}
+
+/**
+ * Drain an endpoint's error queue
+ * Transmit timestamps are attached to their probes; ICMP errors, which
+ * ping sockets only report here, retire the probe they quote.
+ *
+ * @param p Pinger state
+ * @param e Endpoint whose error queue has entries
+ */
+static void receive_error_queue(t_pinger *p, t_endpoint *e)
+{
+    t_errqueue *q;
+    t_inflight *inflight;
+    t_tx_key *entry;
+    t_probe *probe;
+    int64_t now_ns;
+    int count;
+
+    q = &e->errqueue;
+    while ((count = read_error_queue(e->sockfd, e->ident, q)) > 0) {
+        for (int i = 0; i < q->stamp_count; i++) {
+            entry = &e->tx_keys[q->stamps[i].key & (TX_KEY_RING - 1)];
+            if (entry->key != q->stamps[i].key) {
+                continue; /* Overwritten by a more recent send */
+            }
+            inflight = &p->inflight[entry->target];
+            if (!inflight_pending(inflight, entry->seq)) {
+                continue; /* Already answered or expired */
+            }
+            probe = &inflight->slots[entry->seq & (inflight->size - 1)];
+            probe->tx_sw_ns = q->stamps[i].sw_ns;
+            probe->tx_hw_ns = q->stamps[i].hw_ns;
+        }
+
+        now_ns = monotonic_ns();
+        for (int i = 0; i < q->error_count; i++) {
+            q->errors[i].rx_ns = now_ns;
+            handle_error(p, &q->errors[i]);
+        }
+        if (count < BATCH_SIZE) {
+            break;
+        }
+    }
+}
+
+/**
+ * Retire every probe whose timeout has elapsed
+ * Queue entries whose probe already got a reply are dropped on the way.
+ *
+ * @param p Pinger state
+ * @param now_ns Current time (monotonic)
+ */
+static void expire_probes(t_pinger *p, int64_t now_ns)
+{
+    int64_t deadline;
+    t_inflight *inflight;
+    t_expiry *entry;
+    t_probe probe;
+
+    deadline = now_ns - DEFAULT_TIMEOUT * NSEC_PER_SEC;
+
+    while ((entry = expiry_peek(&p->expiry)) != NULL) {
+        inflight = &p->inflight[entry->target];
+        if (inflight_pending(inflight, entry->seq)) {
+            if (entry->send_ns >= deadline) {
+                break;
+            }
+            inflight_match(inflight, (uint16_t)entry->seq, &probe);
+            report_expired(p, entry->target, &probe, now_ns);
+            if (p->opts->verbose) {
+                print_verbose("No response received within timeout from %s icmp_seq=%d",
+                              p->targets[entry->target].hostname, probe.seq);
+            }
+            /* Dropped without a word: a black hole on the path looks like this */
+            if (p->opts->pmtu_search) {
+                pmtu_result(p, entry->target, &probe, PMTU_LOST, 0);
+            }
+            if (p->opts->trace_hops) {
+                trace_hop(p, entry->target, &probe, HOP_TIMEOUT, NULL, 0, now_ns);
+            }
+        }
+        expiry_pop(&p->expiry);
+    }
+}
+
+/**
+ * Compute how long the event loop may sleep before the next probe expires
+ * Sends are driven by the timer, so only expiries bound the sleep.
+ *
+ * @param p Pinger state
+ * @param now_ns Current time (monotonic)
+ * @return Timeout in milliseconds, rounded up, or -1 if nothing is outstanding
+ */
+static int expiry_timeout_ms(t_pinger *p, int64_t now_ns)
+{
+    int64_t expiry;
+    t_expiry *entry;
+
+    if ((entry = expiry_peek(&p->expiry)) == NULL) {
+        return -1;
+    }
+
+    expiry = entry->send_ns + DEFAULT_TIMEOUT * NSEC_PER_SEC;
+    if (expiry <= now_ns) {
+        return 0;
+    }
+
+    return (expiry - now_ns + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+}
+
+/**
+ * Compute how long the event loop may sleep
+ * Besides expiries, the next metrics snapshot is due on time even when
+ * probes are sent seldom, and a path MTU round that is over goes at once.
+ *
+ * @param p Pinger state
+ * @param now_ns Current time (monotonic)
+ * @return Timeout in milliseconds, or -1 to wait for an event
+ */
+static int loop_timeout_ms(t_pinger *p, int64_t now_ns)
+{
+    int timeout, publish;
+
+    if (p->pmtu_ready > 0) {
+        return 0;
+    }
+    timeout = expiry_timeout_ms(p, now_ns);
+    if (!p->metrics) {
+        return timeout;
+    }
+    publish = 0;
+    if (p->metrics_next_ns > now_ns) {
+        publish = (int)((p->metrics_next_ns - now_ns + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC);
+    }
+
+    return timeout < 0 || publish < timeout ? publish : timeout;
+}
+
+/**
+ * Drain the replies queued on an endpoint's socket and match them
+ *
+ * @param p Pinger state
+ * @param e Endpoint whose socket is readable
+ */
+static void receive_replies(t_pinger *p, t_endpoint *e)
+{
+    t_recv_batch *batch;
+    t_reply reply;
+    int64_t now_ns;
+    int received;
+
+    batch = &e->recv_batch;
+    received = receive_batch(e->sockfd, batch, &p->batch_stats);
+    if (received <= 0) {
+        return;
+    }
+
+    /* Record receive time, shared by the whole batch */
+    now_ns = monotonic_ns();
+    for (int i = 0; i < received; i++) {
+        reply.from = batch->addrs[i];
+        if (parse_reply(batch->buffers + (size_t)i * batch->buffer_size, batch->msgs[i].msg_len,
+                        e->family, e->kind, e->ident, &reply) < 0) {
+            continue;
+        }
+        p->batch_stats.packets_accepted++;
+        reply.rx_ns = now_ns;
+        if (reply.ttl == 0) {
+            reply.ttl = read_reply_ttl(&batch->msgs[i].msg_hdr);
+        }
+        read_rx_timestamp(&batch->msgs[i].msg_hdr, &reply.rx_sw_ns, &reply.rx_hw_ns);
+        if (reply.error != ICMP_ERR_NONE) {
+            handle_error(p, &reply);
+        } else {
+            handle_reply(p, &reply);
+        }
+    }
+}
+
+/**
+ * Release everything allocated by init_pinger, and the names resolved since
+ *
+ * @param p Pinger state
+ */
+static void free_pinger(t_pinger *p)
+{
+    expiry_free(&p->expiry);
+    arena_free(&p->arena);
+}
+
+/**
+ * Release every shard and the shard array
+ *
+ * @param shards Pinger state of every shard
+ * @param count Number of shards initialized
+ */
+static void free_shards(t_pinger *shards, int count)
+{
+    for (int s = 0; s < count; s++) {
+        free_pinger(&shards[s]);
+    }
+    free(shards);
+}
+
+/**
+ * Spread the sends of one interval evenly over the active targets
+ *
+ * @param p Pinger state
+ */
+static void set_send_gap(t_pinger *p)
+{
+    p->send_gap = p->pacer.interval_ns / (p->active_count ? p->active_count : 1);
+    if (p->send_gap < 1) {
+        p->send_gap = 1;
+    }
+}
+
+/**
+ * Allocate per-target state for every target, resolved or not
+ * Per-target state lives in arrays of per-target records indexed by target
+ * position (reply index, inflight tables and probe slots, statistics,
+ * histograms), all carved from one arena, so nothing is freed one by one.
+ * A reply updates one target's min, max, sum, count and running mean
+ * together; side by side in its record they span two cache lines at most,
+ * where one array per field would touch a line per field.
+ *
+ * @param p Pinger state (output)
  * @param opts Options structure
- * @return Exit code
+ * @param shard Position of the shard
+ * @param targets First target of the shard's slice
+ * @param count Number of targets in the slice
+ * @return 0 on success, -1 on error
+ */
+static int init_pinger(t_pinger *p, t_options *opts, int shard, t_target *targets, int count)
+{
+    t_target_index *index;
+    size_t size, hops;
+    uint32_t slots;
+    int window;
+
+    memset(p, 0, sizeof(t_pinger));
+    p->opts = opts;
+    p->shard = shard;
+    p->targets = targets;
+    p->count = count;
+    pacer_init(&p->pacer, opts, monotonic_ns());
+
+    /* Size the windows for the fastest rate this run may reach */
+    if (opts->trace_hops) {
+        window = 1;
+        while (window < opts->trace_hops) {
+            window <<= 1;
+        }
+    } else if (opts->pmtu_search) {
+        window = PMTU_PROBES;
+    } else if (opts->flood) {
+        window = FLOOD_WINDOW;
+    } else if (opts->adaptive) {
+        window = inflight_window(ADAPT_MIN_INTERVAL_NS, DEFAULT_TIMEOUT * NSEC_PER_SEC);
+    } else {
+        window = inflight_window(opts->interval_ns, DEFAULT_TIMEOUT * NSEC_PER_SEC);
+    }
+
+    /* Every array is carved from one block sized up front; names resolved
+       later go to blocks of their own */
+    slots = index_slots(p->count);
+    hops = opts->trace_hops ? (size_t)p->count * opts->trace_hops : 0;
+    size = arena_span(slots * sizeof(t_target_index)) +
+           arena_span(p->count * sizeof(int)) +
+           arena_span(p->count * sizeof(t_inflight)) +
+           arena_span((size_t)p->count * window * sizeof(t_probe)) +
+           arena_span(p->count * sizeof(t_ping_stats)) +
+           arena_span((size_t)p->count * HIST_BUCKETS * sizeof(uint32_t)) +
+           arena_span(hops * sizeof(t_hop)) +
+           arena_span(p->count * sizeof(t_pmtu)) +
+           arena_span(p->count * sizeof(bool));
+    if (arena_init(&p->arena, size) < 0) {
+        return -1;
+    }
+    index = arena_alloc(&p->arena, slots * sizeof(t_target_index));
+    p->active = arena_alloc(&p->arena, p->count * sizeof(int));
+    p->inflight = arena_alloc(&p->arena, p->count * sizeof(t_inflight));
+    p->slots = arena_alloc(&p->arena, (size_t)p->count * window * sizeof(t_probe));
+    p->stats = arena_alloc(&p->arena, p->count * sizeof(t_ping_stats));
+    p->histograms = arena_alloc(&p->arena, (size_t)p->count * HIST_BUCKETS * sizeof(uint32_t));
+    if (opts->trace_hops) {
+        p->hops = arena_alloc(&p->arena, hops * sizeof(t_hop));
+    }
+    if (opts->pmtu_search) {
+        p->pmtu = arena_alloc(&p->arena, p->count * sizeof(t_pmtu));
+    }
+    if (opts->trace_hops || opts->pmtu_search) {
+        p->reported = arena_alloc(&p->arena, p->count * sizeof(bool));
+    }
+    if (!index || !p->active || !p->inflight || !p->slots || !p->stats || !p->histograms ||
+        (opts->trace_hops && !p->hops) || (opts->pmtu_search && !p->pmtu) ||
+        ((opts->trace_hops || opts->pmtu_search) && !p->reported) ||
+        expiry_init(&p->expiry, p->count * window) < 0) {
+        free_pinger(p);
+        return -1;
+    }
+    index_init(&p->index, index, slots);
+
+    for (int i = 0; i < p->count; i++) {
+        p->stats[i].min_time = -1; /* Will be updated on first received packet */
+        p->stats[i].hostname = targets[i].hostname;
+        p->stats[i].target = &targets[i];
+        p->stats[i].histogram = &p->histograms[(size_t)i * HIST_BUCKETS];
+        inflight_init(&p->inflight[i], &p->slots[(size_t)i * window], window);
+    }
+
+    /* Sockets are opened later, for the families the targets use */
+    for (int i = 0; i < ENDPOINT_COUNT; i++) {
+        p->endpoints[i].sockfd = -1;
+        p->endpoints[i].family = i == ENDPOINT_V6 ? AF_INET6 : AF_INET;
+    }
+
+    set_send_gap(p);
+
+    return 0;
+}
+
+/**
+ * Start the send timer at the current pace
+ * The timer ticks once per send, or once per batch window when sends are
+ * closer than that, from an absolute start so ticks never drift.
+ *
+ * @param p Pinger state
+ * @param start_ns Time of the first tick (monotonic)
  */
-int start_ping(t_options *opts)
+static void start_send_timer(t_pinger *p, int64_t start_ns)
 {
-    int sockfd;
-    int seq = 0;
-    struct timeval send_time, recv_time, timeout, wait_time;
-    double rtt;
-    t_ping_stats stats;
-    char packet[PACKET_SIZE];
-    char recv_buffer[PACKET_SIZE + sizeof(struct ip) + 8]; /* Adding some padding */
-    struct sockaddr_in recv_addr;
-    int ret, bytes_recv;
-
-    /* Initialize statistics */
-    memset(&stats, 0, sizeof(t_ping_stats));
-    stats.min_time = -1; /* Will be updated on first received packet */
-    stats.hostname = strdup(opts->hostname); /* Copy hostname for statistics display */
-
-    /* Create raw socket */
-    sockfd = create_socket();
-    if (sockfd < 0) {
-        fprintf(stderr, "ft_ping: cannot create socket\n");
-        return ERR_SOCKET;
-    }
-
-    /* Set socket options */
-    if (setup_socket(sockfd) < 0) {
+    int64_t tick;
+
+    tick = p->send_gap;
+    if (p->opts->flood || tick < SEND_BATCH_WINDOW_US * NSEC_PER_USEC) {
+        tick = SEND_BATCH_WINDOW_US * NSEC_PER_USEC;
+    }
+
+    p->next_send = start_ns;
+    event_start_timer(&p->events, start_ns, tick);
+}
+
+/**
+ * Follow the adaptive pacer, re-arming the send timer when the rate changes
+ *
+ * @param p Pinger state
+ * @param now_ns Current time (monotonic)
+ */
+static void adapt_rate(t_pinger *p, int64_t now_ns)
+{
+    if (!pacer_adapt(&p->pacer, now_ns)) {
+        return;
+    }
+
+    set_send_gap(p);
+    start_send_timer(p, now_ns);
+    if (p->opts->verbose) {
+        print_verbose("adaptive: interval %.3f ms (%.1f probes/s)",
+                      p->pacer.interval_ns / (double)NSEC_PER_MSEC,
+                      p->active_count * (double)NSEC_PER_SEC / p->pacer.interval_ns);
+    }
+}
+
+/**
+ * Open the socket of an endpoint and prepare it for probing
+ *
+ * @param p Pinger state
+ * @param endpoint ENDPOINT_V4 or ENDPOINT_V6
+ * @return 0 on success, exit code on error
+ */
+static int open_endpoint(t_pinger *p, int endpoint)
+{
+    t_endpoint *e;
+    int buffer_size;
+
+    e = &p->endpoints[endpoint];
+
+    /* Create a ping socket, or a raw socket if ping sockets are not allowed */
+    e->sockfd = create_socket(e->family, &e->kind);
+    if (e->sockfd < 0) {
+        return (errno == EPERM || errno == EACCES) ? ERR_PERMISSION : ERR_SOCKET;
+    }
+    if (p->opts->verbose) {
+        print_verbose("shard %d: using %s %s socket", p->shard,
+                      e->family == AF_INET6 ? "ICMPv6" : "ICMP",
+                      e->kind == SOCKET_DGRAM ? "ping (SOCK_DGRAM)" : "raw (SOCK_RAW)");
+    }
+
+    /* Set socket options and learn the identifier replies will carry */
+    if (setup_socket(e->sockfd, e->family) < 0 ||
+        socket_ident(e->sockfd, e->family, e->kind, p->shard, &e->ident) < 0) {
         fprintf(stderr, "ft_ping: cannot set socket options\n");
-        close(sockfd);
         return ERR_SETOPT;
     }
 
-    /* Print ping header */
-    print_ping_header(opts);
+    /* Ping sockets are demultiplexed by the kernel; raw sockets need a filter */
+    e->filter = "kernel (ping socket)";
+    if (e->kind == SOCKET_DGRAM && enable_icmp_errors(e->sockfd, e->family) < 0) {
+        fprintf(stderr, "ft_ping: ICMP errors unavailable, failed probes will time out\n");
+    }
+    if (e->kind == SOCKET_RAW) {
+        e->filter = "bpf";
+        if (attach_reply_filter(e->sockfd, e->family, e->ident) < 0) {
+            fprintf(stderr, "ft_ping: socket filter unavailable, filtering in userspace\n");
+            e->filter = "none";
+        }
+    }
+
+    /* Set DF, or not, as asked; the path MTU search sets it past any known MTU */
+    if (p->opts->pmtu_discover != PMTU_DEFAULT &&
+        set_mtu_discovery(e->sockfd, e->family, p->opts->pmtu_discover) < 0) {
+        fprintf(stderr, "ft_ping: cannot set path MTU discovery\n");
+        return ERR_SETOPT;
+    }
+
+    /* Ask for kernel timestamps; without them RTT uses the monotonic clock */
+    if (p->opts->kernel_timestamps) {
+        e->timestamps = enable_timestamps(e->sockfd);
+        if (e->timestamps < 0) {
+            fprintf(stderr, "ft_ping: kernel timestamps unavailable, using monotonic clock\n");
+            e->timestamps = 0;
+        }
+    }
+
+    if (event_add_socket(&p->events, e->sockfd, endpoint) < 0) {
+        fprintf(stderr, "ft_ping: cannot set up event loop\n");
+        return 1;
+    }
+
+    /* Wire the batch buffers, every one starting from the template; raw
+       sockets hand replies over with their IP header */
+    buffer_size = ICMP_HEADER_SIZE + p->opts->packet_size + IP_HEADER_MAX;
+    if (buffer_size < RECV_BUFFER_SIZE) {
+        buffer_size = RECV_BUFFER_SIZE;
+    }
+    if (init_template(&e->tpl, e->family, p->opts->packet_size, e->ident, p->opts->nonce) < 0 ||
+        send_batch_init(&e->send_batch, &e->tpl) < 0 ||
+        recv_batch_init(&e->recv_batch, buffer_size) < 0) {
+        fprintf(stderr, "ft_ping: memory allocation failed\n");
+        return 1;
+    }
+
+    return 0;
+}
 
-    /* Main ping loop */
-    while (g_running) {
-        /* Initialize packet */
-        init_packet(packet, PACKET_SIZE, seq);
+/**
+ * Close the socket of every open endpoint and release its buffers
+ *
+ * @param p Pinger state
+ */
+static void close_endpoints(t_pinger *p)
+{
+    for (int i = 0; i < ENDPOINT_COUNT; i++) {
+        if (p->endpoints[i].sockfd >= 0) {
+            close(p->endpoints[i].sockfd);
+            p->endpoints[i].sockfd = -1;
+        }
+        free_template(&p->endpoints[i].tpl);
+        send_batch_free(&p->endpoints[i].send_batch);
+        recv_batch_free(&p->endpoints[i].recv_batch);
+    }
+}
 
-        /* Record send time */
-        gettimeofday(&send_time, NULL);
+/**
+ * Describe how replies are filtered on every endpoint that was opened
+ * Shards open their sockets the same way, so the first shard using an
+ * address family speaks for all of them.
+ *
+ * @param shards Pinger state of every shard
+ * @param count Number of shards
+ * @param buffer Output buffer
+ * @param size Size of the buffer
+ * @return buffer
+ */
+static const char *describe_filters(t_pinger *shards, int count, char *buffer, size_t size)
+{
+    t_endpoint *e;
+    size_t len = 0;
 
-        /* Send packet */
-        ret = send_packet(sockfd, &opts->addr, packet, PACKET_SIZE);
-        if (ret < 0) {
-            if (opts->verbose) {
-                print_verbose("Error sending packet: %s", strerror(errno));
+    buffer[0] = '\0';
+    for (int i = 0; i < ENDPOINT_COUNT && len < size; i++) {
+        for (int s = 0; s < count; s++) {
+            e = &shards[s].endpoints[i];
+            if (e->filter) {
+                len += snprintf(buffer + len, size - len, "%s%s %s", len ? ", " : "",
+                                e->family == AF_INET6 ? "icmpv6" : "icmp", e->filter);
+                break;
             }
-        } else {
-            g_ping_count++;
-            stats.packets_sent++;
+        }
+    }
+
+    return buffer;
+}
+
+/**
+ * Start probing a target whose address is now known
+ * The socket of its address family is opened with the first such target.
+ * A target sharing its address with one already probed is dropped, since
+ * replies are matched by source address.
+ *
+ * @param p Pinger state
+ * @param target Position of the target
+ * @return 0 on success, exit code on error
+ */
+static int activate_target(t_pinger *p, int target)
+{
+    t_record rec;
+    t_target *t;
+    t_endpoint *e;
+    int ret;
 
-            /* Wait for response with timeout */
-            timeout.tv_sec = DEFAULT_TIMEOUT;
-            timeout.tv_usec = 0;
+    t = &p->targets[target];
+    e = target_endpoint(p, target);
+    if (e->sockfd < 0 && (ret = open_endpoint(p, e - p->endpoints)) != 0) {
+        return ret;
+    }
 
-            bytes_recv = receive_packet(sockfd, &recv_addr, recv_buffer,
-                                        sizeof(recv_buffer), &timeout);
+    if (index_insert(&p->index, &t->addr, target) < 0) {
+        fprintf(stderr, "ft_ping: duplicate target %s (%s) ignored\n", t->hostname, t->ipstr);
+        t->state = TARGET_FAILED;
+        return 0;
+    }
+    p->active[p->active_count++] = target;
+    t->state = TARGET_ACTIVE;
+    if (p->capture) {
+        capture_target(p->capture, (int)(p->targets - p->opts->targets) + target, &t->addr);
+    }
+    /* A traced path is printed whole, header included, once it is known */
+    if (!p->opts->trace_hops && !p->opts->pmtu_search) {
+        memset(&rec, 0, sizeof(rec));
+        rec.type = RECORD_HEADER;
+        rec.target = t;
+        rec.name = t->hostname;
+        rec.bytes = p->opts->packet_size;
+        output_push(p->output, p->ring, &rec);
+    }
 
-            if (bytes_recv > 0) {
-                /* Record receive time */
-                gettimeofday(&recv_time, NULL);
+    /* Name numeric targets once the reverse lookup answers */
+    if (p->opts->reverse_dns && strcmp(t->hostname, t->ipstr) == 0 &&
+        resolver_reverse(p->resolver, p->shard, &t->addr, target) < 0) {
+        fprintf(stderr, "ft_ping: reverse lookup of %s failed\n", t->ipstr);
+    }
 
-                /* Calculate round-trip time in milliseconds */
-                rtt = (recv_time.tv_sec - send_time.tv_sec) * 1000.0 +
-                      (recv_time.tv_usec - send_time.tv_usec) / 1000.0;
+    /* A trace sends its whole sweep now, and a search its first round,
+       rather than on the schedule */
+    if (p->opts->trace_hops) {
+        send_trace_probes(p, target, monotonic_ns());
+    } else if (p->opts->pmtu_search) {
+        pmtu_start(p, target, monotonic_ns());
+    }
 
-                /* Update statistics */
-                g_ping_received++;
-                stats.packets_received++;
-                stats.total_time += rtt;
+    return 0;
+}
 
-                if (stats.min_time < 0 || rtt < stats.min_time) {
-                    stats.min_time = rtt;
-                }
-                if (rtt > stats.max_time) {
-                    stats.max_time = rtt;
-                }
+/**
+ * Apply the answers of the resolver
+ * Newly resolved targets join the send rotation at once, while the rest
+ * of the list is still being resolved.
+ *
+ * @param p Pinger state
+ * @return 0 on success, exit code on error
+ */
+static int collect_resolved(t_pinger *p)
+{
+    t_dns_job *job, *next;
+    t_target *t;
+    int active, ret;
 
-                /* Print ping result */
-                print_ping_result(opts, seq, bytes_recv - sizeof(struct ip), rtt);
-            } else {
-                /* Handle timeout or error */
-                if (opts->verbose) {
-                    print_verbose("No response received within timeout");
+    active = p->active_count;
+    ret = 0;
+    for (job = resolver_collect(p->resolver, p->shard); job; job = next) {
+        next = job->next;
+        t = &p->targets[job->target];
+        if (job->kind == DNS_REVERSE) {
+            if (job->status == 0) {
+                t->rdns = arena_strdup(&p->arena, job->result);
+            }
+        } else {
+            p->pending--;
+            if (job->status < 0) {
+                fprintf(stderr, "ft_ping: unknown host %s\n", t->hostname);
+                t->state = TARGET_FAILED;
+            } else if (ret == 0) {
+                t->addr = job->addr;
+                t->ipstr = arena_strdup(&p->arena, job->result);
+                if (!t->ipstr) {
+                    fprintf(stderr, "ft_ping: memory allocation failed\n");
+                    ret = 1;
+                } else {
+                    ret = activate_target(p, job->target);
                 }
             }
         }
+        dns_job_free(job);
+    }
+
+    /* Re-spread the interval over the grown rotation */
+    if (p->active_count != active) {
+        set_send_gap(p);
+        start_send_timer(p, monotonic_ns());
+    }
+
+    return ret;
+}
+
+/**
+ * Keep the statistics of the probed targets, in command line order
+ *
+ * @param p Pinger state
+ */
+static void keep_probed_stats(t_pinger *p)
+{
+    p->kept = 0;
+    for (int i = 0; i < p->count; i++) {
+        if (p->targets[i].state == TARGET_ACTIVE) {
+            p->stats[p->kept++] = p->stats[i];
+        }
+    }
+}
+
+/**
+ * Print the statistics of every target that was probed, over all shards
+ *
+ * @param shards Pinger state of every shard
+ * @param count Number of shards
+ * @param elapsed_ns Duration of the run
+ */
+static void print_final_stats(t_pinger *shards, int count, int64_t elapsed_ns)
+{
+    t_options *opts;
+    t_ping_stats *stats;
+    t_batch_stats batch;
+    long rtt_sources[3];
+    long sent;
+    double requested;
+    bool settled;
+    char filters[64];
+    int kept;
+
+    /* Merge the per-shard results; shards hold consecutive target slices */
+    opts = shards[0].opts;
+    kept = 0;
+    for (int s = 0; s < count; s++) {
+        kept += shards[s].kept;
+    }
+    stats = malloc((kept ? kept : 1) * sizeof(t_ping_stats));
+    if (!stats) {
+        fprintf(stderr, "ft_ping: memory allocation failed\n");
+        return;
+    }
+    memset(&batch, 0, sizeof(batch));
+    memset(rtt_sources, 0, sizeof(rtt_sources));
+    kept = 0;
+    sent = 0;
+    requested = 0;
+    settled = true;
+    for (int s = 0; s < count; s++) {
+        t_pinger *p = &shards[s];
+
+        memcpy(&stats[kept], p->stats, p->kept * sizeof(t_ping_stats));
+        kept += p->kept;
+        batch.send_calls += p->batch_stats.send_calls;
+        batch.packets_sent += p->batch_stats.packets_sent;
+        batch.recv_calls += p->batch_stats.recv_calls;
+        batch.packets_received += p->batch_stats.packets_received;
+        batch.packets_accepted += p->batch_stats.packets_accepted;
+        for (int i = 0; i < 3; i++) {
+            rtt_sources[i] += p->rtt_sources[i];
+        }
+        for (int i = 0; i < p->kept; i++) {
+            sent += p->stats[i].packets_sent;
+        }
+        requested += p->kept * (double)NSEC_PER_SEC / p->pacer.interval_ns;
+        settled = settled && p->pacer.settled;
+    }
+
+    if (opts->format != FORMAT_TEXT) {
+        for (int i = 0; i < kept; i++) {
+            format_stats(opts, &stats[i]);
+        }
+        format_summary(opts, stats, kept, elapsed_ns);
+    } else if (!opts->trace_hops && !opts->pmtu_search) {
+        for (int i = 0; i < kept; i++) {
+            finish_ping(&stats[i]);
+        }
+        if (kept > 1) {
+            print_ping_summary(stats, kept);
+        }
+        if (opts->flood || opts->adaptive || opts->interval_set) {
+            print_rate_stats(opts, requested, settled, sent, elapsed_ns);
+        }
+    }
+    if (opts->verbose) {
+        print_batch_stats(&batch);
+        print_filter_stats(&batch, describe_filters(shards, count, filters, sizeof(filters)));
+        print_dns_stats(shards[0].resolver->lookups, shards[0].resolver->hits);
+        if (opts->kernel_timestamps) {
+            print_timestamp_stats(rtt_sources);
+        }
+    }
+
+    free(stats);
+}
+
+/**
+ * Check whether a trace or a path MTU search is over: every name resolved,
+ * every path or path MTU reported
+ *
+ * @param p Pinger state
+ * @return true once nothing is left to search, false otherwise or when pinging
+ */
+static bool search_finished(t_pinger *p)
+{
+    return (p->opts->trace_hops || p->opts->pmtu_search) && p->pending == 0 &&
+           p->reported_count == p->active_count;
+}
+
+/**
+ * Probe the targets of one shard until the run ends
+ * Probes are sent on a fixed schedule while replies are matched against
+ * the table of outstanding probes as they arrive, so a slow or lost reply
+ * never delays the next send. Every target of an address family shares
+ * the shard's socket. Names are resolved in the background by the
+ * resolver every shard shares; each target joins the schedule as soon as
+ * its address is known.
+ *
+ * @param p Pinger state of the shard
+ * @return Exit code
+ */
+static int run_pinger(t_pinger *p)
+{
+    t_options *opts;
+    int ready, ret;
+
+    /* Watch the sockets, the send timer and the shard's resolver inbox */
+    opts = p->opts;
+    if (event_init(&p->events) < 0) {
+        fprintf(stderr, "ft_ping: cannot set up event loop\n");
+        return 1;
+    }
+
+    /* Resolve every name; numeric addresses are answered on the spot */
+    ret = event_add_fd(&p->events, p->resolver->inboxes[p->shard].eventfd, EVENT_DNS);
+    if (ret == 0 && p->stopfd >= 0) {
+        ret = event_add_fd(&p->events, p->stopfd, EVENT_STOP);
+    }
+    for (int i = 0; i < p->count && ret == 0; i++) {
+        p->pending++;
+        ret = resolver_forward(p->resolver, p->shard, p->targets[i].hostname, opts->family, i);
+    }
+    if (ret != 0) {
+        fprintf(stderr, "ft_ping: cannot start name resolution\n");
+        ret = 1;
+    }
+
+    p->start_ns = monotonic_ns();
+    start_send_timer(p, p->start_ns);
+    if (ret == 0) {
+        ret = collect_resolved(p);
+    }
+
+    /* Main ping loop: sleep until a reply, a send tick, an answer or an expiry */
+    while (g_running && ret == 0 && (p->pending > 0 || p->active_count > 0) && !search_finished(p)) {
+        ready = event_wait(&p->events, loop_timeout_ms(p, monotonic_ns()));
+        if (ready & EVENT_STOP) {
+            break;
+        }
+
+        /* Bring newly resolved targets into the rotation */
+        if (ready & EVENT_DNS) {
+            ret = collect_resolved(p);
+        }
+
+        /* Error queues first: transmit stamps for the replies of this
+           wakeup, and ICMP errors, which then no longer fail a send */
+        for (int i = 0; i < ENDPOINT_COUNT; i++) {
+            if (ready & EVENT_ERRQUEUE(i)) {
+                receive_error_queue(p, &p->endpoints[i]);
+            }
+        }
+
+        /* Send on a fixed schedule, independent of outstanding replies */
+        if ((ready & EVENT_TIMER) && !opts->flood && !opts->trace_hops && !opts->pmtu_search) {
+            send_due_probes(p, monotonic_ns());
+        }
+
+        /* Match whatever replies have arrived */
+        for (int i = 0; i < ENDPOINT_COUNT; i++) {
+            if (ready & EVENT_SOCKET(i)) {
+                receive_replies(p, &p->endpoints[i]);
+            }
+        }
+
+        /* Retire probes whose timeout has elapsed */
+        expire_probes(p, monotonic_ns());
+
+        /* Searches whose round is over send the next one */
+        send_pmtu_rounds(p, monotonic_ns());
+
+        /* Refill freed slots at once in flood mode, or follow the adaptive rate */
+        if (opts->flood) {
+            send_flood_probes(p, monotonic_ns());
+        } else {
+            adapt_rate(p, monotonic_ns());
+        }
+
+        /* Refresh what the metrics endpoint serves */
+        if (p->metrics && monotonic_ns() >= p->metrics_next_ns) {
+            metrics_publish(p->metrics, p->stats);
+            p->metrics_next_ns = monotonic_ns() + METRICS_PUBLISH_MS * NSEC_PER_MSEC;
+        }
+    }
+
+    /* Every name of the shard failed to resolve */
+    if (ret == 0 && p->pending == 0 && p->active_count == 0) {
+        ret = ERR_ADDR;
+    }
+
+    /* Paths and searches cut short by an interrupt are reported as far as they got */
+    for (int i = 0; opts->trace_hops && i < p->active_count; i++) {
+        trace_report(p, p->active[i], monotonic_ns(), true);
+    }
+    for (int i = 0; opts->pmtu_search && i < p->active_count; i++) {
+        pmtu_report(p, p->active[i], monotonic_ns(), true);
+    }
+
+    keep_probed_stats(p);
+
+    close_endpoints(p);
+    event_free(&p->events);
+
+    return ret;
+}
+
+/**
+ * Pin the calling thread to one of the CPUs the process may run on
+ * Shards are spread round-robin over the allowed CPUs.
+ *
+ * @param shard Position of the shard
+ */
+static void pin_shard(int shard)
+{
+    cpu_set_t allowed, one;
+    int cpu, nth;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        return;
+    }
+    nth = shard % CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && nth-- == 0) {
+            break;
+        }
+    }
+
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+}
+
+/**
+ * Thread of one shard
+ * A shard that fails stops the whole run rather than leave a partial one.
+ *
+ * @param arg Pinger state of the shard
+ * @return NULL
+ */
+static void *shard_main(void *arg)
+{
+    t_pinger *p = arg;
+    uint64_t one = 1;
+
+    pin_shard(p->shard);
+    p->status = run_pinger(p);
+    if (p->status != 0 && p->status != ERR_ADDR) {
+        if (write(p->stopfd, &one, sizeof(one)) < 0) {
+            perror("write eventfd");
+        }
+    }
+    if (write(p->donefd, &one, sizeof(one)) < 0) {
+        perror("write eventfd");
+    }
+
+    return NULL;
+}
 
-        /* Increment sequence number */
-        seq++;
+/**
+ * Run every shard on its own thread and wait for all of them
+ * SIGINT and SIGTERM are taken through a signalfd by this thread, which
+ * then wakes every shard at once through the shared stop descriptor. That
+ * eventfd is never read, so it stays readable until every shard has seen
+ * it; no thread writes g_running.
+ *
+ * @param shards Pinger state of every shard
+ * @param count Number of shards
+ * @return 0 on success, -1 if the threads could not be started
+ */
+static int run_shards(t_pinger *shards, int count)
+{
+    struct pollfd fds[2];
+    struct signalfd_siginfo info;
+    sigset_t blocked, saved;
+    uint64_t value, one = 1;
+    int stopfd, donefd, sigfd, started, done;
 
-        /* Wait before sending next packet (while checking for interrupt) */
-        gettimeofday(&wait_time, NULL);
-        wait_time.tv_sec += DEFAULT_INTERVAL;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, &saved);
 
-        while (g_running) {
-            struct timeval current_time;
-            gettimeofday(&current_time, NULL);
+    stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    donefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sigfd = signalfd(-1, &blocked, SFD_NONBLOCK | SFD_CLOEXEC);
+    started = 0;
+    if (stopfd < 0 || donefd < 0 || sigfd < 0) {
+        perror("eventfd");
+    }
 
-            /* Calculate time difference */
-            if (current_time.tv_sec > wait_time.tv_sec ||
-                (current_time.tv_sec == wait_time.tv_sec &&
-                 current_time.tv_usec >= wait_time.tv_usec)) {
-                break; /* Time to send next packet */
+    while (stopfd >= 0 && donefd >= 0 && sigfd >= 0 && started < count) {
+        shards[started].stopfd = stopfd;
+        shards[started].donefd = donefd;
+        if (pthread_create(&shards[started].thread, NULL, shard_main, &shards[started]) != 0) {
+            fprintf(stderr, "ft_ping: cannot start shard threads\n");
+            if (write(stopfd, &one, sizeof(one)) < 0) {
+                perror("write eventfd");
             }
+            break;
+        }
+        started++;
+    }
 
-            /* Sleep for a short time */
-            usleep(10000); /* 10ms */
+    /* Wait for every shard to return, relaying a stop request to all */
+    fds[0] = (struct pollfd){.fd = sigfd, .events = POLLIN};
+    fds[1] = (struct pollfd){.fd = donefd, .events = POLLIN};
+    done = 0;
+    while (done < started) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (read(sigfd, &info, sizeof(info)) == sizeof(info)) {
+            if (write(stopfd, &one, sizeof(one)) < 0) {
+                perror("write eventfd");
+            }
+        }
+        if (read(donefd, &value, sizeof(value)) == sizeof(value)) {
+            done += value;
         }
     }
 
-    /* Print final statistics */
-    finish_ping(&stats);
+    for (int s = 0; s < started; s++) {
+        pthread_join(shards[s].thread, NULL);
+    }
+    if (sigfd >= 0) {
+        close(sigfd);
+    }
+    if (donefd >= 0) {
+        close(donefd);
+    }
+    if (stopfd >= 0) {
+        close(stopfd);
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    return started == count ? 0 : -1;
+}
+
+/**
+ * Draw the nonce that tags the probes of this run
+ * The kernel pool is not a hard requirement: the nonce only needs to
+ * differ between runs, so the clock and pid do if it is unavailable.
+ *
+ * @return Nonce
+ */
+static uint32_t draw_nonce(void)
+{
+    uint32_t nonce;
 
-    /* Free allocated memory */
-    if (stats.hostname) {
-        free(stats.hostname);
+    if (getrandom(&nonce, sizeof(nonce), GRND_NONBLOCK) == sizeof(nonce)) {
+        return nonce;
     }
+    return (uint32_t)(realtime_ns() ^ ((int64_t)getpid() << 16));
+}
+
+/**
+ * Start pinging the targets
+ * With -T the target list is cut into consecutive slices, one per shard.
+ * Each shard runs on its own thread, pinned to a CPU, with its own
+ * sockets and echo identifiers, so replies are steered to it by the
+ * kernel and the hot path shares nothing. Results are merged at the end.
+ *
+ * @param opts Options structure
+ * @return Exit code
+ */
+int start_ping(t_options *opts)
+{
+    t_capture capture;
+    t_metrics metrics;
+    t_output output;
+    t_pinger *shards;
+    int64_t start_ns, elapsed_ns;
+    t_resolver *resolver;
+    int count, ret, first, last;
 
-    /* Close socket */
-    close(sockfd);
+    count = opts->shards < opts->target_count ? opts->shards : opts->target_count;
+    if (count < 1) {
+        count = 1;
+    }
+    opts->nonce = draw_nonce();
 
-    return 0;
+    /* Allocate per-target state and statistics, one slice per shard */
+    shards = calloc(count, sizeof(t_pinger));
+    if (!shards) {
+        fprintf(stderr, "ft_ping: memory allocation failed\n");
+        return 1;
+    }
+    for (int s = 0; s < count; s++) {
+        first = (int)((long)opts->target_count * s / count);
+        last = (int)((long)opts->target_count * (s + 1) / count);
+        if (init_pinger(&shards[s], opts, s, &opts->targets[first], last - first) < 0) {
+            fprintf(stderr, "ft_ping: memory allocation failed\n");
+            free_shards(shards, s);
+            return 1;
+        }
+        shards[s].output = &output;
+        shards[s].stopfd = -1;
+        shards[s].donefd = -1;
+    }
+
+    /* Every probe is recorded to the capture file too, if one was asked for */
+    if (opts->capture_file && capture_open(&capture, opts, count) < 0) {
+        free_shards(shards, count);
+        return 1;
+    }
+
+    /* Scrapes are served from snapshots the shards publish as they go */
+    if (opts->metrics_endpoint && metrics_start(&metrics, opts, shards, count) < 0) {
+        if (opts->capture_file) {
+            capture_close(&capture);
+        }
+        free_shards(shards, count);
+        return 1;
+    }
+
+    /* Replies are printed by a thread of their own, off the receive path */
+    format_begin(opts);
+    if (output_start(&output, opts, count) < 0) {
+        if (opts->metrics_endpoint) {
+            metrics_stop(&metrics);
+        }
+        if (opts->capture_file) {
+            capture_close(&capture);
+        }
+        free_shards(shards, count);
+        return 1;
+    }
+    for (int s = 0; s < count; s++) {
+        shards[s].ring = &output.rings[s];
+        shards[s].capture = opts->capture_file ? &capture : NULL;
+    }
+
+    /* One resolver and cache serve every shard, so no name is looked up twice */
+    resolver = resolver_create(DNS_THREADS, count);
+    for (int s = 0; s < count; s++) {
+        shards[s].resolver = resolver;
+    }
+
+    start_ns = monotonic_ns();
+    if (!resolver) {
+        shards[0].status = 1;
+    } else if (count == 1) {
+        shards[0].status = run_pinger(&shards[0]);
+    } else if (run_shards(shards, count) < 0) {
+        shards[0].status = 1;
+    }
+    elapsed_ns = monotonic_ns() - start_ns;
+    print_output_stats(output_stop(&output));
+    if (opts->metrics_endpoint) {
+        metrics_stop(&metrics);
+    }
+    if (opts->capture_file) {
+        capture_close(&capture);
+    }
+
+    /* A failed shard fails the run; unknown hosts only if none was probed */
+    ret = ERR_ADDR;
+    for (int s = 0; s < count; s++) {
+        if (shards[s].status != 0 && shards[s].status != ERR_ADDR) {
+            ret = shards[s].status;
+            break;
+        }
+        if (shards[s].status == 0) {
+            ret = 0;
+        }
+    }
+    if (ret == 0) {
+        print_final_stats(shards, count, elapsed_ns);
+    }
+
+    /* It outlives the run while a lookup is stuck; the last worker frees it */
+    if (resolver) {
+        resolver_destroy(resolver);
+    }
+    free_shards(shards, count);
+
+    return ret;
 }
 
 /**
@@ -140,6 +1876,7 @@ int start_ping(t_options *opts)
 void finish_ping(t_ping_stats *stats)
 {
     double packet_loss;
+    int errors;
 
     /* Calculate packet loss percentage */
     if (stats->packets_sent > 0) {
@@ -147,22 +1884,39 @@ void finish_ping(t_ping_stats *stats)
     } else {
         packet_loss = 0.0;
     }
+    errors = 0;
+    for (int i = 0; i < ICMP_ERR_KINDS; i++) {
+        errors += stats->errors[i];
+    }
 
     /* Print statistics in a format matching inetutils-2.0 */
     printf("\n--- %s ping statistics ---\n",
            stats->hostname ? stats->hostname : "ping");
 
-    printf("%d packets transmitted, %d received, %.1f%% packet loss, time %dms\n",
-           stats->packets_sent,
-           stats->packets_received,
-           packet_loss,
-           (int)stats->total_time);
+    /* ICMP errors are counted the way iputils does */
+    printf("%ld packets transmitted, %ld received, ", stats->packets_sent, stats->packets_received);
+    if (stats->replies[REPLY_DUPLICATE] > 0) {
+        printf("+%d duplicates, ", stats->replies[REPLY_DUPLICATE]);
+    }
+    if (stats->replies[REPLY_CORRUPTED] > 0) {
+        printf("+%d corrupted, ", stats->replies[REPLY_CORRUPTED]);
+    }
+    if (stats->replies[REPLY_MISMATCHED] > 0) {
+        printf("+%d mismatched, ", stats->replies[REPLY_MISMATCHED]);
+    }
+    if (errors > 0) {
+        printf("+%d errors, ", errors);
+    }
+    printf("%.1f%% packet loss, time %dms\n", packet_loss, (int)stats->total_time);
+    print_error_counts(stats->errors);
 
     /* Print round-trip statistics if packets were received */
     if (stats->packets_received > 0) {
-        printf("rtt min/avg/max/mdev = %.3f/%.3f/%.3f/0.000 ms\n",
+        printf("rtt min/avg/max/mdev = %.3f/%.3f/%.3f/%.3f ms\n",
                stats->min_time,
                stats->total_time / stats->packets_received,
-               stats->max_time);
+               stats->max_time,
+               stats_mdev(stats));
+        print_rtt_quantiles(stats->histogram, stats->packets_received, stats->min_time, stats->max_time);
     }
 }
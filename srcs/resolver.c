@@ -0,0 +1,501 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Hash a cache key (FNV-1a)
+ *
+ * @param key Cache key
+ * @return Hash value
+ */
+static uint32_t hash_key(const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*key) {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Find the cache slot of a key, or the free slot it would take
+ *
+ * @param cache Cache slots
+ * @param size Number of slots (power of two)
+ * @param key Cache key
+ * @return Slot holding the key, or the first free slot on its probe path
+ */
+static t_dns_entry *cache_slot(t_dns_entry *cache, int size, const char *key)
+{
+    uint32_t i;
+
+    i = hash_key(key) & (size - 1);
+    while (cache[i].key && strcmp(cache[i].key, key) != 0) {
+        i = (i + 1) & (size - 1);
+    }
+
+    return &cache[i];
+}
+
+/**
+ * Double the cache once it is half full
+ * Entries are never removed, only retried, so there are no tombstones.
+ *
+ * @param r Resolver (locked)
+ * @return 0 on success, -1 on error
+ */
+static int cache_grow(t_resolver *r)
+{
+    t_dns_entry *cache;
+    int size;
+
+    if (r->cache_used * 2 < r->cache_size) {
+        return 0;
+    }
+
+    size = r->cache_size * 2;
+    cache = calloc(size, sizeof(t_dns_entry));
+    if (!cache) {
+        return -1;
+    }
+    for (int i = 0; i < r->cache_size; i++) {
+        if (r->cache[i].key) {
+            *cache_slot(cache, size, r->cache[i].key) = r->cache[i];
+        }
+    }
+
+    free(r->cache);
+    r->cache = cache;
+    r->cache_size = size;
+    return 0;
+}
+
+/**
+ * Copy a cached answer into a job
+ *
+ * @param job Job to answer
+ * @param entry Cache entry holding the answer
+ */
+static void answer_job(t_dns_job *job, t_dns_entry *entry)
+{
+    job->status = entry->status;
+    if (entry->status == 0) {
+        if (job->kind == DNS_FORWARD) {
+            job->addr = entry->addr;
+        }
+        job->result = strdup(entry->result);
+        if (!job->result) {
+            job->status = -1;
+        }
+    }
+}
+
+/**
+ * Hand an answered job back to the ping loop of the shard that asked
+ *
+ * @param r Resolver (locked)
+ * @param job Answered job
+ */
+static void complete_job(t_resolver *r, t_dns_job *job)
+{
+    t_dns_inbox *inbox;
+    uint64_t one = 1;
+
+    inbox = &r->inboxes[job->inbox];
+    job->next = inbox->done;
+    inbox->done = job;
+    if (write(inbox->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("write eventfd");
+    }
+}
+
+/**
+ * Release a list of jobs
+ *
+ * @param job First job of the list
+ */
+static void free_jobs(t_dns_job *job)
+{
+    t_dns_job *next;
+
+    while (job) {
+        next = job->next;
+        dns_job_free(job);
+        job = next;
+    }
+}
+
+/**
+ * Release the resolver once no worker uses it anymore
+ *
+ * @param r Resolver
+ */
+static void resolver_release(t_resolver *r)
+{
+    for (int i = 0; i < r->cache_size; i++) {
+        free(r->cache[i].key);
+        free(r->cache[i].result);
+        free_jobs(r->cache[i].waiters);
+    }
+    free(r->cache);
+    free_jobs(r->queue_head);
+    for (int i = 0; i < r->inbox_count; i++) {
+        free_jobs(r->inboxes[i].done);
+        if (r->inboxes[i].eventfd >= 0) {
+            close(r->inboxes[i].eventfd);
+        }
+    }
+    free(r->inboxes);
+    pthread_cond_destroy(&r->wake);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+/**
+ * Run the lookup a job asks for
+ * This blocks for as long as the name servers take, which is why it only
+ * ever runs on a worker thread.
+ *
+ * @param job Job to run
+ */
+static void run_lookup(t_dns_job *job)
+{
+    if (job->kind == DNS_FORWARD) {
+        job->status = resolve_hostname(job->name, job->family, &job->addr, &job->result);
+    } else {
+        job->result = get_hostname_from_ip(&job->addr);
+        job->status = job->result ? 0 : -1;
+    }
+}
+
+/**
+ * Store the answer of a lookup and complete every job waiting for it
+ * Answers, failures included, are kept for the rest of the run: a target
+ * is resolved once, so an answer is only ever reused by another target of
+ * the same name, in whichever shard.
+ *
+ * @param r Resolver (locked)
+ * @param job Job the worker ran
+ */
+static void store_answer(t_resolver *r, t_dns_job *job)
+{
+    t_dns_entry *entry;
+    t_dns_job *waiter, *next;
+
+    /* Out of memory leaves a success with no answer: the next job retries */
+    entry = cache_slot(r->cache, r->cache_size, job->key);
+    entry->pending = false;
+    entry->status = job->status;
+    entry->addr = job->addr;
+    entry->result = job->result ? strdup(job->result) : NULL;
+
+    for (waiter = entry->waiters; waiter; waiter = next) {
+        next = waiter->next;
+        waiter->status = job->status;
+        waiter->addr = job->addr;
+        waiter->result = job->result ? strdup(job->result) : NULL;
+        if (job->status == 0 && !waiter->result) {
+            waiter->status = -1;
+        }
+        complete_job(r, waiter);
+    }
+    entry->waiters = NULL;
+
+    complete_job(r, job);
+}
+
+/**
+ * Worker thread: run queued lookups until the resolver stops
+ * The last worker out frees the resolver, so a lookup stuck on a slow
+ * name server never delays the end of the run.
+ *
+ * @param arg Resolver
+ * @return NULL
+ */
+static void *resolver_worker(void *arg)
+{
+    t_resolver *r = arg;
+    t_dns_job *job;
+    bool last;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stopping) {
+        job = r->queue_head;
+        if (!job) {
+            pthread_cond_wait(&r->wake, &r->lock);
+            continue;
+        }
+        r->queue_head = job->next;
+        if (!r->queue_head) {
+            r->queue_tail = NULL;
+        }
+
+        pthread_mutex_unlock(&r->lock);
+        run_lookup(job);
+        pthread_mutex_lock(&r->lock);
+
+        store_answer(r, job);
+    }
+    last = --r->threads == 0;
+    pthread_mutex_unlock(&r->lock);
+
+    if (last) {
+        resolver_release(r);
+    }
+    return NULL;
+}
+
+/**
+ * Start the resolver and its worker threads
+ * Workers block every signal, so SIGINT always reaches the ping loop.
+ * One resolver serves every shard; each collects its answers from an
+ * inbox of its own.
+ *
+ * @param threads Number of worker threads
+ * @param inboxes Number of inboxes, one per shard
+ * @return Resolver, or NULL on error
+ */
+t_resolver *resolver_create(int threads, int inboxes)
+{
+    t_resolver *r;
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t all, saved;
+
+    r = calloc(1, sizeof(t_resolver));
+    if (!r) {
+        return NULL;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    r->cache = calloc(DNS_CACHE_MIN, sizeof(t_dns_entry));
+    r->inboxes = calloc(inboxes, sizeof(t_dns_inbox));
+    if (!r->cache || !r->inboxes) {
+        resolver_release(r);
+        return NULL;
+    }
+    r->cache_size = DNS_CACHE_MIN;
+    r->inbox_count = inboxes;
+    for (int i = 0; i < inboxes; i++) {
+        r->inboxes[i].eventfd = -1;
+    }
+    for (int i = 0; i < inboxes; i++) {
+        r->inboxes[i].eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (r->inboxes[i].eventfd < 0) {
+            perror("eventfd");
+            resolver_release(r);
+            return NULL;
+        }
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&thread, &attr, resolver_worker, r) != 0) {
+            break;
+        }
+        r->threads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (r->threads == 0) {
+        fprintf(stderr, "ft_ping: cannot start resolver threads\n");
+        resolver_release(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * Stop the resolver
+ * Idle workers exit at once; a worker still waiting on a name server
+ * exits when its lookup returns, and the last one frees the resolver.
+ *
+ * @param r Resolver
+ */
+void resolver_destroy(t_resolver *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->stopping = true;
+    pthread_cond_broadcast(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/**
+ * Answer a job from the cache, join a lookup in progress, or queue it
+ *
+ * @param r Resolver
+ * @param job Job to run
+ * @return 0 on success, -1 on error (the job is freed)
+ */
+static int resolver_submit(t_resolver *r, t_dns_job *job)
+{
+    t_dns_entry *entry;
+
+    pthread_mutex_lock(&r->lock);
+    if (cache_grow(r) < 0) {
+        pthread_mutex_unlock(&r->lock);
+        dns_job_free(job);
+        return -1;
+    }
+
+    entry = cache_slot(r->cache, r->cache_size, job->key);
+    if (entry->key && entry->pending) {
+        /* Same lookup already running: share its answer */
+        job->next = entry->waiters;
+        entry->waiters = job;
+        r->hits++;
+    } else if (entry->key && (entry->status != 0 || entry->result)) {
+        answer_job(job, entry);
+        complete_job(r, job);
+        r->hits++;
+    } else {
+        if (!entry->key) {
+            entry->key = strdup(job->key);
+            if (!entry->key) {
+                pthread_mutex_unlock(&r->lock);
+                dns_job_free(job);
+                return -1;
+            }
+            r->cache_used++;
+        }
+        free(entry->result);
+        entry->result = NULL;
+        entry->pending = true;
+
+        job->next = NULL;
+        if (r->queue_tail) {
+            r->queue_tail->next = job;
+        } else {
+            r->queue_head = job;
+        }
+        r->queue_tail = job;
+        r->lookups++;
+        pthread_cond_signal(&r->wake);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    return 0;
+}
+
+/**
+ * Resolve a target name in the background
+ * Numeric addresses are parsed on the spot and never reach a worker.
+ *
+ * @param r Resolver
+ * @param inbox Shard the answer goes back to
+ * @param name Hostname or IP address string
+ * @param family AF_INET, AF_INET6, or AF_UNSPEC for either
+ * @param target Position of the target, returned with the answer
+ * @return 0 on success, -1 on error
+ */
+int resolver_forward(t_resolver *r, int inbox, const char *name, int family, int target)
+{
+    t_dns_job *job;
+
+    job = calloc(1, sizeof(t_dns_job));
+    if (!job) {
+        return -1;
+    }
+    job->kind = DNS_FORWARD;
+    job->inbox = inbox;
+    job->target = target;
+    job->family = family;
+
+    if (resolve_numeric(name, family, &job->addr, &job->result) == 0) {
+        pthread_mutex_lock(&r->lock);
+        complete_job(r, job);
+        pthread_mutex_unlock(&r->lock);
+        return 0;
+    }
+
+    job->name = strdup(name);
+    if (!job->name || asprintf(&job->key, "%d:%s", family, name) < 0) {
+        job->key = NULL;
+        dns_job_free(job);
+        return -1;
+    }
+
+    return resolver_submit(r, job);
+}
+
+/**
+ * Look up the name of an address in the background
+ *
+ * @param r Resolver
+ * @param inbox Shard the answer goes back to
+ * @param addr Address to look up
+ * @param target Position of the target, returned with the answer
+ * @return 0 on success, -1 on error
+ */
+int resolver_reverse(t_resolver *r, int inbox, t_sockaddr *addr, int target)
+{
+    t_dns_job *job;
+    char ip[INET6_ADDRSTRLEN];
+
+    job = calloc(1, sizeof(t_dns_job));
+    if (!job) {
+        return -1;
+    }
+    job->kind = DNS_REVERSE;
+    job->inbox = inbox;
+    job->target = target;
+    job->addr = *addr;
+    if (asprintf(&job->key, "ptr:%s", sockaddr_str(addr, ip, sizeof(ip))) < 0) {
+        job->key = NULL;
+        dns_job_free(job);
+        return -1;
+    }
+
+    return resolver_submit(r, job);
+}
+
+/**
+ * Take every answered job of a shard, in the order they were answered
+ *
+ * @param r Resolver
+ * @param inbox Shard collecting its answers
+ * @return List of jobs linked by next (free each with dns_job_free), or NULL
+ */
+t_dns_job *resolver_collect(t_resolver *r, int inbox)
+{
+    t_dns_job *done, *job, *next;
+    uint64_t count;
+
+    if (read(r->inboxes[inbox].eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("read eventfd");
+    }
+
+    pthread_mutex_lock(&r->lock);
+    done = r->inboxes[inbox].done;
+    r->inboxes[inbox].done = NULL;
+    pthread_mutex_unlock(&r->lock);
+
+    /* The list was built newest first */
+    job = NULL;
+    while (done) {
+        next = done->next;
+        done->next = job;
+        job = done;
+        done = next;
+    }
+
+    return job;
+}
+
+/**
+ * Release a job
+ *
+ * @param job Job to release
+ */
+void dns_job_free(t_dns_job *job)
+{
+    free(job->key);
+    free(job->name);
+    free(job->result);
+    free(job);
+}
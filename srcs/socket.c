@@ -1,39 +1,117 @@
 #include "../includes/ft_ping.h"
 
 /**
- * Create a raw socket for ICMP
+ * Create a socket for ICMP or ICMPv6
+ * Linux ping sockets (SOCK_DGRAM) are tried first: they need no privilege
+ * when net.ipv4.ping_group_range covers our group, and the kernel only
+ * hands us replies to our own identifier. Raw sockets are the fallback.
  *
+ * @param family AF_INET or AF_INET6
+ * @param kind Kind of socket created, SOCKET_DGRAM or SOCKET_RAW (output)
  * @return Socket file descriptor or -1 on error
  */
-int create_socket(void)
+int create_socket(int family, int *kind)
 {
-    int sockfd;
+    int sockfd, protocol;
+
+    protocol = family == AF_INET6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+    sockfd = socket(family, SOCK_DGRAM, protocol);
+    if (sockfd >= 0) {
+        *kind = SOCKET_DGRAM;
+        return sockfd;
+    }
 
     /* Create raw socket for ICMP protocol */
-    sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    sockfd = socket(family, SOCK_RAW, protocol);
     if (sockfd < 0) {
-        perror("socket");
+        if (errno == EPERM || errno == EACCES) {
+            fprintf(stderr, "ft_ping: socket: Operation not permitted "
+                    "(run as root or allow ping sockets with net.ipv4.ping_group_range)\n");
+        } else {
+            perror("socket");
+        }
         return -1;
     }
 
+    *kind = SOCKET_RAW;
     return sockfd;
 }
 
+/**
+ * Get the echo identifier our replies will carry
+ * A ping socket owns an identifier the kernel writes into every request,
+ * so bind to let it pick one and read it back. Raw sockets use the PID,
+ * offset by the shard so each shard's filter only lets its own replies in.
+ *
+ * @param sockfd Socket file descriptor
+ * @param family AF_INET or AF_INET6
+ * @param kind Kind of socket
+ * @param shard Position of the shard owning the socket
+ * @param ident Echo identifier in host byte order (output)
+ * @return 0 on success, -1 on error
+ */
+int socket_ident(int sockfd, int family, int kind, int shard, uint16_t *ident)
+{
+    t_sockaddr addr;
+    socklen_t len;
+
+    if (kind == SOCKET_RAW) {
+        *ident = (getpid() + shard) & 0xFFFF; /* Use process ID as identifier */
+        return 0;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sa.sa_family = family;
+    if (bind(sockfd, &addr.sa, sockaddr_len(&addr)) < 0) {
+        perror("bind");
+        return -1;
+    }
+
+    len = sizeof(addr);
+    if (getsockname(sockfd, &addr.sa, &len) < 0) {
+        perror("getsockname");
+        return -1;
+    }
+    *ident = ntohs(family == AF_INET6 ? addr.v6.sin6_port : addr.v4.sin_port);
+
+    return 0;
+}
+
 /**
  * Set up socket options
+ * DEFAULT_TTL is only the default: a probe may carry its own TTL as
+ * ancillary data. The TTL replies arrive with is asked for too, since
+ * only raw IPv4 sockets see the IP header it is in.
  *
  * @param sockfd Socket file descriptor
+ * @param family AF_INET or AF_INET6
  * @return 0 on success, -1 on error
  */
-int setup_socket(int sockfd)
+int setup_socket(int sockfd, int family)
 {
     int ttl = DEFAULT_TTL;
+    int on = 1;
     struct timeval timeout;
 
-    /* Set TTL (Time-To-Live) */
-    if (setsockopt(sockfd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
-        perror("setsockopt IP_TTL");
-        return -1;
+    /* Set TTL (Time-To-Live), the hop limit for IPv6 */
+    if (family == AF_INET6) {
+        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl)) < 0) {
+            perror("setsockopt IPV6_UNICAST_HOPS");
+            return -1;
+        }
+        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on)) < 0) {
+            perror("setsockopt IPV6_RECVHOPLIMIT");
+            return -1;
+        }
+    } else {
+        if (setsockopt(sockfd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
+            perror("setsockopt IP_TTL");
+            return -1;
+        }
+        if (setsockopt(sockfd, IPPROTO_IP, IP_RECVTTL, &on, sizeof(on)) < 0) {
+            perror("setsockopt IP_RECVTTL");
+            return -1;
+        }
     }
 
     /* Set receive timeout */
@@ -46,3 +124,115 @@ int setup_socket(int sockfd)
 
     return 0;
 }
+
+/**
+ * Have ICMP errors about our requests queued on a ping socket
+ * Raw sockets read errors like any other ICMP message; ping sockets only
+ * see the ones the kernel matched to their identifier, on the error queue,
+ * once IP_RECVERR (IPV6_RECVERR) is set.
+ *
+ * @param sockfd Ping socket file descriptor
+ * @param family AF_INET or AF_INET6
+ * @return 0 on success, -1 on error
+ */
+int enable_icmp_errors(int sockfd, int family)
+{
+    int on = 1;
+
+    if (family == AF_INET6) {
+        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVERR, &on, sizeof(on)) < 0) {
+            perror("setsockopt IPV6_RECVERR");
+            return -1;
+        }
+    } else if (setsockopt(sockfd, IPPROTO_IP, IP_RECVERR, &on, sizeof(on)) < 0) {
+        perror("setsockopt IP_RECVERR");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Choose how the socket treats the Don't Fragment bit (IPv4) or
+ * fragmentation at the source (IPv6)
+ * IP_PMTUDISC_DO sets DF and refuses sends above the known path MTU;
+ * IP_PMTUDISC_PROBE sets DF but ignores what the kernel learnt, so every
+ * size really goes out; IP_PMTUDISC_DONT lets routers fragment.
+ *
+ * @param sockfd Socket file descriptor
+ * @param family AF_INET or AF_INET6
+ * @param mode IP_PMTUDISC_* (the IPv6 values are the same)
+ * @return 0 on success, -1 on error
+ */
+int set_mtu_discovery(int sockfd, int family, int mode)
+{
+    if (family == AF_INET6) {
+        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &mode, sizeof(mode)) < 0) {
+            perror("setsockopt IPV6_MTU_DISCOVER");
+            return -1;
+        }
+    } else if (setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) < 0) {
+        perror("setsockopt IP_MTU_DISCOVER");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Get the MTU of the route to an address, as the kernel knows it
+ * A connected UDP socket is the only way to ask for one destination
+ * without sending anything: the answer is the interface MTU, or a path
+ * MTU learnt earlier.
+ *
+ * @param addr Destination
+ * @return MTU, or -1 if there is no route or on error
+ */
+int route_mtu(t_sockaddr *addr)
+{
+    t_sockaddr dest;
+    socklen_t len;
+    int sockfd, mtu;
+
+    sockfd = socket(addr->sa.sa_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+    dest = *addr;
+    if (dest.sa.sa_family == AF_INET6) {
+        dest.v6.sin6_port = htons(DISCARD_PORT);
+    } else {
+        dest.v4.sin_port = htons(DISCARD_PORT);
+    }
+    len = sizeof(mtu);
+    if (connect(sockfd, &dest.sa, sockaddr_len(&dest)) < 0 ||
+        getsockopt(sockfd, dest.sa.sa_family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP,
+                   dest.sa.sa_family == AF_INET6 ? IPV6_MTU : IP_MTU, &mtu, &len) < 0) {
+        mtu = -1;
+    }
+    close(sockfd);
+
+    return mtu;
+}
+
+/**
+ * Get the TTL (hop limit) a reply arrived with from its ancillary data
+ *
+ * @param msg Received message, with IP_RECVTTL or IPV6_RECVHOPLIMIT set
+ * @return TTL, or 0 if the message does not carry it
+ */
+int read_reply_ttl(struct msghdr *msg)
+{
+    struct cmsghdr *cmsg;
+    int ttl;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TTL) ||
+            (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT)) {
+            memcpy(&ttl, CMSG_DATA(cmsg), sizeof(ttl));
+            return ttl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Find the histogram bucket of a value
+ * Values below HIST_SUB_BUCKETS get one bucket each; above that, every
+ * power of two is split into HIST_SUB_BUCKETS / 2 equal buckets, which
+ * bounds the relative error of a bucket to 1 / (HIST_SUB_BUCKETS / 2).
+ *
+ * @param value Value in nanoseconds
+ * @return Bucket index
+ */
+int histogram_index(uint64_t value)
+{
+    int msb, level, index;
+
+    if (value < HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    msb = 63 - __builtin_clzll(value);
+    level = msb - HIST_SUB_BITS + 1;
+    index = level * (HIST_SUB_BUCKETS / 2) + (int)(value >> level);
+
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+/**
+ * Get the value a bucket stands for (the middle of its range)
+ *
+ * @param index Bucket index
+ * @return Value in nanoseconds
+ */
+uint64_t histogram_value(int index)
+{
+    int level;
+    uint64_t sub;
+
+    if (index < HIST_SUB_BUCKETS) {
+        return index;
+    }
+
+    level = index / (HIST_SUB_BUCKETS / 2) - 1;
+    sub = index - level * (HIST_SUB_BUCKETS / 2);
+
+    return (sub << level) + ((1ULL << level) >> 1);
+}
+
+/**
+ * Find the value below which a fraction of the samples fall
+ * A bucket stands for its midpoint, which can lie past the samples it
+ * holds, so the result is clamped to the smallest and largest seen.
+ *
+ * @param histogram Bucket counts (HIST_BUCKETS entries)
+ * @param total Number of samples recorded
+ * @param quantile Fraction between 0 and 1
+ * @param min Smallest sample recorded, in milliseconds
+ * @param max Largest sample recorded, in milliseconds
+ * @return Value in milliseconds
+ */
+double histogram_quantile(uint32_t *histogram, long total, double quantile, double min, double max)
+{
+    double value;
+
+    long rank, seen;
+
+    if (total == 0) {
+        return 0.0;
+    }
+
+    /* Rank of the sample we are looking for, counting from one */
+    rank = (long)(quantile * total + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    seen = 0;
+    value = histogram_value(HIST_BUCKETS - 1) / (double)NSEC_PER_MSEC;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            value = histogram_value(i) / (double)NSEC_PER_MSEC;
+            break;
+        }
+    }
+
+    if (value < min) {
+        return min;
+    }
+    return value > max ? max : value;
+}
+
+/**
+ * Account for one round-trip time
+ * Keeps min/max/total, a running mean and sum of squared deviations
+ * (Welford's algorithm, numerically stable over millions of samples) and
+ * the quantile histogram.
+ *
+ * @param stats Statistics of the target
+ * @param rtt Round-trip time in milliseconds
+ */
+void update_stats(t_ping_stats *stats, double rtt)
+{
+    double delta;
+
+    stats->packets_received++;
+    stats->total_time += rtt;
+
+    if (stats->min_time < 0 || rtt < stats->min_time) {
+        stats->min_time = rtt;
+    }
+    if (rtt > stats->max_time) {
+        stats->max_time = rtt;
+    }
+
+    delta = rtt - stats->mean;
+    stats->mean += delta / stats->packets_received;
+    stats->m2 += delta * (rtt - stats->mean);
+
+    if (stats->histogram) {
+        stats->histogram[histogram_index(rtt > 0 ? rtt * NSEC_PER_MSEC : 0)]++;
+    }
+}
+
+/**
+ * Compute the mean deviation printed as mdev (population standard deviation)
+ *
+ * @param stats Statistics of the target
+ * @return Standard deviation in milliseconds
+ */
+double stats_mdev(t_ping_stats *stats)
+{
+    if (stats->packets_received == 0) {
+        return 0.0;
+    }
+    return sqrt(stats->m2 / stats->packets_received);
+}
+
+/**
+ * Merge the statistics of every target into one set of totals
+ * Counters and histograms are summed, min/max taken over the targets that
+ * answered, and the Welford moments combined pairwise (Chan et al.).
+ *
+ * @param merged Receives the totals; its histogram points at histogram
+ * @param histogram Storage for the merged histogram (HIST_BUCKETS entries)
+ * @param stats Per-target statistics
+ * @param count Number of targets
+ * @return Number of targets that answered at least once
+ */
+int merge_stats(t_ping_stats *merged, uint32_t *histogram, t_ping_stats *stats, int count)
+{
+    double delta;
+    long total;
+    int alive;
+
+    memset(merged, 0, sizeof(*merged));
+    memset(histogram, 0, HIST_BUCKETS * sizeof(*histogram));
+    merged->min_time = -1;
+    merged->histogram = histogram;
+
+    alive = 0;
+    for (int i = 0; i < count; i++) {
+        merged->packets_sent += stats[i].packets_sent;
+        if (stats[i].packets_received > 0) {
+            if (merged->min_time < 0 || stats[i].min_time < merged->min_time) {
+                merged->min_time = stats[i].min_time;
+            }
+            if (stats[i].max_time > merged->max_time) {
+                merged->max_time = stats[i].max_time;
+            }
+            total = merged->packets_received + stats[i].packets_received;
+            delta = stats[i].mean - merged->mean;
+            merged->mean += delta * stats[i].packets_received / total;
+            merged->m2 += stats[i].m2
+                + delta * delta * merged->packets_received * stats[i].packets_received / total;
+            merged->packets_received = total;
+            merged->total_time += stats[i].total_time;
+            alive++;
+        }
+        if (stats[i].histogram) {
+            for (int j = 0; j < HIST_BUCKETS; j++) {
+                histogram[j] += stats[i].histogram[j];
+            }
+        }
+        for (int j = 0; j < ICMP_ERR_KINDS; j++) {
+            merged->errors[j] += stats[i].errors[j];
+        }
+        for (int j = 0; j < REPLY_KINDS; j++) {
+            merged->replies[j] += stats[i].replies[j];
+        }
+    }
+    return alive;
+}
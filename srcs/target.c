@@ -0,0 +1,235 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Append a destination to the target list
+ * The name is resolved later, in the background, once pinging starts.
+ *
+ * @param opts Options structure holding the target list
+ * @param name Hostname or IP address string
+ * @return 0 on success, -1 on allocation error
+ */
+int add_target(t_options *opts, const char *name)
+{
+    t_target *target;
+    t_target *grown;
+    int capacity;
+
+    /* Grow the target array geometrically */
+    if (opts->target_count == opts->target_capacity) {
+        capacity = opts->target_capacity ? opts->target_capacity * 2 : 16;
+        grown = realloc(opts->targets, capacity * sizeof(t_target));
+        if (!grown) {
+            return -1;
+        }
+        opts->targets = grown;
+        opts->target_capacity = capacity;
+    }
+
+    target = &opts->targets[opts->target_count];
+    memset(target, 0, sizeof(t_target));
+    target->state = TARGET_PENDING;
+
+    /* Store original hostname for display, next to the others */
+    target->hostname = arena_strdup(&opts->hostnames, name);
+    if (!target->hostname) {
+        return -1;
+    }
+
+    opts->target_count++;
+    return 0;
+}
+
+/**
+ * Read destinations from a file, one per line
+ * Blank lines and lines starting with '#' are ignored.
+ *
+ * @param opts Options structure holding the target list
+ * @param path Path of the file ("-" for standard input)
+ * @return 0 on success, -1 if the file cannot be read or memory runs out
+ */
+int read_target_file(t_options *opts, const char *path)
+{
+    FILE *file;
+    char line[NI_MAXHOST];
+    char *name;
+    int ret;
+
+    file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "ft_ping: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    ret = 0;
+    while (fgets(line, sizeof(line), file)) {
+        /* Trim surrounding whitespace */
+        name = line + strspn(line, " \t");
+        name[strcspn(name, " \t\r\n")] = '\0';
+        if (name[0] == '\0' || name[0] == '#') {
+            continue;
+        }
+
+        ret = add_target(opts, name);
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    if (file != stdin) {
+        fclose(file);
+    }
+    return ret;
+}
+
+/**
+ * Get the index key of an address
+ * IPv4 addresses are mapped into IPv6 (::ffff:a.b.c.d), so both families
+ * share one index without colliding.
+ *
+ * @param addr Address structure
+ * @param key Index key (output)
+ */
+static void index_key(t_sockaddr *addr, struct in6_addr *key)
+{
+    if (addr->sa.sa_family == AF_INET6) {
+        *key = addr->v6.sin6_addr;
+        return;
+    }
+    memset(key, 0, sizeof(struct in6_addr));
+    key->s6_addr[10] = 0xFF;
+    key->s6_addr[11] = 0xFF;
+    memcpy(&key->s6_addr[12], &addr->v4.sin_addr, sizeof(struct in_addr));
+}
+
+/**
+ * Release every target
+ * Resolved names live in the arenas of the shards, released with them.
+ *
+ * @param opts Options structure holding the target list
+ */
+void free_targets(t_options *opts)
+{
+    arena_free(&opts->hostnames);
+    free(opts->targets);
+    opts->targets = NULL;
+    opts->target_count = 0;
+    opts->target_capacity = 0;
+}
+
+/**
+ * Hash an index key
+ * Both halves are folded and mixed (splitmix64 finalizer), so addresses
+ * differing in a single byte, or only in their IPv4 part, spread evenly.
+ *
+ * @param key Index key
+ * @return Hash
+ */
+static uint32_t index_hash(const struct in6_addr *key)
+{
+    uint64_t high, low, h;
+
+    memcpy(&high, &key->s6_addr[0], sizeof(high));
+    memcpy(&low, &key->s6_addr[8], sizeof(low));
+    h = high ^ (low * 0x9E3779B97F4A7C15ULL);
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return (uint32_t)(h ^ (h >> 31));
+}
+
+/**
+ * Get the number of index slots for a number of targets
+ * The index is kept at most half full, so a lookup seldom probes past
+ * the first slot.
+ *
+ * @param count Most targets indexed
+ * @return Number of slots (power of two)
+ */
+uint32_t index_slots(int count)
+{
+    uint32_t size;
+
+    size = 2;
+    while (size < 2 * (uint32_t)count) {
+        size <<= 1;
+    }
+    return size;
+}
+
+/**
+ * Prepare an empty index over caller-provided slots
+ *
+ * @param table Index to initialize
+ * @param slots Slot array, index_slots() entries
+ * @param size Number of slots (power of two)
+ */
+void index_init(t_target_table *table, t_target_index *slots, uint32_t size)
+{
+    table->slots = slots;
+    table->mask = size - 1;
+    for (uint32_t i = 0; i < size; i++) {
+        table->slots[i].target = INDEX_EMPTY;
+    }
+}
+
+/**
+ * Add a target to the index of targets by address
+ * The index is an open-addressing hash table of (address, position)
+ * pairs, so finding the target of a reply costs one hash and, most of
+ * the time, a single cache line, however many targets there are. The
+ * echo identifier needs no place in the key: each socket has its own,
+ * already checked when the reply was parsed. Targets join as their names
+ * resolve and never leave; replies are matched by source address, so an
+ * address can only be indexed once.
+ *
+ * @param table Index with room for one more entry
+ * @param addr Address of the target
+ * @param target Position of the target in the target array
+ * @return 0 on success, -1 if the address is already indexed
+ */
+int index_insert(t_target_table *table, t_sockaddr *addr, int target)
+{
+    t_target_index *slot;
+    struct in6_addr key;
+    uint32_t i;
+
+    index_key(addr, &key);
+    for (i = index_hash(&key) & table->mask;; i = (i + 1) & table->mask) {
+        slot = &table->slots[i];
+        if (slot->target == INDEX_EMPTY) {
+            break;
+        }
+        if (memcmp(&slot->addr, &key, sizeof(struct in6_addr)) == 0) {
+            return -1;
+        }
+    }
+
+    slot->addr = key;
+    slot->target = target;
+
+    return 0;
+}
+
+/**
+ * Find the target a reply came from
+ *
+ * @param table Index built by index_insert
+ * @param addr Source address of the reply
+ * @return Position in the target array or -1 if the address is not a target
+ */
+int find_target(t_target_table *table, t_sockaddr *addr)
+{
+    t_target_index *slot;
+    struct in6_addr key;
+    uint32_t i;
+
+    index_key(addr, &key);
+    for (i = index_hash(&key) & table->mask;; i = (i + 1) & table->mask) {
+        slot = &table->slots[i];
+        if (slot->target == INDEX_EMPTY) {
+            return -1;
+        }
+        if (memcmp(&slot->addr, &key, sizeof(struct in6_addr)) == 0) {
+            return slot->target;
+        }
+    }
+}
@@ -0,0 +1,171 @@
+#include "../includes/ft_ping.h"
+
+/**
+ * Read the monotonic clock
+ * Used for scheduling and as the RTT fallback, since it never jumps when
+ * NTP steps the wall clock.
+ *
+ * @return Nanoseconds since an arbitrary point
+ */
+int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * Read the wall clock, the domain of kernel software timestamps
+ *
+ * @return Nanoseconds since the epoch
+ */
+int64_t realtime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * Convert a timespec to nanoseconds
+ *
+ * @param ts Timestamp
+ * @return Nanoseconds, 0 if the timestamp is unset
+ */
+static int64_t timespec_ns(struct timespec *ts)
+{
+    return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/**
+ * Ask the kernel to timestamp sent and received packets
+ * SO_TIMESTAMPING gives software and, where the NIC has hardware
+ * timestamping enabled, hardware stamps for both directions. Receive
+ * stamps alone (SO_TIMESTAMPNS) are not asked for: with no kernel stamp of
+ * the send to pair them with, RTT uses the monotonic clock anyway.
+ *
+ * @param sockfd Socket file descriptor
+ * @return Mask of TIMESTAMP_TX and TIMESTAMP_RX, or -1 if unsupported
+ */
+int enable_timestamps(int sockfd)
+{
+    int flags;
+
+    flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+            SOF_TIMESTAMPING_SOFTWARE |
+            SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+            SOF_TIMESTAMPING_RAW_HARDWARE |
+            SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+        return TIMESTAMP_TX | TIMESTAMP_RX;
+    }
+
+    perror("setsockopt SO_TIMESTAMPING");
+    return -1;
+}
+
+/**
+ * Extract the kernel receive timestamps from a received message
+ *
+ * @param msg Message returned by recvmsg/recvmmsg
+ * @param sw Software timestamp (output, 0 if absent)
+ * @param hw Hardware timestamp (output, 0 if absent)
+ */
+void read_rx_timestamp(struct msghdr *msg, int64_t *sw, int64_t *hw)
+{
+    struct cmsghdr *cmsg;
+    struct scm_timestamping *stamps;
+
+    *sw = 0;
+    *hw = 0;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            stamps = (struct scm_timestamping *)CMSG_DATA(cmsg);
+            *sw = timespec_ns(&stamps->ts[0]);
+            *hw = timespec_ns(&stamps->ts[2]);
+        }
+    }
+}
+
+/**
+ * Drain one batch of the socket's error queue
+ * Two kinds of entries end up there: transmit timestamps, each carrying
+ * the OPT_ID key of the datagram it belongs to (a count of datagrams sent
+ * on the socket from zero), and, on ping sockets with IP_RECVERR, the ICMP
+ * errors the kernel matched to our identifier.
+ *
+ * @param sockfd Socket file descriptor
+ * @param ident Echo identifier of our requests (host byte order)
+ * @param q Error queue buffers; stamps and errors are filled in
+ * @return Number of entries read
+ */
+int read_error_queue(int sockfd, uint16_t ident, t_errqueue *q)
+{
+    struct sock_extended_err *err;
+    struct scm_timestamping *ts;
+    struct cmsghdr *cmsg;
+    struct msghdr *msg;
+    t_reply *reply;
+    int received;
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        q->iov[i].iov_base = q->payloads[i];
+        q->iov[i].iov_len = RECV_BUFFER_SIZE;
+        q->msgs[i].msg_hdr.msg_iov = &q->iov[i];
+        q->msgs[i].msg_hdr.msg_iovlen = 1;
+        q->msgs[i].msg_hdr.msg_name = &q->addrs[i];
+        q->msgs[i].msg_hdr.msg_namelen = sizeof(t_sockaddr);
+        q->msgs[i].msg_hdr.msg_control = q->control[i];
+        q->msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+    }
+    q->stamp_count = 0;
+    q->error_count = 0;
+
+    received = recvmmsg(sockfd, q->msgs, BATCH_SIZE, MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+    if (received <= 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < received; i++) {
+        msg = &q->msgs[i].msg_hdr;
+        err = NULL;
+        ts = NULL;
+        for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                ts = (struct scm_timestamping *)CMSG_DATA(cmsg);
+            } else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                       (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            }
+        }
+        if (!err) {
+            continue;
+        }
+
+        if (err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+            if (ts && err->ee_errno == ENOMSG) {
+                q->stamps[q->stamp_count].key = err->ee_data;
+                q->stamps[q->stamp_count].sw_ns = timespec_ns(&ts->ts[0]);
+                q->stamps[q->stamp_count].hw_ns = timespec_ns(&ts->ts[2]);
+                q->stamp_count++;
+            }
+            continue;
+        }
+
+        /* ICMP errors carry the receive stamp of the error itself */
+        reply = &q->errors[q->error_count];
+        reply->target = q->addrs[i];
+        reply->rx_sw_ns = ts ? timespec_ns(&ts->ts[0]) : 0;
+        reply->rx_hw_ns = ts ? timespec_ns(&ts->ts[2]) : 0;
+        if (parse_queued_error(err, q->payloads[i], q->msgs[i].msg_len, ident, reply) == 0) {
+            q->error_count++;
+        }
+    }
+
+    return received;
+}
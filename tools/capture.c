@@ -0,0 +1,234 @@
+#include "ft_ping.h"
+#include <sys/stat.h>
+
+/* Time between two looks at the rings when following a live capture */
+#define FOLLOW_INTERVAL_MS 100
+
+/* Mapped capture file and how far each ring was read */
+typedef struct s_reader {
+    uint8_t *map;                   /* Whole file, read-only shared mapping */
+    size_t size;                    /* Size of the file */
+    t_capture_header *header;       /* Start of the file */
+    t_capture_head *heads;          /* Ring heads, one per shard */
+    t_capture_target *targets;      /* Target table */
+    t_sample *rings;                /* Rings, one after the other */
+    uint64_t next[SHARD_MAX];       /* Next position to read in each ring */
+    long samples;                   /* Samples printed */
+    long lost;                      /* Samples overwritten before they were read */
+    bool json;                      /* One JSON object per line instead of text */
+} t_reader;
+
+/**
+ * Print usage instructions
+ */
+static void print_capture_usage(void)
+{
+    printf("Usage: ft_ping_capture [options] <file>\n");
+    printf("\nDecode a capture file written by ft_ping -w, oldest sample first.\n");
+    printf("\nOptions:\n");
+    printf("  -f                 follow: keep printing new samples until ft_ping exits\n");
+    printf("  -j                 one JSON object per line\n");
+    printf("  -h                 print help and exit\n");
+}
+
+/**
+ * Map a capture file and check that this reader understands it
+ *
+ * @param r Reader state (output)
+ * @param path Capture file
+ * @return 0 on success, -1 on error
+ */
+static int open_capture(t_reader *r, const char *path)
+{
+    t_capture_header *h;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(t_capture_header)) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        close(fd);
+        return -1;
+    }
+    r->size = st.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    h = (t_capture_header *)r->map;
+    if (memcmp(h->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        return -1;
+    }
+    if (h->byte_order != WIRE_BYTE_ORDER || h->version != CAPTURE_VERSION ||
+        h->sample_size != sizeof(t_sample) || h->target_size != sizeof(t_capture_target)) {
+        fprintf(stderr, "%s: unsupported capture format (version %d)\n", path, h->version);
+        return -1;
+    }
+    if (h->shards < 1 || h->shards > SHARD_MAX || h->capacity == 0 ||
+        (h->capacity & (h->capacity - 1)) != 0 ||
+        h->heads_offset + SHARD_MAX * sizeof(t_capture_head) > r->size ||
+        h->targets_offset + (uint64_t)h->targets * sizeof(t_capture_target) > r->size ||
+        h->rings_offset + (uint64_t)h->shards * h->capacity * sizeof(t_sample) > r->size) {
+        fprintf(stderr, "%s: truncated or corrupt capture file\n", path);
+        return -1;
+    }
+
+    r->header = h;
+    r->heads = (t_capture_head *)(r->map + h->heads_offset);
+    r->targets = (t_capture_target *)(r->map + h->targets_offset);
+    r->rings = (t_sample *)(r->map + h->rings_offset);
+    return 0;
+}
+
+/**
+ * Print one sample
+ *
+ * @param r Reader state
+ * @param s Sample
+ */
+static void print_sample(t_reader *r, t_sample *s)
+{
+    t_capture_target *t;
+    char addr[INET6_ADDRSTRLEN];
+    const char *name;
+    uint8_t family;
+
+    name = "?";
+    strcpy(addr, "?");
+    if (s->target < r->header->targets) {
+        t = &r->targets[s->target];
+        name = t->name;
+        family = __atomic_load_n(&t->family, __ATOMIC_ACQUIRE);
+        if (family == 4 || family == 6) {
+            inet_ntop(family == 6 ? AF_INET6 : AF_INET, t->addr, addr, sizeof(addr));
+        }
+    }
+
+    if (r->json) {
+        printf("{\"target\":%u,\"host\":\"%s\",\"addr\":\"%s\",\"seq\":%u,\"status\":\"%s\","
+               "\"send_ns\":%lld,\"recv_ns\":%lld,\"rtt_ns\":%lld,\"ttl\":%d,\"bytes\":%d",
+               s->target, name, addr, s->seq,
+               s->status == SAMPLE_REPLY ? "reply" : s->status == SAMPLE_ERROR ? "error" : "timeout",
+               (long long)s->send_ns, (long long)s->recv_ns, (long long)s->rtt_ns, s->ttl, s->bytes);
+        if (s->status == SAMPLE_ERROR) {
+            printf(",\"icmp_type\":%d,\"icmp_code\":%d", s->icmp_type, s->icmp_code);
+        }
+        printf("}\n");
+    } else if (s->status == SAMPLE_REPLY) {
+        printf("%lld.%06lld %s (%s): icmp_seq=%u bytes=%d ttl=%d time=%.3f ms\n",
+               (long long)(s->recv_ns / NSEC_PER_SEC), (long long)(s->recv_ns % NSEC_PER_SEC / NSEC_PER_USEC),
+               name, addr, s->seq, s->bytes, s->ttl, (double)s->rtt_ns / NSEC_PER_MSEC);
+    } else if (s->status == SAMPLE_ERROR) {
+        printf("%lld.%06lld %s (%s): icmp_seq=%u icmp error type=%d code=%d after %.3f ms\n",
+               (long long)(s->recv_ns / NSEC_PER_SEC), (long long)(s->recv_ns % NSEC_PER_SEC / NSEC_PER_USEC),
+               name, addr, s->seq, s->icmp_type, s->icmp_code, (double)s->rtt_ns / NSEC_PER_MSEC);
+    } else {
+        printf("%lld.%06lld %s (%s): icmp_seq=%u timeout\n",
+               (long long)(s->recv_ns / NSEC_PER_SEC), (long long)(s->recv_ns % NSEC_PER_SEC / NSEC_PER_USEC),
+               name, addr, s->seq);
+    }
+}
+
+/**
+ * Print every sample added to a ring since the last call
+ * The prober may be overwriting the oldest slots meanwhile: a slot whose
+ * sequence changed while it was copied is counted as lost, not printed.
+ *
+ * @param r Reader state
+ * @param shard Ring to read
+ */
+static void read_ring(t_reader *r, int shard)
+{
+    t_sample *ring, copy;
+    uint64_t head, pos, before, after;
+    uint32_t capacity;
+
+    capacity = r->header->capacity;
+    ring = &r->rings[(size_t)shard * capacity];
+    head = __atomic_load_n(&r->heads[shard].head, __ATOMIC_ACQUIRE);
+
+    /* Samples older than one lap are gone */
+    if (head - r->next[shard] > capacity) {
+        r->lost += head - capacity - r->next[shard];
+        r->next[shard] = head - capacity;
+    }
+
+    for (pos = r->next[shard]; pos < head; pos++) {
+        before = __atomic_load_n(&ring[pos & (capacity - 1)].sequence, __ATOMIC_ACQUIRE);
+        copy = ring[pos & (capacity - 1)];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&ring[pos & (capacity - 1)].sequence, __ATOMIC_RELAXED);
+        if (before != pos + 1 || after != before) {
+            r->lost++;
+            continue;
+        }
+        print_sample(r, &copy);
+        r->samples++;
+    }
+    r->next[shard] = head;
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec interval;
+    t_reader r;
+    bool follow, done;
+    uint64_t head;
+    int opt;
+
+    memset(&r, 0, sizeof(r));
+    follow = false;
+    while ((opt = getopt(argc, argv, "fjh")) != -1) {
+        switch (opt) {
+            case 'f': follow = true; break;
+            case 'j': r.json = true; break;
+            case 'h': print_capture_usage(); return 0;
+            default: print_capture_usage(); return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        print_capture_usage();
+        return 1;
+    }
+    if (open_capture(&r, argv[optind]) < 0) {
+        return 1;
+    }
+
+    /* Start at the oldest sample still in each ring */
+    for (uint32_t s = 0; s < r.header->shards; s++) {
+        head = __atomic_load_n(&r.heads[s].head, __ATOMIC_ACQUIRE);
+        r.next[s] = head > r.header->capacity ? head - r.header->capacity : 0;
+    }
+
+    interval.tv_sec = 0;
+    interval.tv_nsec = FOLLOW_INTERVAL_MS * NSEC_PER_MSEC;
+    do {
+        /* Samples written before the end mark are read on this last pass */
+        done = __atomic_load_n(&r.header->end_ns, __ATOMIC_ACQUIRE) != 0;
+        for (uint32_t s = 0; s < r.header->shards; s++) {
+            read_ring(&r, s);
+        }
+        if (follow && !done) {
+            fflush(stdout);
+            nanosleep(&interval, NULL);
+        }
+    } while (follow && !done);
+
+    fflush(stdout);
+    if (r.lost > 0) {
+        fprintf(stderr, "ft_ping_capture: %ld samples overwritten before they were read\n", r.lost);
+    }
+    if (!done) {
+        fprintf(stderr, "ft_ping_capture: capture still open or not closed cleanly\n");
+    }
+    munmap(r.map, r.size);
+    return 0;
+}
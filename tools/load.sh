@@ -0,0 +1,179 @@
+#!/bin/sh
+# End-to-end load scenarios: ft_ping against ft_ping_responder on a TUN device.
+#
+# Each scenario starts a responder with a given delay, jitter, loss,
+# duplication, reordering, share of requests refused with an ICMP error
+# and share of replies damaged, pings a set of addresses behind it at a
+# given rate, and checks that the achieved rate, the median RTT and the
+# reported loss, errors, duplicates and corrupted replies match what was
+# configured. Trace scenarios put routers in front of the targets (-t),
+# path MTU scenarios a narrower link, black hole or not (-P). One JSON
+# object is printed per scenario; the exit status is non-zero if any
+# scenario is out of tolerance.
+#
+# Needs root (TUN device and raw socket). Run from the repository root,
+# after `make ft_ping ft_ping_responder`, or through `make load`.
+
+PING=${PING:-./ft_ping}
+RESPONDER=${RESPONDER:-./ft_ping_responder}
+IFNAME=${IFNAME:-ftping0}
+NETWORK=10.99.0.1/16
+WORKDIR=$(mktemp -d)
+FAILED=0
+
+trap 'pkill -TERM -f "$RESPONDER -n $IFNAME" 2>/dev/null; rm -rf "$WORKDIR"' EXIT
+
+# Write the first N addresses of 10.99.1.0/16 to a target file
+targets() {
+    i=0
+    : > "$WORKDIR/targets"
+    while [ "$i" -lt "$1" ]; do
+        echo "10.99.$((1 + i / 250)).$((1 + i % 250))" >> "$WORKDIR/targets"
+        i=$((i + 1))
+    done
+}
+
+# Start a responder on the device with the given options
+start_responder() {
+    "$RESPONDER" -n "$IFNAME" -a "$NETWORK" "$@" > "$WORKDIR/responder.json" &
+    responder=$!
+    sleep 0.5
+}
+
+# Stop the responder once the replies still on their way are written
+stop_responder() {
+    sleep 0.2
+    kill -TERM "$responder"
+    wait "$responder"
+}
+
+# scenario NAME TARGETS INTERVAL SECONDS DELAY_MS JITTER_MS LOSS% DUP% REORDER% REFUSED% CORRUPT%
+scenario() {
+    name=$1 count=$2 interval=$3 seconds=$4
+    delay=$5 jitter=$6 loss=$7 dup=$8 reorder=$9 refused=${10} corrupt=${11}
+
+    targets "$count"
+    start_responder -d "$delay" -j "$jitter" -l "$loss" -D "$dup" -r "$reorder" \
+        -U "$refused" -C "$corrupt"
+    timeout -s INT "$seconds" "$PING" -i "$interval" -F "$WORKDIR/targets" \
+        > "$WORKDIR/ping.txt" 2>&1
+    stop_responder
+
+    # Totals are the last "transmitted" line (summary for several targets)
+    awk -v name="$name" -v count="$count" -v interval="$interval" \
+        -v delay="$delay" -v jitter="$jitter" -v loss="$loss" -v dup="$dup" -v refused="$refused" \
+        -v corrupt="$corrupt" \
+        -v counters="$(cat "$WORKDIR/responder.json")" '
+        # "+N duplicates, +N corrupted, +N errors, " sit between received and loss
+        /packets transmitted/ {
+            sent = $1; received = $4; errors = duplicates = corrupted = 0
+            for (i = 6; $i ~ /^[+]/; i += 2) {
+                if ($(i + 1) ~ /^errors/) errors = substr($i, 2)
+                if ($(i + 1) ~ /^duplicates/) duplicates = substr($i, 2)
+                if ($(i + 1) ~ /^corrupted/) corrupted = substr($i, 2)
+            }
+        }
+        /^rtt p50/ { split($4, q, "/"); p50 = q[1] }
+        /^rate: requested/ { requested = $3; achieved = $6 }
+        END {
+            measured_loss = sent ? 100 * (sent - received) / sent : 100
+            # Refused requests are lost too, and each one reported as an
+            # error; so are damaged replies, each one reported as corrupted
+            answered = (100 - loss) * (100 - refused) / 100
+            expected = 100 - answered * (100 - corrupt) / 100
+            measured_errors = sent ? 100 * errors / sent : 0
+            measured_dup = sent ? 100 * duplicates / sent : 0
+            measured_corrupt = sent ? 100 * corrupted / sent : 0
+            expected_corrupt = answered * corrupt / 100
+            ok = 1
+            # Rate within 10% of the request
+            if (achieved < 0.9 * requested) ok = 0
+            # Median RTT within the jitter band, plus 2 ms of host overhead
+            if (p50 < delay - jitter || p50 > delay + jitter + 2) ok = 0
+            # Loss within 2 points of the configured loss, plus the probes
+            # still in flight when the run is interrupted
+            inflight = 100 * count * (delay + jitter) / (interval * 1000) / (sent ? sent : 1)
+            if (measured_loss < expected - 2 || measured_loss > expected + 2 + inflight) ok = 0
+            if (measured_errors < refused - 2 || measured_errors > refused + 2) ok = 0
+            # Every duplicate recognized as such, and every damaged payload
+            # caught, with no false alarm when none is damaged
+            if (measured_dup < dup - 5 || measured_dup > dup + 5) ok = 0
+            if (corrupt == 0 ? corrupted > 0 : measured_corrupt < expected_corrupt - 3 ||
+                measured_corrupt > expected_corrupt + 3) ok = 0
+            printf "{\"scenario\":\"%s\",\"targets\":%d,\"requested_pps\":%s,\"achieved_pps\":%s," \
+                   "\"sent\":%d,\"received\":%d,\"errors\":%d,\"duplicates\":%d,\"corrupted\":%d," \
+                   "\"loss\":%.2f,\"expected_loss\":%.2f," \
+                   "\"p50_ms\":%s,\"delay_ms\":%s,\"responder\":%s,\"ok\":%s}\n",
+                   name, count, requested, achieved, sent, received, errors, duplicates, corrupted,
+                   measured_loss, expected,
+                   p50, delay, counters, ok ? "true" : "false"
+            exit !ok
+        }' "$WORKDIR/ping.txt" || FAILED=1
+}
+
+# trace_scenario NAME HOPS
+trace_scenario() {
+    name=$1 hops=$2
+
+    start_responder -d 1 -H "$hops"
+    timeout -s INT 5 "$PING" -t "$((hops + 4))" 10.99.1.1 > "$WORKDIR/ping.txt" 2>&1
+    stop_responder
+
+    # Routers take the top addresses of the network, the last one nearest
+    # the targets; the sweep ends at the target, HOPS hops away
+    awk -v name="$name" -v hops="$hops" -v counters="$(cat "$WORKDIR/responder.json")" '
+        /^ *[0-9]+  / {
+            ttl = $1
+            expected = ttl < hops ? "10.99.255." (255 - hops + ttl) : "10.99.1.1"
+            if ($2 == expected) matched++
+            if ($2 == "10.99.1.1" && !reached) reached = ttl
+        }
+        END {
+            ok = reached == hops && matched == hops
+            printf "{\"scenario\":\"%s\",\"hops\":%d,\"reached_at\":%d,\"matched\":%d," \
+                   "\"responder\":%s,\"ok\":%s}\n",
+                   name, hops, reached, matched, counters, ok ? "true" : "false"
+            exit !ok
+        }' "$WORKDIR/ping.txt" || FAILED=1
+}
+
+# pmtu_scenario NAME MTU [-b]
+pmtu_scenario() {
+    name=$1 mtu=$2
+    shift 2
+
+    start_responder -d 1 -m "$mtu" "$@"
+    timeout -s INT 10 "$PING" -P 10.99.1.1 > "$WORKDIR/ping.txt" 2>&1
+    stop_responder
+
+    # Found whether the narrow link says so (fragmentation needed) or
+    # silently drops what does not fit
+    awk -v name="$name" -v mtu="$mtu" -v counters="$(cat "$WORKDIR/responder.json")" '
+        / pmtu [0-9]/ { for (i = 1; i < NF; i++) if ($i == "pmtu") found = $(i + 1) }
+        END {
+            ok = found == mtu
+            printf "{\"scenario\":\"%s\",\"mtu\":%d,\"found\":%d,\"responder\":%s,\"ok\":%s}\n",
+                   name, mtu, found, counters, ok ? "true" : "false"
+            exit !ok
+        }' "$WORKDIR/ping.txt" || FAILED=1
+}
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "load.sh: needs root for the TUN device" >&2
+    exit 1
+fi
+
+scenario baseline     1    0.01   3  1   0    0  0  0  0  0
+scenario delay        1    0.01   3  20  2    0  0  0  0  0
+scenario loss         1    0.002  4  5   0    10 0  0  0  0
+scenario duplicate    1    0.005  3  5   0    0  20 0  0  0
+scenario reorder      1    0.002  3  5   1    0  0  20 0  0
+scenario refused      1    0.002  4  5   0    0  0  0  20 0
+scenario corrupted    1    0.002  4  5   0    0  0  0  0  10
+scenario many_targets 500  0.1    3  10  1    0  0  0  0  0
+scenario high_rate    1000 0.05   4  2   0    1  0  0  0  0
+trace_scenario  trace      4
+pmtu_scenario   pmtu       1400
+pmtu_scenario   black_hole 1400 -b
+
+exit $FAILED
@@ -0,0 +1,692 @@
+#include "ft_ping.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <linux/if_tun.h>
+
+/* Default network answered by the responder (address of the TUN side) */
+#define DEFAULT_NETWORK "10.99.0.1/16"
+#define DEFAULT_IFNAME "ftping0"
+
+/* Extra delay given to reordered replies, so later ones overtake them */
+#define DEFAULT_REORDER_MS 5.0
+
+/* Largest packet read from the TUN device */
+#define RESPONDER_MTU 65535
+
+/* Replies waiting for their send time; requests beyond this are dropped */
+#define RESPONDER_QUEUE 65536
+
+/* Largest ICMP error sent, quoted request included (RFC 1812, 4.3.2.3) */
+#define ERROR_MAX 576
+
+/* Reply waiting for its send time */
+typedef struct s_pending {
+    int64_t due_ns;                 /* Time to write the reply (monotonic) */
+    int len;                        /* Size of the reply */
+    uint8_t *packet;                /* IPv4 echo reply */
+} t_pending;
+
+typedef struct s_responder {
+    int fd;                         /* TUN device */
+    double delay_ms;                /* Base one-way delay added to every reply */
+    double jitter_ms;               /* Uniform jitter around the delay */
+    double loss;                    /* Probability of dropping a request */
+    double duplicate;               /* Probability of answering twice */
+    double reorder;                 /* Probability of holding a reply back */
+    double reorder_ms;              /* Extra delay of held back replies */
+    double refuse;                  /* Probability of answering with an ICMP error */
+    double corrupt;                 /* Probability of damaging a reply's payload */
+    int hops;                       /* Routers before the targets + 1, 0 for none */
+    int mtu;                        /* MTU of a link on the way, 0 for the device's */
+    bool black_hole;                /* Requests too large for that link vanish instead */
+    uint32_t routers;               /* The router at hop t is this address plus t (host order) */
+    uint64_t rng;                   /* xorshift state, for reproducible runs */
+    t_pending *heap;                /* Replies ordered by send time */
+    int count;                      /* Number of queued replies */
+    long requests;                  /* Echo requests read */
+    long replies;                   /* Replies written, duplicates included */
+    long lost;                      /* Requests dropped on purpose */
+    long duplicated;                /* Requests answered twice */
+    long reordered;                 /* Replies held back */
+    long refused;                   /* Requests answered with an ICMP error */
+    long corrupted;                 /* Replies whose payload was damaged */
+    long expired;                   /* Requests whose TTL ran out at a router */
+    long too_big;                   /* Requests with DF set too large for the link */
+    long overflow;                  /* Requests dropped because the queue was full */
+} t_responder;
+
+volatile bool g_running = true;
+
+/**
+ * Stop the responder on SIGINT or SIGTERM
+ *
+ * @param signo Signal number
+ */
+static void stop(int signo)
+{
+    (void)signo;
+    g_running = false;
+}
+
+/**
+ * Draw a uniform number in [0, 1)
+ *
+ * @param r Responder
+ * @return Random number
+ */
+static double uniform(t_responder *r)
+{
+    r->rng ^= r->rng << 13;
+    r->rng ^= r->rng >> 7;
+    r->rng ^= r->rng << 17;
+    return (r->rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Queue a reply, keeping the earliest one at the top of the heap
+ *
+ * @param r Responder
+ * @param packet Reply to copy
+ * @param len Size of the reply
+ * @param due_ns Time to write the reply
+ * @return 0 on success, -1 if the queue is full
+ */
+static int heap_push(t_responder *r, uint8_t *packet, int len, int64_t due_ns)
+{
+    t_pending entry;
+    int i, parent;
+
+    if (r->count == RESPONDER_QUEUE) {
+        return -1;
+    }
+    entry.packet = malloc(len);
+    if (!entry.packet) {
+        return -1;
+    }
+    memcpy(entry.packet, packet, len);
+    entry.len = len;
+    entry.due_ns = due_ns;
+
+    i = r->count++;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (r->heap[parent].due_ns <= due_ns) {
+            break;
+        }
+        r->heap[i] = r->heap[parent];
+        i = parent;
+    }
+    r->heap[i] = entry;
+
+    return 0;
+}
+
+/**
+ * Remove the earliest reply from the heap
+ *
+ * @param r Responder
+ * @return Earliest reply, owned by the caller
+ */
+static t_pending heap_pop(t_responder *r)
+{
+    t_pending top, last;
+    int i, child;
+
+    top = r->heap[0];
+    last = r->heap[--r->count];
+
+    i = 0;
+    while ((child = 2 * i + 1) < r->count) {
+        if (child + 1 < r->count && r->heap[child + 1].due_ns < r->heap[child].due_ns) {
+            child++;
+        }
+        if (last.due_ns <= r->heap[child].due_ns) {
+            break;
+        }
+        r->heap[i] = r->heap[child];
+        i = child;
+    }
+    r->heap[i] = last;
+
+    return top;
+}
+
+/**
+ * Find the echo request in a packet read from the TUN device
+ *
+ * @param packet IPv4 packet
+ * @param len Size of the packet
+ * @return ICMP header of the request, or NULL if the packet is not one
+ */
+static struct icmphdr *echo_request(uint8_t *packet, int len)
+{
+    struct ip *ip;
+    struct icmphdr *icmp;
+    int hlen;
+
+    ip = (struct ip *)packet;
+    if (len < (int)sizeof(struct ip) || ip->ip_v != 4 || ip->ip_p != IPPROTO_ICMP) {
+        return NULL;
+    }
+    hlen = ip->ip_hl << 2;
+    if (len < hlen + (int)sizeof(struct icmphdr)) {
+        return NULL;
+    }
+    icmp = (struct icmphdr *)(packet + hlen);
+    if (icmp->type != ICMP_ECHO || icmp->code != 0) {
+        return NULL;
+    }
+
+    return icmp;
+}
+
+/**
+ * Build an ICMP error about a request
+ * As much of the request is quoted as fits in ERROR_MAX bytes.
+ *
+ * @param packet Echo request
+ * @param len Size of the request
+ * @param error Buffer of ERROR_MAX bytes (output)
+ * @param type ICMP type of the error
+ * @param code ICMP code of the error
+ * @param from Host sending the error
+ * @param ttl TTL the error arrives with
+ * @param mtu Next-hop MTU (fragmentation needed), 0 otherwise
+ * @return Size of the error
+ */
+static int make_error(uint8_t *packet, int len, uint8_t *error, int type, int code, struct in_addr from, int ttl,
+                      int mtu)
+{
+    struct ip *request, *ip;
+    struct icmphdr *icmp;
+    int quoted;
+
+    quoted = len;
+    if (quoted > ERROR_MAX - (int)(sizeof(struct ip) + sizeof(struct icmphdr))) {
+        quoted = ERROR_MAX - (int)(sizeof(struct ip) + sizeof(struct icmphdr));
+    }
+    request = (struct ip *)packet;
+    ip = (struct ip *)error;
+    icmp = (struct icmphdr *)(error + sizeof(struct ip));
+    memset(error, 0, sizeof(struct ip) + sizeof(struct icmphdr));
+    memcpy(icmp + 1, packet, quoted);
+
+    icmp->type = type;
+    icmp->code = code;
+    icmp->un.frag.mtu = htons(mtu);
+    icmp->checksum = compute_checksum(icmp, sizeof(struct icmphdr) + quoted);
+
+    ip->ip_v = 4;
+    ip->ip_hl = sizeof(struct ip) >> 2;
+    ip->ip_len = htons(sizeof(struct ip) + sizeof(struct icmphdr) + quoted);
+    ip->ip_ttl = ttl;
+    ip->ip_p = IPPROTO_ICMP;
+    ip->ip_src = from;
+    ip->ip_dst = request->ip_src;
+    ip->ip_sum = compute_checksum(ip, sizeof(struct ip));
+
+    return sizeof(struct ip) + sizeof(struct icmphdr) + quoted;
+}
+
+/**
+ * Turn an echo request into its reply, in place
+ *
+ * @param packet IPv4 packet read from the TUN device
+ * @param len Size of the packet
+ * @param ttl TTL the reply arrives with
+ * @return 0 if the packet was an echo request, -1 otherwise
+ */
+static int make_reply(uint8_t *packet, int len, int ttl)
+{
+    struct ip *ip;
+    struct icmphdr *icmp;
+    struct in_addr addr;
+    uint16_t old_word, new_word;
+    int hlen;
+
+    icmp = echo_request(packet, len);
+    if (!icmp) {
+        return -1;
+    }
+    ip = (struct ip *)packet;
+    hlen = ip->ip_hl << 2;
+
+    /* Only the type changes, so patch the ICMP checksum incrementally */
+    memcpy(&old_word, icmp, sizeof(old_word));
+    icmp->type = ICMP_ECHOREPLY;
+    memcpy(&new_word, icmp, sizeof(new_word));
+    icmp->checksum = checksum_update(icmp->checksum, old_word, new_word);
+
+    addr = ip->ip_src;
+    ip->ip_src = ip->ip_dst;
+    ip->ip_dst = addr;
+    ip->ip_ttl = ttl;
+    ip->ip_sum = 0;
+    ip->ip_sum = compute_checksum(ip, hlen);
+
+    return 0;
+}
+
+/**
+ * Flip one random payload byte of a reply, keeping its checksum valid
+ * so only the prober's payload check can tell
+ *
+ * @param r Responder
+ * @param packet IPv4 echo reply
+ * @param len Size of the reply
+ */
+static void corrupt_reply(t_responder *r, uint8_t *packet, int len)
+{
+    struct icmphdr *icmp;
+    int hlen, size;
+
+    hlen = ((struct ip *)packet)->ip_hl << 2;
+    icmp = (struct icmphdr *)(packet + hlen);
+    size = len - hlen - (int)sizeof(struct icmphdr);
+    if (size <= 0) {
+        return;
+    }
+    ((uint8_t *)(icmp + 1))[(int)(uniform(r) * size) % size] ^= 0xFF;
+    icmp->checksum = 0;
+    icmp->checksum = compute_checksum(icmp, len - hlen);
+}
+
+/**
+ * Schedule one reply with the configured delay, jitter and reordering
+ *
+ * @param r Responder
+ * @param packet Reply
+ * @param len Size of the reply
+ * @param now_ns Current time (monotonic)
+ */
+static void schedule_reply(t_responder *r, uint8_t *packet, int len, int64_t now_ns)
+{
+    double delay_ms;
+
+    delay_ms = r->delay_ms + r->jitter_ms * (2.0 * uniform(r) - 1.0);
+    if (r->reorder > 0 && uniform(r) < r->reorder) {
+        delay_ms += r->reorder_ms;
+        r->reordered++;
+    }
+    if (delay_ms < 0) {
+        delay_ms = 0;
+    }
+
+    if (heap_push(r, packet, len, now_ns + (int64_t)(delay_ms * NSEC_PER_MSEC)) < 0) {
+        r->overflow++;
+    }
+}
+
+/**
+ * Read every pending request from the TUN device and schedule the replies
+ *
+ * @param r Responder
+ * @param buffer Scratch buffer of RESPONDER_MTU bytes
+ */
+static void read_requests(t_responder *r, uint8_t *buffer)
+{
+    uint8_t error[ERROR_MAX];
+    struct in_addr router;
+    int64_t now_ns;
+    int len, ttl;
+
+    while ((len = read(r->fd, buffer, RESPONDER_MTU)) > 0) {
+        if (!echo_request(buffer, len)) {
+            continue;
+        }
+        r->requests++;
+        if (r->loss > 0 && uniform(r) < r->loss) {
+            r->lost++;
+            continue;
+        }
+
+        /* A request sent with a TTL too small for the path dies at a router,
+           which answers with a TTL counted down on the way back */
+        now_ns = monotonic_ns();
+        ttl = ((struct ip *)buffer)->ip_ttl;
+        if (ttl < r->hops) {
+            router.s_addr = htonl(r->routers + ttl);
+            schedule_reply(r, error, make_error(buffer, len, error, ICMP_TIME_EXCEEDED, ICMP_EXC_TTL,
+                                                router, DEFAULT_TTL - ttl + 1, 0), now_ns);
+            r->expired++;
+            continue;
+        }
+
+        /* A request that may not be fragmented stops at the narrow link,
+           whose router says how large a packet it takes, or says nothing */
+        if (r->mtu > 0 && len > r->mtu && (ntohs(((struct ip *)buffer)->ip_off) & IP_DF)) {
+            r->too_big++;
+            if (!r->black_hole) {
+                router.s_addr = r->hops > 0 ? htonl(r->routers + 1) : ((struct ip *)buffer)->ip_dst.s_addr;
+                schedule_reply(r, error, make_error(buffer, len, error, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED,
+                                                    router, DEFAULT_TTL, r->mtu), now_ns);
+            }
+            continue;
+        }
+        if (r->refuse > 0 && uniform(r) < r->refuse) {
+            schedule_reply(r, error, make_error(buffer, len, error, ICMP_DEST_UNREACH, ICMP_PKT_FILTERED,
+                                                ((struct ip *)buffer)->ip_dst,
+                                                DEFAULT_TTL - (r->hops > 0 ? r->hops - 1 : 0), 0), now_ns);
+            r->refused++;
+            continue;
+        }
+        make_reply(buffer, len, DEFAULT_TTL - (r->hops > 0 ? r->hops - 1 : 0));
+        if (r->corrupt > 0 && uniform(r) < r->corrupt) {
+            corrupt_reply(r, buffer, len);
+            r->corrupted++;
+        }
+        schedule_reply(r, buffer, len, now_ns);
+        if (r->duplicate > 0 && uniform(r) < r->duplicate) {
+            schedule_reply(r, buffer, len, now_ns);
+            r->duplicated++;
+        }
+    }
+}
+
+/**
+ * Write every reply whose send time has come
+ *
+ * @param r Responder
+ */
+static void write_replies(t_responder *r)
+{
+    t_pending entry;
+    int64_t now_ns;
+
+    now_ns = monotonic_ns();
+    while (r->count > 0 && r->heap[0].due_ns <= now_ns) {
+        entry = heap_pop(r);
+        if (write(r->fd, entry.packet, entry.len) == entry.len) {
+            r->replies++;
+        }
+        free(entry.packet);
+    }
+}
+
+/**
+ * Create the TUN device, give it an address and bring it up
+ * The kernel then routes the whole network to the device.
+ *
+ * @param ifname Name of the device
+ * @param network Address and prefix length of the device (a.b.c.d/len)
+ * @param broadcast Last address of the network, host order (output)
+ * @return TUN file descriptor or -1 on error
+ */
+static int open_tun(const char *ifname, const char *network, uint32_t *broadcast)
+{
+    struct ifreq ifr;
+    struct sockaddr_in *sin;
+    char address[INET_ADDRSTRLEN];
+    const char *slash;
+    int fd, sockfd, prefix;
+
+    slash = strchr(network, '/');
+    prefix = slash ? atoi(slash + 1) : 24;
+    if (!slash || slash - network >= INET_ADDRSTRLEN || prefix < 1 || prefix > 30) {
+        fprintf(stderr, "responder: invalid network: '%s'\n", network);
+        return -1;
+    }
+    memcpy(address, network, slash - network);
+    address[slash - network] = '\0';
+
+    fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open /dev/net/tun");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        perror("ioctl TUNSETIFF");
+        close(fd);
+        return -1;
+    }
+
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        close(fd);
+        return -1;
+    }
+
+    sin = (struct sockaddr_in *)&ifr.ifr_addr;
+    sin->sin_family = AF_INET;
+    if (inet_pton(AF_INET, address, &sin->sin_addr) != 1 ||
+        ioctl(sockfd, SIOCSIFADDR, &ifr) < 0) {
+        perror("ioctl SIOCSIFADDR");
+        goto error;
+    }
+    *broadcast = ntohl(sin->sin_addr.s_addr) | ~(~0U << (32 - prefix));
+    sin->sin_addr.s_addr = htonl(~0U << (32 - prefix));
+    if (ioctl(sockfd, SIOCSIFNETMASK, &ifr) < 0) {
+        perror("ioctl SIOCSIFNETMASK");
+        goto error;
+    }
+    if (ioctl(sockfd, SIOCGIFFLAGS, &ifr) < 0) {
+        perror("ioctl SIOCGIFFLAGS");
+        goto error;
+    }
+    ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+    if (ioctl(sockfd, SIOCSIFFLAGS, &ifr) < 0) {
+        perror("ioctl SIOCSIFFLAGS");
+        goto error;
+    }
+
+    close(sockfd);
+    return fd;
+
+error:
+    close(sockfd);
+    close(fd);
+    return -1;
+}
+
+/**
+ * Parse a percentage option into a probability
+ *
+ * @param arg Option argument
+ * @param value Probability (output)
+ * @return 0 on success, -1 if the argument is not between 0 and 100
+ */
+static int parse_percent(const char *arg, double *value)
+{
+    char *end;
+    double percent;
+
+    percent = strtod(arg, &end);
+    if (*end != '\0' || percent < 0 || percent > 100) {
+        fprintf(stderr, "responder: invalid percentage: '%s'\n", arg);
+        return -1;
+    }
+    *value = percent / 100.0;
+    return 0;
+}
+
+/**
+ * Parse a non-negative duration in milliseconds
+ *
+ * @param arg Option argument
+ * @param value Duration (output)
+ * @return 0 on success, -1 on error
+ */
+static int parse_ms(const char *arg, double *value)
+{
+    char *end;
+
+    *value = strtod(arg, &end);
+    if (*end != '\0' || *value < 0) {
+        fprintf(stderr, "responder: invalid duration: '%s'\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Parse the number of hops to the targets
+ *
+ * @param arg Option argument
+ * @param value Hops (output)
+ * @return 0 on success, -1 on error
+ */
+static int parse_hops(const char *arg, int *value)
+{
+    char *end;
+    long hops;
+
+    hops = strtol(arg, &end, 10);
+    if (*end != '\0' || hops < 1 || hops > DEFAULT_TTL) {
+        fprintf(stderr, "responder: invalid hop count: '%s' (1-%d)\n", arg, DEFAULT_TTL);
+        return -1;
+    }
+    *value = (int)hops;
+    return 0;
+}
+
+/**
+ * Parse the MTU of the narrow link
+ *
+ * @param arg Option argument
+ * @param value MTU (output)
+ * @return 0 on success, -1 on error
+ */
+static int parse_mtu(const char *arg, int *value)
+{
+    char *end;
+    long mtu;
+
+    mtu = strtol(arg, &end, 10);
+    if (*end != '\0' || mtu < 68 || mtu > RESPONDER_MTU) {
+        fprintf(stderr, "responder: invalid mtu: '%s' (68-%d)\n", arg, RESPONDER_MTU);
+        return -1;
+    }
+    *value = (int)mtu;
+    return 0;
+}
+
+/**
+ * Print usage instructions
+ */
+static void print_responder_usage(void)
+{
+    printf("Usage: ft_ping_responder [options]\n");
+    printf("\nAnswers ICMP echo requests routed to a TUN device.\n");
+    printf("\nOptions:\n");
+    printf("  -a <addr/len>      address of the device, whose network is answered (%s)\n", DEFAULT_NETWORK);
+    printf("  -n <name>          name of the device (%s)\n", DEFAULT_IFNAME);
+    printf("  -d <ms>            delay added to every reply\n");
+    printf("  -j <ms>            uniform jitter around the delay\n");
+    printf("  -l <percent>       requests dropped\n");
+    printf("  -D <percent>       requests answered twice\n");
+    printf("  -r <percent>       replies held back so later ones overtake them\n");
+    printf("  -R <ms>            extra delay of held back replies (%.1f)\n", DEFAULT_REORDER_MS);
+    printf("  -U <percent>       requests answered with an ICMP error (packet filtered)\n");
+    printf("  -C <percent>       replies whose payload is damaged (checksum kept valid)\n");
+    printf("  -H <hops>          targets are hops away, behind routers at the top of the network\n");
+    printf("  -m <mtu>           a link on the way takes packets up to mtu: larger ones with DF\n");
+    printf("                     get fragmentation needed, from the first router if any\n");
+    printf("  -b                 larger ones vanish instead (a path mtu black hole)\n");
+    printf("  -S <seed>          random seed\n");
+    printf("\nCounters are printed as JSON on exit (SIGINT or SIGTERM).\n");
+}
+
+int main(int argc, char **argv)
+{
+    t_responder r;
+    const char *network, *ifname;
+    uint8_t *buffer;
+    struct pollfd pfd;
+    struct timespec timeout;
+    int64_t wait_ns;
+    int opt, ret;
+
+    memset(&r, 0, sizeof(r));
+    r.reorder_ms = DEFAULT_REORDER_MS;
+    r.rng = 0x9E3779B97F4A7C15ULL;
+    network = DEFAULT_NETWORK;
+    ifname = DEFAULT_IFNAME;
+
+    while ((opt = getopt(argc, argv, "a:n:d:j:l:D:r:R:U:C:H:m:bS:h")) != -1) {
+        ret = 0;
+        switch (opt) {
+            case 'a': network = optarg; break;
+            case 'n': ifname = optarg; break;
+            case 'd': ret = parse_ms(optarg, &r.delay_ms); break;
+            case 'j': ret = parse_ms(optarg, &r.jitter_ms); break;
+            case 'l': ret = parse_percent(optarg, &r.loss); break;
+            case 'D': ret = parse_percent(optarg, &r.duplicate); break;
+            case 'r': ret = parse_percent(optarg, &r.reorder); break;
+            case 'R': ret = parse_ms(optarg, &r.reorder_ms); break;
+            case 'U': ret = parse_percent(optarg, &r.refuse); break;
+            case 'C': ret = parse_percent(optarg, &r.corrupt); break;
+            case 'H': ret = parse_hops(optarg, &r.hops); break;
+            case 'm': ret = parse_mtu(optarg, &r.mtu); break;
+            case 'b': r.black_hole = true; break;
+            case 'S': r.rng = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': print_responder_usage(); return 0;
+            default: print_responder_usage(); return 1;
+        }
+        if (ret < 0) {
+            return 1;
+        }
+    }
+
+    r.heap = malloc(RESPONDER_QUEUE * sizeof(t_pending));
+    buffer = malloc(RESPONDER_MTU);
+    if (!r.heap || !buffer) {
+        perror("malloc");
+        return 1;
+    }
+
+    r.fd = open_tun(ifname, network, &r.routers);
+    if (r.fd < 0) {
+        return 1;
+    }
+    /* Routers take the addresses just below the broadcast address */
+    r.routers -= r.hops;
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    pfd.fd = r.fd;
+    pfd.events = POLLIN;
+    while (g_running) {
+        /* Sleep until a request arrives or the earliest reply is due */
+        wait_ns = NSEC_PER_SEC;
+        if (r.count > 0) {
+            wait_ns = r.heap[0].due_ns - monotonic_ns();
+            if (wait_ns < 0) {
+                wait_ns = 0;
+            }
+        }
+        timeout.tv_sec = wait_ns / NSEC_PER_SEC;
+        timeout.tv_nsec = wait_ns % NSEC_PER_SEC;
+
+        ret = ppoll(&pfd, 1, &timeout, NULL);
+        if (ret < 0 && errno != EINTR) {
+            perror("ppoll");
+            break;
+        }
+        if (ret > 0) {
+            read_requests(&r, buffer);
+        }
+        write_replies(&r);
+    }
+
+    printf("{\"requests\":%ld,\"replies\":%ld,\"lost\":%ld,\"duplicated\":%ld,"
+           "\"reordered\":%ld,\"refused\":%ld,\"corrupted\":%ld,\"expired\":%ld,\"too_big\":%ld,"
+           "\"overflow\":%ld,\"pending\":%d}\n",
+           r.requests, r.replies, r.lost, r.duplicated, r.reordered, r.refused, r.corrupted, r.expired,
+           r.too_big, r.overflow, r.count);
+
+    while (r.count > 0) {
+        free(heap_pop(&r).packet);
+    }
+    free(r.heap);
+    free(buffer);
+    close(r.fd);
+    return 0;
+}